@@ -1,14 +1,22 @@
 #include "FormulaAST.h"
 
+#include "aggregate.h"
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
 
 namespace ASTImpl {
 
@@ -69,33 +77,331 @@ constexpr PrecedenceRule PRECEDENCE_RULES[EP_END][EP_END] = {
 
 class Expr {
 public:
-    virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
-    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
+    // formulas are printed into a string, they are read far more often
+    // than the debug tree
+    virtual void DoPrintFormula(std::string& out, ExprPrecedence precedence) const = 0;
     virtual double Evaluate(const SheetInterface& sheet) const = 0;
+    // appends the postfix form of the expression to the program
+    virtual void Compile(std::vector<Instruction>& program) const = 0;
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
-    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+    void PrintFormula(std::string& out, ExprPrecedence parent_precedence,
         bool right_child = false) const {
         auto precedence = GetPrecedence();
         auto mask = right_child ? PR_RIGHT : PR_LEFT;
         bool parens_needed = PRECEDENCE_RULES[parent_precedence][precedence] & mask;
         if (parens_needed) {
-            out << '(';
+            out += '(';
         }
 
         DoPrintFormula(out, precedence);
 
         if (parens_needed) {
-            out << ')';
+            out += ')';
         }
     }
+
+protected:
+    // nodes live in the formula arena and are never destroyed one by one
+    ~Expr() = default;
 };
 
 namespace {
 
+double GetCellValue(const SheetInterface& sheet, Position pos) {
+    if (!pos.IsValid())
+        throw FormulaError(FormulaError::Category::Ref);
+
+    const auto cell = sheet.GetCell(pos);
+    if (!cell) {
+        return 0;
+    }
+    const auto value = cell->GetValue();
+    switch (value.index()) {
+    case 0:
+        if (std::get<std::string>(value).empty())
+            return 0;
+        else
+            throw FormulaError(FormulaError::Category::Value);
+    case 1:
+        return std::get<double>(value);
+    case 2:
+        throw std::get<FormulaError>(value);
+    default:
+        throw FormulaException("Unexpected error");
+    }
+}
+
+// The sheet a reference points to, an unknown name is a #REF! error
+const SheetInterface& ResolveSheet(const SheetInterface& sheet, std::string_view name) {
+    if (name.empty()) {
+        return sheet;
+    }
+    if (const SheetInterface* other = sheet.FindSheet(name)) {
+        return *other;
+    }
+    throw FormulaError(FormulaError::Category::Ref);
+}
+
+// Sheet of a reference: no name for the own sheet, otherwise the index of
+// the name among the sheets of the formula plus one, as in Instruction
+struct SheetName {
+    std::string_view name;
+    uint16_t index = 0;
+};
+
+// Names of the other sheets of a formula, each copied once into its arena
+class SheetNameTable {
+public:
+    SheetName Add(Arena& arena, std::string_view name) {
+        for (size_t i = 0; i < names_.size(); ++i) {
+            if (names_[i] == name) {
+                return { names_[i], static_cast<uint16_t>(i + 1) };
+            }
+        }
+        if (UINT16_MAX == names_.size()) {
+            throw ParsingError("Too many sheets in a formula");
+        }
+        char* data = arena.MakeArray<char>(name.size());
+        std::copy(name.begin(), name.end(), data);
+        names_.emplace_back(data, name.size());
+        return { names_.back(), static_cast<uint16_t>(names_.size()) };
+    }
+
+    ArrayView<std::string_view> Finish(Arena& arena) const {
+        if (names_.empty()) {
+            return {};
+        }
+        auto data = arena.MakeArray<std::string_view>(names_.size());
+        std::copy(names_.begin(), names_.end(), data);
+        return { data, names_.size() };
+    }
+
+private:
+    std::vector<std::string_view> names_;
+};
+
+void AppendSheet(std::string& out, SheetName sheet) {
+    if (0 != sheet.index) {
+        out += sheet.name;
+        out += '!';
+    }
+}
+
+constexpr std::string_view FUNCTION_NAMES[] = { "SUM", "AVERAGE", "MIN", "MAX", "COUNT" };
+
+std::string_view GetFunctionName(Function function) {
+    return FUNCTION_NAMES[static_cast<size_t>(function)];
+}
+
+std::optional<Function> FindFunction(std::string_view name) {
+    for (size_t i = 0; i < std::size(FUNCTION_NAMES); ++i) {
+        if (FUNCTION_NAMES[i] == name) {
+            return static_cast<Function>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+// the same as pos.ToString() without temporary strings
+void AppendPosition(std::string& out, Position pos) {
+    // the column letters come out last to first
+    char buffer[16];
+    char* first = std::end(buffer);
+    for (int col = pos.col; col >= 0; col = col / 26 - 1) {
+        *--first = static_cast<char>('A' + col % 26);
+    }
+    out.append(first, std::end(buffer));
+    const auto [last, ec] = std::to_chars(buffer, std::end(buffer), pos.row + 1);
+    out.append(buffer, last);
+}
+
+// A1:B2 and B2:A1 denote the same range
+Rect MakeRange(Position first, Position last) {
+    return { { std::min(first.row, last.row), std::min(first.col, last.col) },
+        { std::max(first.row, last.row), std::max(first.col, last.col) } };
+}
+
+// Collects the numbers of one function call in blocks for the kernels of
+// aggregate.h. The tree and the compiled program feed it in the same
+// order, so both give bit-identical results.
+class Aggregator {
+public:
+    void Reset() {
+        size_ = 0;
+        totals_ = {};
+    }
+
+    void Add(double number) {
+        block_[size_++] = number;
+        if (BLOCK_SIZE == size_) {
+            Flush();
+        }
+    }
+
+    // Empty cells and texts are skipped, a text holding a number counts as
+    // that number. An error in the range is the result of the call.
+    void AddRange(const SheetInterface& sheet, Rect range) {
+        // nothing is stored outside the printable area
+        const Size size = sheet.GetPrintableSize();
+        const int bottom = std::min(range.bottom_right.row, size.rows - 1);
+        const int right = std::min(range.bottom_right.col, size.cols - 1);
+        for (int col = range.top_left.col; col <= right; ++col) {
+            if (const auto column = sheet.GetNumericColumn(col)) {
+                AddColumn(sheet, *column, col, range.top_left.row,
+                    std::min(bottom, column->rows - 1));
+                continue;
+            }
+            for (int row = range.top_left.row; row <= bottom; ++row) {
+                AddCell(sheet.GetCell({ row, col }));
+            }
+        }
+    }
+    double Finish(Function function) {
+        Flush();
+        switch (function) {
+        case Function::Sum:
+            return totals_.sum;
+        case Function::Average:
+            if (0 == totals_.count) {
+                throw FormulaError(FormulaError::Category::Arithmetic);
+            }
+            return totals_.sum / static_cast<double>(totals_.count);
+        case Function::Min:
+            return 0 == totals_.count ? 0 : totals_.min;
+        case Function::Max:
+            return 0 == totals_.count ? 0 : totals_.max;
+        case Function::Count:
+            return static_cast<double>(totals_.count);
+        }
+        throw FormulaException("Unsupported function");
+    }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    void Flush() {
+        aggregate::Accumulate(block_, size_, totals_);
+        size_ = 0;
+    }
+
+    void AddCell(const CellInterface* cell) {
+        if (!cell) {
+            return;
+        }
+        const auto value = cell->GetValue();
+        if (const auto* number = std::get_if<double>(&value)) {
+            Add(*number);
+        }
+        else if (const auto* error = std::get_if<FormulaError>(&value)) {
+            throw *error;
+        }
+    }
+
+    // Rows [top, bottom] of the column a chunk at a time. Chunks full of
+    // numbers go to the kernel straight from the column, other numbers
+    // through the block.
+    void AddColumn(const SheetInterface& sheet, const NumericColumn& column, int col,
+        int top, int bottom) {
+        constexpr int CHUNK_ROWS = NumericColumn::CHUNK_ROWS;
+        for (int chunk_begin = top - top % CHUNK_ROWS; chunk_begin <= bottom; chunk_begin += CHUNK_ROWS) {
+            const auto& chunk = column.chunks[chunk_begin / CHUNK_ROWS];
+            if (!chunk) {
+                continue;
+            }
+            const int first = std::max(top, chunk_begin);
+            const int last = std::min(bottom, chunk_begin + CHUNK_ROWS - 1);
+            uint64_t mask = ~uint64_t{ 0 } << (first - chunk_begin);
+            if (last - chunk_begin + 1 < CHUNK_ROWS) {
+                mask &= (uint64_t{ 1 } << (last - chunk_begin + 1)) - 1;
+            }
+
+            const uint64_t numbers = chunk->numbers & mask;
+            if (numbers == mask) {
+                Flush();
+                aggregate::Accumulate(chunk->values + (first - chunk_begin), last - first + 1, totals_);
+                continue;
+            }
+            for (uint64_t bits = numbers; bits; bits &= bits - 1) {
+                Add(chunk->values[CountTrailingZeros(bits)]);
+            }
+            for (uint64_t bits = chunk->others & mask; bits; bits &= bits - 1) {
+                AddCell(sheet.GetCell({ chunk_begin + CountTrailingZeros(bits), col }));
+            }
+        }
+    }
+
+    // bits is not zero
+    static int CountTrailingZeros(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(bits);
+#else
+        int count = 0;
+        for (; 0 == (bits & 1); bits >>= 1) {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    double block_[BLOCK_SIZE];
+    size_t size_ = 0;
+    aggregate::Totals totals_;
+};
+
+// Aggregators of the function calls being evaluated by the compiled
+// programs of one thread. A run nests in another when a cell evaluates the
+// formulas it reads, so the aggregators live apart from each other and
+// stay in place, each one is allocated the first time its depth is reached.
+class AggregatorStack {
+public:
+    // Gives back the aggregators taken after it was created
+    class Scope {
+    public:
+        explicit Scope(AggregatorStack& stack)
+            : stack_(stack)
+            , size_(stack.size_) {
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+            stack_.size_ = size_;
+        }
+
+    private:
+        AggregatorStack& stack_;
+        size_t size_;
+    };
+
+    static AggregatorStack& ForThisThread() {
+        thread_local AggregatorStack stack;
+        return stack;
+    }
+
+    void Push() {
+        if (pool_.size() == size_) {
+            pool_.push_back(std::make_unique<Aggregator>());
+        }
+        pool_[size_++]->Reset();
+    }
+
+    Aggregator& Top() {
+        return *pool_[size_ - 1];
+    }
+
+    void Pop() {
+        --size_;
+    }
+
+private:
+    std::vector<std::unique_ptr<Aggregator>> pool_;
+    size_t size_ = 0;
+};
+
 class BinaryOpExpr final : public Expr {
 public:
     enum Type : char {
@@ -106,10 +412,10 @@ public:
     };
 
 public:
-    explicit BinaryOpExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+    explicit BinaryOpExpr(Type type, const Expr* lhs, const Expr* rhs)
         : type_(type)
-        , lhs_(std::move(lhs))
-        , rhs_(std::move(rhs)) {
+        , lhs_(lhs)
+        , rhs_(rhs) {
     }
 
     void Print(std::ostream& out) const override {
@@ -120,9 +426,9 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+    void DoPrintFormula(std::string& out, ExprPrecedence precedence) const override {
         lhs_->PrintFormula(out, precedence);
-        out << static_cast<char>(type_);
+        out += static_cast<char>(type_);
         rhs_->PrintFormula(out, precedence, /* right_child = */ true);
     }
 
@@ -171,10 +477,34 @@ public:
             throw FormulaError(FormulaError::Category::Arithmetic);
     }
 
+    void Compile(std::vector<Instruction>& program) const override {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+
+        Instruction instruction{};
+        switch (type_) {
+        case Add:
+            instruction.code = Instruction::Code::Add;
+            break;
+        case Subtract:
+            instruction.code = Instruction::Code::Subtract;
+            break;
+        case Multiply:
+            instruction.code = Instruction::Code::Multiply;
+            break;
+        case Divide:
+            instruction.code = Instruction::Code::Divide;
+            break;
+        default:
+            throw FormulaException("Unsupported operation");
+        }
+        program.push_back(instruction);
+    }
+
 private:
     Type type_;
-    std::unique_ptr<Expr> lhs_;
-    std::unique_ptr<Expr> rhs_;
+    const Expr* lhs_;
+    const Expr* rhs_;
 };
 
 class UnaryOpExpr final : public Expr {
@@ -185,9 +515,9 @@ public:
     };
 
 public:
-    explicit UnaryOpExpr(Type type, std::unique_ptr<Expr> operand)
+    explicit UnaryOpExpr(Type type, const Expr* operand)
         : type_(type)
-        , operand_(std::move(operand)) {
+        , operand_(operand) {
     }
 
     void Print(std::ostream& out) const override {
@@ -196,8 +526,8 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-        out << static_cast<char>(type_);
+    void DoPrintFormula(std::string& out, ExprPrecedence precedence) const override {
+        out += static_cast<char>(type_);
         operand_->PrintFormula(out, precedence);
     }
 
@@ -218,28 +548,48 @@ public:
         }
     }
 
+    void Compile(std::vector<Instruction>& program) const override {
+        operand_->Compile(program);
+
+        // unary plus leaves the operand as it is
+        if (UnaryMinus == type_) {
+            Instruction instruction{};
+            instruction.code = Instruction::Code::Negate;
+            program.push_back(instruction);
+        }
+    }
+
 private:
     Type type_;
-    std::unique_ptr<Expr> operand_;
+    const Expr* operand_;
 };
 
 class CellExpr final : public Expr {
 public:
-    explicit CellExpr(const Position* cell)
-        : cell_(cell) {
+    explicit CellExpr(Position cell, SheetName sheet = {})
+        : cell_(cell)
+        , sheet_(sheet) {
     }
 
     void Print(std::ostream& out) const override {
-        if (!cell_->IsValid()) {
+        if (!cell_.IsValid()) {
             out << FormulaError::Category::Ref;
         }
         else {
-            out << cell_->ToString();
+            if (0 != sheet_.index) {
+                out << sheet_.name << '!';
+            }
+            out << cell_.ToString();
         }
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-        Print(out);
+    void DoPrintFormula(std::string& out, ExprPrecedence /* precedence */) const override {
+        if (!cell_.IsValid()) {
+            out += FormulaError(FormulaError::Category::Ref).ToString();
+            return;
+        }
+        AppendSheet(out, sheet_);
+        AppendPosition(out, cell_);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -247,31 +597,20 @@ public:
     }
 
     double Evaluate(const SheetInterface& sheet) const override {
-        if (!cell_->IsValid())
-            throw FormulaError(FormulaError::Category::Ref);
+        return GetCellValue(ResolveSheet(sheet, sheet_.name), cell_);
+    }
 
-        const auto cell = sheet.GetCell(*cell_);
-        if (!cell) {
-            return 0;
-        }
-        const auto value = cell->GetValue();
-        switch (value.index()) {
-        case 0:
-            if (std::get<std::string>(value).empty())
-                return 0;
-            else
-                throw FormulaError(FormulaError::Category::Value);
-        case 1:
-            return std::get<double>(value);
-        case 2:
-            throw std::get<FormulaError>(value);
-        default:
-            throw FormulaException("Unexpected error");
-        }
+    void Compile(std::vector<Instruction>& program) const override {
+        Instruction instruction{};
+        instruction.code = Instruction::Code::Cell;
+        instruction.sheet = sheet_.index;
+        instruction.cell = { cell_.row, cell_.col };
+        program.push_back(instruction);
     }
 
 private:
-    const Position* cell_;
+    Position cell_;
+    SheetName sheet_;
 };
 
 class NumberExpr final : public Expr {
@@ -284,8 +623,9 @@ public:
         out << value_;
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-        out << value_;
+    void DoPrintFormula(std::string& out, ExprPrecedence /* precedence */) const override {
+        char buffer[num_convert::MAX_LENGTH];
+        out.append(buffer, num_convert::ToChars(buffer, value_));
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -296,29 +636,548 @@ public:
         return value_;
     }
 
+    void Compile(std::vector<Instruction>& program) const override {
+        Instruction instruction{};
+        instruction.code = Instruction::Code::Number;
+        instruction.number = value_;
+        program.push_back(instruction);
+    }
+
 private:
     double value_;
 };
 
+class FunctionExpr final : public Expr {
+public:
+    // either an expression or a range of cells, possibly of another sheet
+    struct Argument {
+        const Expr* expr;
+        Rect range;
+        SheetName sheet;
+    };
+
+    explicit FunctionExpr(Function function, ArrayView<Argument> args)
+        : function_(function)
+        , args_(args) {
+    }
+
+    void Print(std::ostream& out) const override {
+        out << '(' << GetFunctionName(function_);
+        for (const auto& arg : args_) {
+            out << ' ';
+            if (arg.expr) {
+                arg.expr->Print(out);
+            }
+            else {
+                if (0 != arg.sheet.index) {
+                    out << arg.sheet.name << '!';
+                }
+                out << arg.range.top_left.ToString() << ':' << arg.range.bottom_right.ToString();
+            }
+        }
+        out << ')';
+    }
+
+    void DoPrintFormula(std::string& out, ExprPrecedence /* precedence */) const override {
+        out += GetFunctionName(function_);
+        out += '(';
+        for (size_t i = 0; i < args_.size(); ++i) {
+            if (0 != i) {
+                out += ',';
+            }
+            if (args_[i].expr) {
+                args_[i].expr->PrintFormula(out, EP_ATOM);
+            }
+            else {
+                // both corners are kept, A1:A1 is still a range
+                AppendSheet(out, args_[i].sheet);
+                AppendPosition(out, args_[i].range.top_left);
+                out += ':';
+                AppendPosition(out, args_[i].range.bottom_right);
+            }
+        }
+        out += ')';
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    double Evaluate(const SheetInterface& sheet) const override {
+        Aggregator aggregator;
+        for (const auto& arg : args_) {
+            if (arg.expr) {
+                aggregator.Add(arg.expr->Evaluate(sheet));
+            }
+            else {
+                aggregator.AddRange(ResolveSheet(sheet, arg.sheet.name), arg.range);
+            }
+        }
+
+        const double result = aggregator.Finish(function_);
+        if (std::isfinite(result))
+            return result;
+        else
+            throw FormulaError(FormulaError::Category::Arithmetic);
+    }
+
+    void Compile(std::vector<Instruction>& program) const override {
+        Instruction instruction{};
+        instruction.code = Instruction::Code::BeginAggregate;
+        program.push_back(instruction);
+
+        for (const auto& arg : args_) {
+            instruction = {};
+            if (arg.expr) {
+                arg.expr->Compile(program);
+                instruction.code = Instruction::Code::Accumulate;
+            }
+            else {
+                instruction.code = Instruction::Code::AccumulateRange;
+                instruction.sheet = arg.sheet.index;
+                instruction.range = {
+                    static_cast<uint16_t>(arg.range.top_left.row),
+                    static_cast<uint16_t>(arg.range.top_left.col),
+                    static_cast<uint16_t>(arg.range.bottom_right.row),
+                    static_cast<uint16_t>(arg.range.bottom_right.col) };
+            }
+            program.push_back(instruction);
+        }
+
+        instruction = {};
+        instruction.code = Instruction::Code::EndAggregate;
+        instruction.function = function_;
+        program.push_back(instruction);
+    }
+
+private:
+    Function function_;
+    ArrayView<Argument> args_;
+};
+
+// Splits an expression into the tokens of Formula.g4 without copying it
+class Tokenizer {
+public:
+    enum class Type {
+        End,
+        Number,
+        Cell,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        LeftParen,
+        RightParen,
+        Colon,
+        Comma,
+        Function,
+        // the name of a sheet without the '!' after it
+        Sheet,
+    };
+
+    struct Token {
+        Type type;
+        std::string_view text;
+    };
+
+    explicit Tokenizer(std::string_view input)
+        : input_(input) {
+        current_ = Scan();
+    }
+
+    const Token& Peek() const {
+        return current_;
+    }
+
+    Token Next() {
+        Token token = current_;
+        current_ = Scan();
+        return token;
+    }
+
+private:
+    static bool IsDigit(char c) {
+        return '0' <= c && c <= '9';
+    }
+
+    static bool IsLetter(char c) {
+        return 'A' <= c && c <= 'Z';
+    }
+
+    static bool IsNameStart(char c) {
+        return IsLetter(c) || ('a' <= c && c <= 'z') || '_' == c;
+    }
+
+    static bool IsNameChar(char c) {
+        return IsNameStart(c) || IsDigit(c);
+    }
+
+    bool DigitAt(size_t pos) const {
+        return pos < input_.size() && IsDigit(input_[pos]);
+    }
+
+    size_t SkipDigits(size_t pos) const {
+        while (DigitAt(pos)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    Token Scan() {
+        while (pos_ < input_.size()
+            && (' ' == input_[pos_] || '\t' == input_[pos_]
+                || '\n' == input_[pos_] || '\r' == input_[pos_])) {
+            ++pos_;
+        }
+        if (pos_ == input_.size()) {
+            return { Type::End, {} };
+        }
+
+        const size_t start = pos_;
+        const char c = input_[pos_];
+        switch (c) {
+        case '+':
+            return Single(Type::Add);
+        case '-':
+            return Single(Type::Sub);
+        case '*':
+            return Single(Type::Mul);
+        case '/':
+            return Single(Type::Div);
+        case '(':
+            return Single(Type::LeftParen);
+        case ')':
+            return Single(Type::RightParen);
+        case ':':
+            return Single(Type::Colon);
+        case ',':
+            return Single(Type::Comma);
+        default:
+            break;
+        }
+
+        if (IsDigit(c) || '.' == c) {
+            // UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+            pos_ = SkipDigits(pos_);
+            if (pos_ < input_.size() && '.' == input_[pos_] && DigitAt(pos_ + 1)) {
+                pos_ = SkipDigits(pos_ + 1);
+            }
+            if (start == pos_) {
+                throw ParsingError("Error when lexing: unexpected '.'");
+            }
+            if (pos_ < input_.size() && ('e' == input_[pos_] || 'E' == input_[pos_])) {
+                size_t exponent = pos_ + 1;
+                if (exponent < input_.size()
+                    && ('+' == input_[exponent] || '-' == input_[exponent])) {
+                    ++exponent;
+                }
+                if (DigitAt(exponent)) {
+                    pos_ = SkipDigits(exponent);
+                }
+            }
+            return { Type::Number, input_.substr(start, pos_ - start) };
+        }
+
+        if (IsNameStart(c)) {
+            // [A-Za-z_][A-Za-z0-9_]* '!' is longer than any other token here
+            size_t end = pos_ + 1;
+            while (end < input_.size() && IsNameChar(input_[end])) {
+                ++end;
+            }
+            if (end < input_.size() && '!' == input_[end]) {
+                pos_ = end + 1;
+                return { Type::Sheet, input_.substr(start, end - start) };
+            }
+        }
+
+        if (IsLetter(c)) {
+            // [A-Z]+[0-9]+ or a function name
+            while (pos_ < input_.size() && IsLetter(input_[pos_])) {
+                ++pos_;
+            }
+            const size_t digits = pos_;
+            pos_ = SkipDigits(pos_);
+            if (digits == pos_) {
+                const auto name = input_.substr(start, pos_ - start);
+                if (!FindFunction(name)) {
+                    throw ParsingError("Error when lexing: a cell without a row");
+                }
+                return { Type::Function, name };
+            }
+            return { Type::Cell, input_.substr(start, pos_ - start) };
+        }
+
+        throw ParsingError("Error when lexing: unexpected character");
+    }
+
+    Token Single(Type type) {
+        return { type, input_.substr(pos_++, 1) };
+    }
+
+    std::string_view input_;
+    size_t pos_ = 0;
+    Token current_;
+};
+
+// Recursive descent parser for Formula.g4, builds the same tree as
+// ParseASTListener without going through the ANTLR runtime
+class DescentParser {
+public:
+    explicit DescentParser(std::string_view input)
+        : tokens_(input) {
+        // a first pass over the tokens sizes the arena exactly, so the
+        // whole formula takes a single allocation
+        size_t nodes = 0;
+        size_t cells = 0;
+        size_t calls = 0;
+        size_t names = 0;
+        for (Tokenizer counter(input); Tokenizer::Type::End != counter.Peek().type; ) {
+            const auto token = counter.Next();
+            switch (token.type) {
+            case Tokenizer::Type::Sheet:
+                // an upper bound, a name repeated in the formula is stored once
+                names += token.text.size() + sizeof(std::string_view);
+                break;
+            case Tokenizer::Type::LeftParen:
+            case Tokenizer::Type::RightParen:
+            case Tokenizer::Type::Colon:
+                break;
+            case Tokenizer::Type::Comma:
+                // another argument with its Accumulate instruction
+                calls += sizeof(FunctionExpr::Argument) + sizeof(Instruction);
+                break;
+            case Tokenizer::Type::Function:
+                // the first argument and the BeginAggregate/EndAggregate pair
+                calls += sizeof(FunctionExpr::Argument) + 3 * sizeof(Instruction);
+                ++nodes;
+                break;
+            case Tokenizer::Type::Cell:
+                ++cells;
+                [[fallthrough]];
+            default:
+                ++nodes;
+            }
+        }
+        if (0 != names) {
+            names += alignof(std::string_view);
+        }
+        arena_ = Arena(nodes * (MAX_NODE_SIZE + sizeof(Instruction)) + calls
+            + cells * sizeof(Position) + names);
+        cells_ = arena_.MakeArray<Position>(cells);
+        cell_capacity_ = cells;
+        // what a failed parse left behind
+        GetArgumentStack().clear();
+    }
+
+    FormulaAST Parse() {
+        auto root = ParseExpr(PREC_LOWEST);
+        if (Tokenizer::Type::End != tokens_.Peek().type) {
+            throw ParsingError("Error when parsing: unexpected token");
+        }
+        return FormulaAST(std::move(arena_), root, cells_, cell_count_, sheets_.Finish(arena_));
+    }
+
+private:
+    // arguments of the calls being parsed, reused between formulas
+    static std::vector<FunctionExpr::Argument>& GetArgumentStack() {
+        thread_local std::vector<FunctionExpr::Argument> arguments;
+        return arguments;
+    }
+
+    static constexpr size_t MAX_NODE_SIZE = std::max({ sizeof(BinaryOpExpr),
+        sizeof(UnaryOpExpr), sizeof(CellExpr), sizeof(NumberExpr), sizeof(FunctionExpr) });
+
+    // binding power of the grammar alternatives, unary operators bind
+    // tighter than any binary one
+    enum Precedence {
+        PREC_LOWEST,
+        PREC_ADD,
+        PREC_MUL,
+        PREC_UNARY,
+    };
+
+    static Precedence GetBinaryPrecedence(Tokenizer::Type type) {
+        switch (type) {
+        case Tokenizer::Type::Add:
+        case Tokenizer::Type::Sub:
+            return PREC_ADD;
+        case Tokenizer::Type::Mul:
+        case Tokenizer::Type::Div:
+            return PREC_MUL;
+        default:
+            return PREC_LOWEST;
+        }
+    }
+
+    static BinaryOpExpr::Type GetBinaryType(Tokenizer::Type type) {
+        switch (type) {
+        case Tokenizer::Type::Add:
+            return BinaryOpExpr::Add;
+        case Tokenizer::Type::Sub:
+            return BinaryOpExpr::Subtract;
+        case Tokenizer::Type::Mul:
+            return BinaryOpExpr::Multiply;
+        default:
+            return BinaryOpExpr::Divide;
+        }
+    }
+
+    const Expr* ParseExpr(Precedence precedence) {
+        return ParseBinary(ParseOperand(), precedence);
+    }
+
+    // parses operators binding tighter than precedence, left to right
+    const Expr* ParseBinary(const Expr* lhs, Precedence precedence) {
+        while (true) {
+            const auto type = tokens_.Peek().type;
+            const auto op_precedence = GetBinaryPrecedence(type);
+            if (op_precedence <= precedence) {
+                return lhs;
+            }
+            tokens_.Next();
+            auto rhs = ParseExpr(op_precedence);
+            lhs = arena_.Make<BinaryOpExpr>(GetBinaryType(type), lhs, rhs);
+        }
+    }
+
+    const Expr* ParseOperand() {
+        const auto token = tokens_.Next();
+        switch (token.type) {
+        case Tokenizer::Type::Add:
+            return arena_.Make<UnaryOpExpr>(UnaryOpExpr::UnaryPlus, ParseExpr(PREC_UNARY));
+        case Tokenizer::Type::Sub:
+            return arena_.Make<UnaryOpExpr>(UnaryOpExpr::UnaryMinus, ParseExpr(PREC_UNARY));
+        case Tokenizer::Type::LeftParen: {
+            auto expr = ParseExpr(PREC_LOWEST);
+            if (Tokenizer::Type::RightParen != tokens_.Next().type) {
+                throw ParsingError("Error when parsing: expected ')'");
+            }
+            return expr;
+        }
+        case Tokenizer::Type::Number: {
+            double value = 0;
+            const auto end = token.text.data() + token.text.size();
+            const auto [ptr, ec] = std::from_chars(token.text.data(), end, value);
+            if (std::errc() != ec || end != ptr) {
+                throw ParsingError("Invalid number: " + std::string(token.text));
+            }
+            return arena_.Make<NumberExpr>(value);
+        }
+        case Tokenizer::Type::Cell:
+            return MakeCell(token.text);
+        case Tokenizer::Type::Sheet: {
+            const auto sheet = sheets_.Add(arena_, token.text);
+            const auto cell = tokens_.Next();
+            if (Tokenizer::Type::Cell != cell.type) {
+                throw ParsingError("Error when parsing: expected a cell");
+            }
+            return MakeCell(cell.text, sheet);
+        }
+        case Tokenizer::Type::Function:
+            return ParseFunction(*FindFunction(token.text));
+        default:
+            throw ParsingError("Error when parsing: expected an operand");
+        }
+    }
+
+    const Expr* ParseFunction(Function function) {
+        if (Tokenizer::Type::LeftParen != tokens_.Next().type) {
+            throw ParsingError("Error when parsing: expected '('");
+        }
+
+        // the argument count is known at the closing parenthesis only, so
+        // the arguments wait on the stack above those of the outer calls
+        auto& arguments = GetArgumentStack();
+        const size_t first = arguments.size();
+        while (true) {
+            const auto argument = ParseArgument();
+            arguments.push_back(argument);
+            const auto type = tokens_.Next().type;
+            if (Tokenizer::Type::RightParen == type) {
+                break;
+            }
+            if (Tokenizer::Type::Comma != type) {
+                throw ParsingError("Error when parsing: expected ',' or ')'");
+            }
+        }
+
+        const size_t count = arguments.size() - first;
+        auto data = arena_.MakeArray<FunctionExpr::Argument>(count);
+        std::copy(arguments.begin() + first, arguments.end(), data);
+        arguments.resize(first);
+        return arena_.Make<FunctionExpr>(function, ArrayView<FunctionExpr::Argument>(data, count));
+    }
+
+    // a cell followed by ':' starts a range, otherwise an expression
+    FunctionExpr::Argument ParseArgument() {
+        SheetName sheet;
+        if (Tokenizer::Type::Sheet == tokens_.Peek().type) {
+            sheet = sheets_.Add(arena_, tokens_.Next().text);
+            if (Tokenizer::Type::Cell != tokens_.Peek().type) {
+                throw ParsingError("Error when parsing: expected a cell");
+            }
+        }
+        else if (Tokenizer::Type::Cell != tokens_.Peek().type) {
+            return { ParseExpr(PREC_LOWEST), {}, {} };
+        }
+
+        const auto first = tokens_.Next();
+        if (Tokenizer::Type::Colon != tokens_.Peek().type) {
+            return { ParseBinary(MakeCell(first.text, sheet), PREC_LOWEST), {}, {} };
+        }
+        tokens_.Next();
+        const auto last = tokens_.Next();
+        if (Tokenizer::Type::Cell != last.type) {
+            throw ParsingError("Error when parsing: expected a cell");
+        }
+
+        // the cells of a range are not listed, the sheet tracks the whole range
+        return { nullptr, MakeRange(ParsePosition(first.text), ParsePosition(last.text)), sheet };
+    }
+
+    static Position ParsePosition(std::string_view text) {
+        const auto pos = Position::FromString(text);
+        if (!pos.IsValid()) {
+            throw FormulaException("Invalid position: " + std::string(text));
+        }
+        return pos;
+    }
+
+    // only the cells of the own sheet are listed
+    const Expr* MakeCell(std::string_view text, SheetName sheet = {}) {
+        const auto pos = ParsePosition(text);
+        if (0 == sheet.index) {
+            assert(cell_count_ < cell_capacity_);
+            cells_[cell_count_++] = pos;
+        }
+        return arena_.Make<CellExpr>(pos, sheet);
+    }
+
+    Tokenizer tokens_;
+    Arena arena_;
+    SheetNameTable sheets_;
+    Position* cells_ = nullptr;
+    size_t cell_count_ = 0;
+    size_t cell_capacity_ = 0;
+};
+
 class ParseASTListener final : public FormulaBaseListener {
 public:
-    std::unique_ptr<Expr> MoveRoot() {
+    FormulaAST MoveAST() {
         assert(args_.size() == 1);
-        auto root = std::move(args_.front());
+        const Expr* root = args_.front();
         args_.clear();
 
-        return root;
-    }
-
-    std::forward_list<Position> MoveCells() {
-        return std::move(cells_);
+        Position* cells = arena_.MakeArray<Position>(cells_.size());
+        std::copy(cells_.begin(), cells_.end(), cells);
+        return FormulaAST(std::move(arena_), root, cells, cells_.size(), sheets_.Finish(arena_));
     }
 
 public:
     void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
         assert(args_.size() >= 1);
 
-        auto operand = std::move(args_.back());
+        auto operand = args_.back();
 
         UnaryOpExpr::Type type;
         if (ctx->SUB()) {
@@ -329,8 +1188,7 @@ public:
             type = UnaryOpExpr::UnaryPlus;
         }
 
-        auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-        args_.back() = std::move(node);
+        args_.back() = arena_.Make<UnaryOpExpr>(type, operand);
     }
 
     void exitLiteral(FormulaParser::LiteralContext* ctx) override {
@@ -342,29 +1200,30 @@ public:
             throw ParsingError("Invalid number: " + valueStr);
         }
 
-        auto node = std::make_unique<NumberExpr>(value);
-        args_.push_back(std::move(node));
+        args_.push_back(arena_.Make<NumberExpr>(value));
     }
 
     void exitCell(FormulaParser::CellContext* ctx) override {
+        const SheetName sheet = AddSheet(ctx->SHEET());
         auto value_str = ctx->CELL()->getSymbol()->getText();
         auto value = Position::FromString(value_str);
         if (!value.IsValid()) {
             throw FormulaException("Invalid position: " + value_str);
         }
 
-        cells_.push_front(value);
-        auto node = std::make_unique<CellExpr>(&cells_.front());
-        args_.push_back(std::move(node));
+        if (0 == sheet.index) {
+            cells_.push_back(value);
+        }
+        args_.push_back(arena_.Make<CellExpr>(value, sheet));
     }
 
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
         assert(args_.size() >= 2);
 
-        auto rhs = std::move(args_.back());
+        auto rhs = args_.back();
         args_.pop_back();
 
-        auto lhs = std::move(args_.back());
+        auto lhs = args_.back();
 
         BinaryOpExpr::Type type;
         if (ctx->ADD()) {
@@ -381,8 +1240,41 @@ public:
             type = BinaryOpExpr::Divide;
         }
 
-        auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
-        args_.back() = std::move(node);
+        args_.back() = arena_.Make<BinaryOpExpr>(type, lhs, rhs);
+    }
+
+    void exitRange(FormulaParser::RangeContext* ctx) override {
+        Position corners[2];
+        for (size_t i = 0; i < 2; ++i) {
+            auto value_str = ctx->CELL(i)->getSymbol()->getText();
+            corners[i] = Position::FromString(value_str);
+            if (!corners[i].IsValid()) {
+                throw FormulaException("Invalid position: " + value_str);
+            }
+        }
+
+        arguments_.push_back({ nullptr, MakeRange(corners[0], corners[1]), AddSheet(ctx->SHEET()) });
+    }
+
+    void exitArgument(FormulaParser::ArgumentContext* /* ctx */) override {
+        assert(args_.size() >= 1);
+
+        arguments_.push_back({ args_.back(), {}, {} });
+        args_.pop_back();
+    }
+
+    void exitFunction(FormulaParser::FunctionContext* ctx) override {
+        const size_t count = ctx->arg().size();
+        assert(arguments_.size() >= count);
+
+        auto data = arena_.MakeArray<FunctionExpr::Argument>(count);
+        std::copy(arguments_.end() - count, arguments_.end(), data);
+        arguments_.resize(arguments_.size() - count);
+
+        const auto function = FindFunction(ctx->FUNCTION()->getSymbol()->getText());
+        assert(function.has_value());
+        args_.push_back(arena_.Make<FunctionExpr>(*function,
+            ArrayView<FunctionExpr::Argument>(data, count)));
     }
 
     void visitErrorNode(antlr4::tree::ErrorNode* node) override {
@@ -390,8 +1282,21 @@ public:
     }
 
 private:
-    std::vector<std::unique_ptr<Expr>> args_;
-    std::forward_list<Position> cells_;
+    // the SHEET token ends with '!', an absent one is the own sheet
+    SheetName AddSheet(antlr4::tree::TerminalNode* node) {
+        if (!node) {
+            return {};
+        }
+        const std::string text = node->getSymbol()->getText();
+        return sheets_.Add(arena_, std::string_view(text).substr(0, text.size() - 1));
+    }
+
+    Arena arena_;
+    SheetNameTable sheets_;
+    std::vector<const Expr*> args_;
+    // arguments of the functions being parsed
+    std::vector<FunctionExpr::Argument> arguments_;
+    std::vector<Position> cells_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -408,7 +1313,7 @@ public:
 
 }  // namespace ASTImpl
 
-FormulaAST ParseFormulaAST(std::istream& in) {
+FormulaAST ParseFormulaASTAntlr(std::istream& in) {
     using namespace antlr4;
 
     ANTLRInputStream input(in);
@@ -429,12 +1334,16 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return listener.MoveAST();
+}
+
+FormulaAST ParseFormulaAST(std::istream& in) {
+    const std::string expression{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    return ParseFormulaAST(expression);
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+    return ASTImpl::DescentParser(in_str).Parse();
 }
 
 void FormulaAST::PrintCells(std::ostream& out) const {
@@ -448,17 +1357,357 @@ void FormulaAST::Print(std::ostream& out) const {
 }
 
 void FormulaAST::PrintFormula(std::ostream& out) const {
+    std::string formula;
+    PrintFormula(formula);
+    out << formula;
+}
+
+void FormulaAST::PrintFormula(std::string& out) const {
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
 double FormulaAST::Execute(const SheetInterface& sheet) const {
+    return ASTImpl::Execute(program_, stack_size_, sheet, { 0, 0 }, sheets_);
+}
+
+namespace ASTImpl {
+
+// Every operation is checked at once, as the tree does, so an arithmetic
+// error wins over an error of a cell read after it
+static void CheckFinite(double value) {
+    if (!std::isfinite(value)) {
+        throw FormulaError(FormulaError::Category::Arithmetic);
+    }
+}
+
+double Execute(ArrayView<Instruction> program, size_t stack_size, const SheetInterface& sheet,
+    Position offset, ArrayView<std::string_view> sheets) {
+    using Code = Instruction::Code;
+
+    // other sheets are looked up on first use, once per run
+    std::vector<const SheetInterface*> others(sheets.size());
+    const auto find_other = [&](uint16_t index) -> const SheetInterface& {
+        const SheetInterface*& other = others[index - 1];
+        if (!other) {
+            other = &ResolveSheet(sheet, sheets[index - 1]);
+        }
+        return *other;
+    };
+
+    // most formulas fit the local stack, deeper ones get a heap one
+    constexpr size_t LOCAL_STACK_SIZE = 32;
+    double local_stack[LOCAL_STACK_SIZE];
+    std::vector<double> heap_stack;
+    double* top = local_stack;
+    if (stack_size > LOCAL_STACK_SIZE) {
+        heap_stack.resize(stack_size);
+        top = heap_stack.data();
+    }
+    double* const bottom = top;
+
+    // one per function call being evaluated, taken above those of the runs
+    // this one is nested in and given back however the run ends
+    AggregatorStack& aggregators = AggregatorStack::ForThisThread();
+    const AggregatorStack::Scope scope(aggregators);
+
+    for (const auto& instruction : program) {
+        switch (instruction.code) {
+        case Code::Number:
+            *top++ = instruction.number;
+            break;
+        case Code::Cell:
+            *top++ = GetCellValue(0 == instruction.sheet ? sheet : find_other(instruction.sheet),
+                { instruction.cell.row + offset.row, instruction.cell.col + offset.col });
+            break;
+        case Code::Add:
+            --top;
+            top[-1] += *top;
+            CheckFinite(top[-1]);
+            break;
+        case Code::Subtract:
+            --top;
+            top[-1] -= *top;
+            CheckFinite(top[-1]);
+            break;
+        case Code::Multiply:
+            --top;
+            top[-1] *= *top;
+            CheckFinite(top[-1]);
+            break;
+        case Code::Divide:
+            --top;
+            top[-1] /= *top;
+            CheckFinite(top[-1]);
+            break;
+        case Code::Negate:
+            top[-1] = -top[-1];
+            break;
+        case Code::BeginAggregate:
+            aggregators.Push();
+            break;
+        case Code::Accumulate:
+            aggregators.Top().Add(*--top);
+            break;
+        case Code::AccumulateRange: {
+            const auto& range = instruction.range;
+            aggregators.Top().AddRange(
+                0 == instruction.sheet ? sheet : find_other(instruction.sheet), {
+                { range.top + offset.row, range.left + offset.col },
+                { range.bottom + offset.row, range.right + offset.col } });
+            break;
+        }
+        case Code::EndAggregate:
+            *top++ = aggregators.Top().Finish(instruction.function);
+            aggregators.Pop();
+            CheckFinite(top[-1]);
+            break;
+        }
+    }
+
+    assert(top == bottom + 1);
+    return *bottom;
+}
+
+std::vector<Rect> GetRanges(ArrayView<Instruction> program) {
+    std::vector<Rect> ranges;
+    for (const auto& instruction : program) {
+        if (Instruction::Code::AccumulateRange == instruction.code && 0 == instruction.sheet) {
+            const auto& range = instruction.range;
+            ranges.push_back({ { range.top, range.left }, { range.bottom, range.right } });
+        }
+    }
+
+    const auto corners = [](const Rect& range) {
+        return std::make_pair(range.top_left, range.bottom_right);
+    };
+    std::sort(ranges.begin(), ranges.end(), [&corners](const Rect& lhs, const Rect& rhs) {
+        return corners(lhs) < corners(rhs);
+    });
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+    return ranges;
+}
+
+std::vector<SheetReference> GetSheetReferences(ArrayView<Instruction> program,
+    ArrayView<std::string_view> sheets) {
+    std::vector<SheetReference> references;
+    for (const auto& instruction : program) {
+        if (0 == instruction.sheet) {
+            continue;
+        }
+        const std::string name(sheets[instruction.sheet - 1]);
+        if (Instruction::Code::Cell == instruction.code) {
+            const Position pos{ instruction.cell.row, instruction.cell.col };
+            references.push_back({ name, { pos, pos } });
+        }
+        else if (Instruction::Code::AccumulateRange == instruction.code) {
+            const auto& range = instruction.range;
+            references.push_back({ name, { { range.top, range.left }, { range.bottom, range.right } } });
+        }
+    }
+    std::sort(references.begin(), references.end());
+    references.erase(std::unique(references.begin(), references.end()), references.end());
+    return references;
+}
+
+bool HasSheetReferences(ArrayView<Instruction> program) {
+    return std::any_of(program.begin(), program.end(), [](const Instruction& instruction) {
+        return (Instruction::Code::Cell == instruction.code
+            || Instruction::Code::AccumulateRange == instruction.code) && 0 != instruction.sheet;
+    });
+}
+
+std::vector<CellToken> FindCellTokens(std::string_view expression) {
+    std::vector<CellToken> cells;
+    for (Tokenizer tokens(expression); Tokenizer::Type::End != tokens.Peek().type; ) {
+        const auto token = tokens.Next();
+        if (Tokenizer::Type::Cell == token.type) {
+            const auto pos = Position::FromString(token.text);
+            if (!pos.IsValid()) {
+                throw FormulaException("Invalid position: " + std::string(token.text));
+            }
+            cells.push_back({ static_cast<size_t>(token.text.data() - expression.data()),
+                token.text.size(), pos });
+        }
+    }
+    return cells;
+}
+
+namespace {
+
+// Folds operators of constants and drops operators which leave their operand
+// exactly as it is. Every change keeps the value bit for bit: a constant
+// with a non-finite result stays an operator to raise the error at run time,
+// and x+0 stays as it turns -0 into 0.
+void Optimize(std::vector<Instruction>& program) {
+    using Code = Instruction::Code;
+
+    // the result is never longer, so it is written over the program
+    size_t size = 0;
+    // where the code of every value on the evaluation stack starts
+    thread_local std::vector<size_t> starts;
+    // where the code of every function call being compiled starts
+    thread_local std::vector<size_t> calls;
+    starts.clear();
+    calls.clear();
+
+    const auto is_number = [&program](size_t begin, size_t end, double number) {
+        return end - begin == 1 && Code::Number == program[begin].code
+            && number == program[begin].number && !std::signbit(program[begin].number);
+    };
+    const auto is_constant = [&program](size_t begin, size_t end) {
+        return end - begin == 1 && Code::Number == program[begin].code;
+    };
+
+    for (size_t i = 0; i < program.size(); ++i) {
+        const Instruction instruction = program[i];
+        switch (instruction.code) {
+        case Code::Number:
+        case Code::Cell:
+            starts.push_back(size);
+            program[size++] = instruction;
+            break;
+        case Code::Negate:
+            if (is_constant(starts.back(), size)) {
+                program[size - 1].number = -program[size - 1].number;
+            }
+            else if (Code::Negate == program[size - 1].code) {
+                --size;
+            }
+            else {
+                program[size++] = instruction;
+            }
+            break;
+        case Code::Add:
+        case Code::Subtract:
+        case Code::Multiply:
+        case Code::Divide: {
+            const size_t right = starts.back();
+            starts.pop_back();
+            const size_t left = starts.back();
+            const size_t end = size;
+
+            if (is_constant(left, right) && is_constant(right, end)) {
+                const double lhs = program[left].number;
+                const double rhs = program[right].number;
+                double result = 0;
+                switch (instruction.code) {
+                case Code::Add: result = lhs + rhs; break;
+                case Code::Subtract: result = lhs - rhs; break;
+                case Code::Multiply: result = lhs * rhs; break;
+                default: result = lhs / rhs; break;
+                }
+                if (std::isfinite(result)) {
+                    size = right;
+                    program[left].number = result;
+                    break;
+                }
+            }
+            else if (Code::Multiply == instruction.code && is_number(left, right, 1)) {
+                std::copy(program.begin() + right, program.begin() + size, program.begin() + left);
+                --size;
+                break;
+            }
+            else if ((Code::Subtract == instruction.code && is_number(right, end, 0))
+                || ((Code::Multiply == instruction.code || Code::Divide == instruction.code)
+                    && is_number(right, end, 1))) {
+                --size;
+                break;
+            }
+            program[size++] = instruction;
+            break;
+        }
+        case Code::BeginAggregate:
+            calls.push_back(size);
+            program[size++] = instruction;
+            break;
+        case Code::Accumulate:
+            starts.pop_back();
+            program[size++] = instruction;
+            break;
+        case Code::AccumulateRange:
+            program[size++] = instruction;
+            break;
+        case Code::EndAggregate:
+            starts.push_back(calls.back());
+            calls.pop_back();
+            program[size++] = instruction;
+            break;
+        }
+    }
+    program.resize(size);
+}
+
+}  // namespace
+
+}  // namespace ASTImpl
+
+double FormulaAST::ExecuteTree(const SheetInterface& sheet) const {
     return root_expr_->Evaluate(sheet);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
-    : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
-    cells_.sort();      // to avoid sorting in GetReferencedCells
+void FormulaAST::Compile() {
+    using Code = ASTImpl::Instruction::Code;
+
+    // reused between formulas, only the final program goes to the arena
+    thread_local std::vector<ASTImpl::Instruction> program;
+    program.clear();
+    root_expr_->Compile(program);
+    ASTImpl::Optimize(program);
+
+    size_t depth = 0;
+    for (const auto& instruction : program) {
+        switch (instruction.code) {
+        case Code::Number:
+        case Code::Cell:
+        case Code::EndAggregate:
+            stack_size_ = std::max(stack_size_, ++depth);
+            break;
+        case Code::Negate:
+        case Code::BeginAggregate:
+        case Code::AccumulateRange:
+            break;
+        default:
+            --depth;
+        }
+    }
+
+    auto program_data = arena_.MakeArray<ASTImpl::Instruction>(program.size());
+    std::copy(program.begin(), program.end(), program_data);
+    program_ = { program_data, program.size() };
+}
+
+FormulaAST::FormulaAST(ASTImpl::Arena arena, const ASTImpl::Expr* root_expr,
+    Position* cells, size_t cell_count, ASTImpl::ArrayView<std::string_view> sheets)
+    : arena_(std::move(arena))
+    , root_expr_(root_expr)
+    , sheets_(sheets) {
+    // to avoid sorting in GetReferencedCells
+    std::sort(cells, cells + cell_count);
+    cells_ = { cells, static_cast<size_t>(std::unique(cells, cells + cell_count) - cells) };
+    Compile();
 }
 
 FormulaAST::~FormulaAST() = default;
+
+namespace ASTImpl {
+
+Arena::Arena(size_t capacity)
+    : buffer_(capacity ? std::make_unique<std::byte[]>(capacity) : nullptr)
+    , capacity_(capacity)
+{}
+
+void* Arena::Allocate(size_t size, size_t align) {
+    size_t offset = (used_ + align - 1) / align * align;
+    if (offset + size > capacity_) {
+        if (buffer_) {
+            full_.push_back(std::move(buffer_));
+        }
+        capacity_ = std::max(size + align, std::max<size_t>(capacity_ * 2, 256));
+        buffer_ = std::make_unique<std::byte[]>(capacity_);
+        offset = 0;
+    }
+    used_ = offset + size;
+    return buffer_.get() + offset;
+}
+
+}  // namespace ASTImpl
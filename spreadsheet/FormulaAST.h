@@ -3,47 +3,244 @@
 #include "FormulaLexer.h"
 #include "common.h"
 
-#include <forward_list>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ASTImpl {
     class Expr;
+
+    // Bump allocator owning all nodes of one formula. Memory is released
+    // at once with the arena, so the objects must be trivially destructible.
+    class Arena {
+    public:
+        Arena() = default;
+        explicit Arena(size_t capacity);
+
+        Arena(Arena&&) = default;
+        Arena& operator=(Arena&&) = default;
+
+        template <typename T, typename... Args>
+        T* Make(Args&&... args) {
+            static_assert(std::is_trivially_destructible_v<T>);
+            return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template <typename T>
+        T* MakeArray(size_t count) {
+            static_assert(std::is_trivially_destructible_v<T>);
+            T* data = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+            for (size_t i = 0; i < count; ++i) {
+                new (data + i) T{};
+            }
+            return data;
+        }
+
+        void* Allocate(size_t size, size_t align);
+
+    private:
+        std::unique_ptr<std::byte[]> buffer_;
+        size_t capacity_ = 0;
+        size_t used_ = 0;
+        // buffers that filled up, only the ANTLR parser grows the arena
+        std::vector<std::unique_ptr<std::byte[]>> full_;
+    };
+
+    // Read-only view of a contiguous array, e.g. one placed in the arena
+    template <typename T>
+    class ArrayView {
+    public:
+        ArrayView() = default;
+        ArrayView(const T* data, size_t size)
+            : data_(data)
+            , size_(size)
+        {}
+
+        const T* begin() const {
+            return data_;
+        }
+        const T* end() const {
+            return data_ + size_;
+        }
+        size_t size() const {
+            return size_;
+        }
+        bool empty() const {
+            return 0 == size_;
+        }
+        const T& operator[](size_t index) const {
+            return data_[index];
+        }
+
+    private:
+        const T* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // Aggregate functions of the formula language
+    enum class Function : uint8_t {
+        Sum,
+        Average,
+        Min,
+        Max,
+        Count,
+    };
+
+    // Instruction of a formula compiled to postfix form. Operands are
+    // pushed on the evaluation stack, operators replace their arguments
+    // with the result.
+    //
+    // A function call is BeginAggregate, then Accumulate after every
+    // argument expression or AccumulateRange for a range argument, and
+    // EndAggregate pushing the result.
+    struct Instruction {
+        enum class Code : uint8_t {
+            Number,
+            Cell,
+            Add,
+            Subtract,
+            Multiply,
+            Divide,
+            Negate,
+            BeginAggregate,
+            Accumulate,
+            AccumulateRange,
+            EndAggregate,
+        };
+
+        struct CellRef {
+            int row;
+            int col;
+        };
+
+        // positions fit 16 bits, so an instruction stays 16 bytes
+        struct RangeRef {
+            uint16_t top;
+            uint16_t left;
+            uint16_t bottom;
+            uint16_t right;
+        };
+
+        Code code;
+        // for Cell and AccumulateRange: 0 for the own sheet, otherwise the
+        // index of the name of another sheet plus one
+        uint16_t sheet;
+        union {
+            double number;
+            CellRef cell;
+            RangeRef range;
+            Function function;
+        };
+    };
+
+    // Runs a compiled program which needs at most stack_size stack slots.
+    // Every cell and range of the program is shifted by offset. The names
+    // of the other sheets are looked up through sheet.FindSheet().
+    double Execute(ArrayView<Instruction> program, size_t stack_size, const SheetInterface& sheet,
+        Position offset = { 0, 0 }, ArrayView<std::string_view> sheets = {});
+    // Ranges of the own sheet aggregated by a compiled program, sorted and
+    // without duplicates
+    std::vector<Rect> GetRanges(ArrayView<Instruction> program);
+    // Cells and ranges of other sheets, a cell is a range of one cell
+    std::vector<SheetReference> GetSheetReferences(ArrayView<Instruction> program,
+        ArrayView<std::string_view> sheets);
+    // True if the program refers to other sheets
+    bool HasSheetReferences(ArrayView<Instruction> program);
+
+    // A cell reference in the text of a formula, the corners of a range
+    // are two references. The name of a sheet before a reference is not a
+    // part of it.
+    struct CellToken {
+        size_t offset;
+        size_t length;
+        Position pos;
+    };
+    // References in the order of the text. Throws ParsingError for a text
+    // which does not split into tokens and FormulaException for an invalid
+    // position, as the parser does.
+    std::vector<CellToken> FindCellTokens(std::string_view expression);
 }
 
+// Compiled formula detached from its tree, e.g. mapped from a snapshot file
+struct FormulaProgram {
+    std::string_view expression;
+    ASTImpl::ArrayView<ASTImpl::Instruction> program;
+    size_t stack_size = 0;
+    // sorted referenced cells without duplicates
+    ASTImpl::ArrayView<Position> cells;
+};
+
 class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
 class FormulaAST {
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-        std::forward_list<Position> cells);
+    // cells are stored in the arena and get sorted and deduplicated in place,
+    // they are the cells of the own sheet. sheets are the names of the other
+    // sheets in the arena, the nodes refer to them by index.
+    explicit FormulaAST(ASTImpl::Arena arena, const ASTImpl::Expr* root_expr,
+        Position* cells, size_t cell_count, ASTImpl::ArrayView<std::string_view> sheets = {});
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
+    // Runs the compiled program
     double Execute(const SheetInterface& sheet) const;
+    // Evaluates by walking the tree, kept as a reference for Execute()
+    double ExecuteTree(const SheetInterface& sheet) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
+    // Appends the formula to out
+    void PrintFormula(std::string& out) const;
 
-    std::forward_list<Position>& GetCells() {
+    // sorted referenced cells without duplicates
+    ASTImpl::ArrayView<Position> GetCells() const {
         return cells_;
     }
 
-    const std::forward_list<Position>& GetCells() const {
-        return cells_;
+    // names of the other sheets the formula refers to
+    ASTImpl::ArrayView<std::string_view> GetSheets() const {
+        return sheets_;
+    }
+
+    ASTImpl::ArrayView<ASTImpl::Instruction> GetProgram() const {
+        return program_;
+    }
+
+    size_t GetStackSize() const {
+        return stack_size_;
     }
 
 private:
-    std::unique_ptr<ASTImpl::Expr> root_expr_;
+    void Compile();
+
+    // owns the tree, the cells and the program
+    ASTImpl::Arena arena_;
+    const ASTImpl::Expr* root_expr_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
-    std::forward_list<Position> cells_;
+    ASTImpl::ArrayView<Position> cells_;
+    ASTImpl::ArrayView<std::string_view> sheets_;
+
+    ASTImpl::ArrayView<ASTImpl::Instruction> program_;
+    size_t stack_size_ = 0;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
 FormulaAST ParseFormulaAST(const std::string& in_str);
+
+// Parses with the ANTLR generated parser. The hand-written parser behind
+// ParseFormulaAST accepts the same language and is checked against this one.
+FormulaAST ParseFormulaASTAntlr(std::istream& in);
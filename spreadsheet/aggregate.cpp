@@ -0,0 +1,53 @@
+#include "aggregate.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGGREGATE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace aggregate {
+
+void Accumulate(const double* values, size_t count, Totals& totals) {
+    size_t i = 0;
+
+#ifdef AGGREGATE_SSE2
+    if (count >= 4) {
+        // two registers of two lanes each hide the latency of the additions
+        __m128d sum_lo = _mm_setzero_pd();
+        __m128d sum_hi = _mm_setzero_pd();
+        __m128d min_lo = _mm_set1_pd(totals.min);
+        __m128d min_hi = min_lo;
+        __m128d max_lo = _mm_set1_pd(totals.max);
+        __m128d max_hi = max_lo;
+        for (; i + 4 <= count; i += 4) {
+            const __m128d lo = _mm_loadu_pd(values + i);
+            const __m128d hi = _mm_loadu_pd(values + i + 2);
+            sum_lo = _mm_add_pd(sum_lo, lo);
+            sum_hi = _mm_add_pd(sum_hi, hi);
+            min_lo = _mm_min_pd(min_lo, lo);
+            min_hi = _mm_min_pd(min_hi, hi);
+            max_lo = _mm_max_pd(max_lo, lo);
+            max_hi = _mm_max_pd(max_hi, hi);
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(sum_lo, sum_hi));
+        totals.sum += lanes[0] + lanes[1];
+        _mm_storeu_pd(lanes, _mm_min_pd(min_lo, min_hi));
+        totals.min = std::min(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, _mm_max_pd(max_lo, max_hi));
+        totals.max = std::max(lanes[0], lanes[1]);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        totals.sum += values[i];
+        totals.min = std::min(totals.min, values[i]);
+        totals.max = std::max(totals.max, values[i]);
+    }
+    totals.count += count;
+}
+
+}  // namespace aggregate
\ No newline at end of file
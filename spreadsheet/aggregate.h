@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+
+namespace aggregate {
+
+// Running totals of the numbers passed to an aggregate function
+struct Totals {
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    size_t count = 0;
+};
+
+// Folds a contiguous run of numbers into the totals, four at a time with
+// SSE2 where it is available. The order of additions depends only on the
+// length of the run, so equal runs always give equal sums.
+void Accumulate(const double* values, size_t count, Totals& totals);
+
+}  // namespace aggregate
\ No newline at end of file
@@ -0,0 +1,776 @@
+#pragma once
+
+#include "cell_table.h"
+#include "common.h"
+#include "FormulaAST.h"
+#include "load_generator.h"
+#include "log_duration.h"
+#include "script_runner.h"
+#include "sheet.h"
+#include "sheet_server.h"
+#include "user_interface.h"
+#include "workbook.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace {
+
+    void BenchClearFromBottomRight() {
+        constexpr int ROWS = 10'000;
+        constexpr int COLS = 100;
+
+        CellTable table;
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                table.GetOrCreate({ row, col });
+            }
+        }
+
+        LOG_DURATION("Clear 10000x100 from the bottom right");
+        int checksum = 0;
+        for (int row = ROWS - 1; row >= 0; --row) {
+            for (int col = COLS - 1; col >= 0; --col) {
+                table.Erase({ row, col });
+                const Size bounds = table.GetBounds();
+                checksum += bounds.rows + bounds.cols;
+            }
+        }
+        if (0 != table.GetBounds().rows) {
+            std::cerr << "unexpected bounds, checksum " << checksum << std::endl;
+        }
+    }
+
+    // i-th cell of a chain that fills the sheet column by column
+    Position ChainPos(int i) {
+        return { i % Position::MAX_ROWS, i / Position::MAX_ROWS };
+    }
+
+    void BenchLongChain() {
+        constexpr int LENGTH = 100'000;
+
+        Sheet sheet;
+        {
+            LOG_DURATION("Build a chain of 100000 formulas");
+            sheet.SetCell(ChainPos(0), "1");
+            for (int i = 1; i < LENGTH; ++i) {
+                sheet.SetCell(ChainPos(i), "=" + ChainPos(i - 1).ToString() + "+1");
+            }
+        }
+        {
+            LOG_DURATION("Close the chain into a cycle");
+            try {
+                sheet.SetCell(ChainPos(0), "=" + ChainPos(LENGTH - 1).ToString());
+            }
+            catch (const CircularDependencyException&) {
+            }
+        }
+        {
+            LOG_DURATION("Edit the head of the chain");
+            sheet.SetCell(ChainPos(0), "2");
+        }
+    }
+
+    void BenchWideFanIn() {
+        constexpr int WIDTH = 10'000;
+
+        Sheet sheet;
+        for (int row = 0; row < WIDTH + 1; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+        }
+
+        LOG_DURATION("Fan-in of 10000 formulas sharing their inputs");
+        std::string total = "=";
+        for (int row = 0; row < WIDTH; ++row) {
+            const std::string pos = "B" + std::to_string(row + 1);
+            sheet.SetCell(Position::FromString(pos),
+                "=A" + std::to_string(row + 1) + "+A" + std::to_string(row + 2));
+            total += (row ? "+" : "") + pos;
+        }
+        sheet.SetCell({ 0, 2 }, total);
+        sheet.SetCell({ 0, 0 }, "100");
+    }
+
+    void BenchFormulaEvaluation() {
+        constexpr int RUNS = 1'000'000;
+
+        Sheet sheet;
+        sheet.SetCell({ 0, 0 }, "2");
+        sheet.SetCell({ 1, 0 }, "=A1*3");
+
+        const auto run = [&sheet](const std::string& name, const std::string& expr) {
+            const auto ast = ParseFormulaAST(expr);
+
+            double tree_total = 0;
+            double program_total = 0;
+            {
+                LOG_DURATION(name + ", walking the AST");
+                for (int i = 0; i < RUNS; ++i) {
+                    tree_total += ast.ExecuteTree(sheet);
+                }
+            }
+            {
+                LOG_DURATION(name + ", compiled program");
+                for (int i = 0; i < RUNS; ++i) {
+                    program_total += ast.Execute(sheet);
+                }
+            }
+            if (tree_total != program_total) {
+                std::cerr << "evaluation results differ" << std::endl;
+            }
+        };
+
+        run("Evaluate 1000000 arithmetic formulas",
+            "(1+2)*(3-2/4)+-(2*2-1)/(1+3*3)+3.5*6-7*(8-9/(1+2))");
+        run("Evaluate 1000000 formulas with references",
+            "(A1+A2)*(A1-A2/4)+-(A2*2-A1)/(1+A1*A1)+3.5*A2");
+        run("Evaluate 1000000 formulas with constant parts",
+            "A1*(24*60*60)/(1000*1)+--A2*1-(2+3)/4*A1+1*(A2-0)/(2*2)");
+    }
+
+    void BenchFormulaParsing() {
+        constexpr int COUNT = 100'000;
+
+        std::vector<std::string> formulas;
+        formulas.reserve(COUNT);
+        for (int i = 0; i < COUNT; ++i) {
+            const std::string row = std::to_string(i % Position::MAX_ROWS + 1);
+            formulas.push_back("(A" + row + "+B" + row + ")*1.5-C" + row + "/(2+D" + row + ")");
+        }
+
+        size_t total_cells = 0;
+        {
+            LOG_DURATION("Parse 100000 formulas with ANTLR");
+            for (const auto& formula : formulas) {
+                std::istringstream in(formula);
+                const auto ast = ParseFormulaASTAntlr(in);
+                total_cells += ast.GetCells().size();
+            }
+        }
+        {
+            LOG_DURATION("Parse 100000 formulas with the descent parser");
+            for (const auto& formula : formulas) {
+                const auto ast = ParseFormulaAST(formula);
+                total_cells -= ast.GetCells().size();
+            }
+        }
+        if (0 != total_cells) {
+            std::cerr << "parsers disagree" << std::endl;
+        }
+    }
+
+    void BenchBinarySnapshot() {
+        constexpr int ROWS = 1000;
+        constexpr int COLS = 1000;
+        const std::string path = "bench_snapshot.bin";
+
+        {
+            Sheet sheet;
+            sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+            {
+                LOG_DURATION("Replay SetCell for 1000000 cells");
+                for (int row = 0; row < ROWS; ++row) {
+                    sheet.SetCell({ row, 0 }, std::to_string(row));
+                    for (int col = 1; col < COLS; ++col) {
+                        sheet.SetCell({ row, col }, "=" + Position{ row, col - 1 }.ToString() + "*2+1");
+                    }
+                }
+                sheet.SetRecalcMode(Sheet::RecalcMode::Automatic);
+            }
+            LOG_DURATION("Save a snapshot of 1000000 cells");
+            sheet.SaveBinary(path);
+        }
+
+        std::unique_ptr<Sheet> sheet;
+        {
+            LOG_DURATION("Open a snapshot of 1000000 cells");
+            sheet = Sheet::LoadBinary(path);
+        }
+        {
+            LOG_DURATION("Read 1000 values from the snapshot");
+            double sum = 0;
+            for (int row = 0; row < ROWS; ++row) {
+                sum += std::get<double>(sheet->GetCell({ row, COLS - 1 })->GetValue());
+            }
+            if (0 == sum) {
+                std::cerr << "unexpected sum" << std::endl;
+            }
+        }
+        {
+            LOG_DURATION("First edit of the snapshot, restores all dependencies");
+            sheet->SetCell({ 0, 0 }, "1");
+        }
+        sheet.reset();
+        std::remove(path.c_str());
+    }
+
+    void BenchImportTable() {
+        constexpr int ROWS = 300;
+        constexpr int COLS = 1000;
+
+        std::string table;
+        for (int row = 0; row < ROWS; ++row) {
+            table += std::to_string(row);
+            for (int col = 1; col < COLS; ++col) {
+                table += "\t=" + Position{ row, col - 1 }.ToString() + "*2+1";
+            }
+            table += '\n';
+        }
+
+        {
+            LOG_DURATION("Import 300000 cells with getline and SetCell");
+            Sheet sheet;
+            std::istringstream in(table);
+            std::string line;
+            for (int row = 0; std::getline(in, line); ++row) {
+                std::istringstream fields(line);
+                std::string field;
+                for (int col = 0; std::getline(fields, field, '\t'); ++col) {
+                    if (!field.empty()) {
+                        sheet.SetCell({ row, col }, field);
+                    }
+                }
+            }
+        }
+        {
+            LOG_DURATION("Import 300000 cells with Sheet::Import");
+            Sheet sheet;
+            std::istringstream in(table);
+            sheet.Import(in, TableFormat::Tsv);
+        }
+    }
+
+    void BenchBatchEdits() {
+        constexpr int INPUTS = 100;
+        constexpr int FORMULAS = 1000;
+
+        std::string sum = "=A1";
+        for (int row = 1; row < INPUTS; ++row) {
+            sum += "+" + Position{ row, 0 }.ToString();
+        }
+        Sheet sheet;
+        for (int row = 0; row < FORMULAS; ++row) {
+            sheet.SetCell({ row, 1 }, sum);
+        }
+
+        {
+            LOG_DURATION("Edit 100 inputs of 1000 sums one by one");
+            for (int row = 0; row < INPUTS; ++row) {
+                sheet.SetCell({ row, 0 }, std::to_string(row));
+            }
+        }
+        {
+            LOG_DURATION("Edit 100 inputs of 1000 sums in a batch");
+            sheet.BeginBatch();
+            for (int row = 0; row < INPUTS; ++row) {
+                sheet.SetCell({ row, 0 }, std::to_string(row + 1));
+            }
+            sheet.CommitBatch();
+        }
+    }
+
+    void BenchClearColumn() {
+        constexpr int ROWS = 16'000;
+
+        Sheet sheet;
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::string(row % 50 + 1, 'x'));
+        }
+
+        LOG_DURATION("Clear a column of 16000 cells from the top");
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.ClearCell({ row, 0 });
+        }
+    }
+
+    void BenchDrawWindow() {
+        constexpr int ROWS = 16'000;
+        constexpr int COLS = 10;
+
+        Sheet sheet;
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+            const std::string formula = "=" + Position{ row, 0 }.ToString() + "*2";
+            for (int col = 1; col < COLS; ++col) {
+                sheet.SetCell({ row, col }, formula);
+            }
+        }
+
+        std::ostringstream out;
+        {
+            LOG_DURATION("Draw A1:H40 of 16000x10 cells");
+            sheet.DrawSheet(out, false, Rect::FromString("A1:H40"));
+        }
+        {
+            LOG_DURATION("Draw all 16000x10 cells");
+            sheet.DrawSheet(out, false);
+        }
+    }
+
+    // The output path before TableWriter: operator<< and a flush on every row
+    void PrintWithOstream(const Sheet& sheet, std::ostream& output, bool is_text) {
+        const Size size = sheet.GetPrintableSize();
+        for (int row = 0; row < size.rows; ++row) {
+            for (int col = 0; col < size.cols; ++col) {
+                if (0 != col) {
+                    output << '\t';
+                }
+                if (const Cell* cell = sheet.GetConcreteCell({ row, col })) {
+                    if (is_text) {
+                        output << cell->GetText();
+                    }
+                    else {
+                        std::visit(
+                            [&output](auto&& arg) {
+                                output << arg;
+                            }, cell->GetValue());
+                    }
+                }
+            }
+            output << std::endl;
+        }
+    }
+
+    void BenchPrintTable() {
+        constexpr int ROWS = 16'000;
+        constexpr int COLS = 20;
+        const std::string path = "bench_print.txt";
+
+        Sheet sheet;
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+            for (int col = 1; col < COLS; ++col) {
+                sheet.SetCell({ row, col }, "=" + Position{ row, col - 1 }.ToString() + "/3+1");
+            }
+        }
+
+        for (bool is_text : { false, true }) {
+            const std::string what = is_text ? "texts" : "values";
+            {
+                LOG_DURATION("Print " + what + " of 320000 cells with operator<<");
+                std::ofstream out(path);
+                PrintWithOstream(sheet, out, is_text);
+            }
+            {
+                LOG_DURATION("Print " + what + " of 320000 cells with TableWriter");
+                std::ofstream out(path);
+                is_text ? sheet.PrintTexts(out) : sheet.PrintValues(out);
+            }
+        }
+        std::remove(path.c_str());
+    }
+
+    void BenchParallelRecalculation() {
+        constexpr int ROWS = 10'000;
+        constexpr int COLS = 40;
+
+        // wide and shallow: every formula reads the inputs of its row
+        Sheet sheet;
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        for (int row = 0; row < ROWS; ++row) {
+            const std::string a = Position{ row, 0 }.ToString();
+            const std::string b = Position{ row, 1 }.ToString();
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+            sheet.SetCell({ row, 1 }, "=" + a + "/7");
+            for (int col = 2; col < COLS; ++col) {
+                sheet.SetCell({ row, col }, "=" + a + "*" + std::to_string(col) + "+" + b + "/(" + a + "+1)");
+            }
+        }
+
+        const size_t hardware = std::max(2u, std::thread::hardware_concurrency());
+        for (size_t threads : { size_t{ 1 }, hardware }) {
+            sheet.SetThreadCount(threads);
+            for (int row = 0; row < ROWS; ++row) {
+                sheet.SetCell({ row, 0 }, std::to_string(row + static_cast<int>(threads)));
+            }
+            LOG_DURATION("Recalculate 390000 formulas on " + std::to_string(threads) + " threads");
+            sheet.Recalculate();
+        }
+    }
+
+    void BenchRangeAggregates() {
+        constexpr int ROWS = 10'000;
+        constexpr int RUNS = 1'000;
+
+        Sheet sheet;
+        std::string terms;
+        for (int row = 0; row < ROWS; ++row) {
+            const std::string pos = Position{ row, 0 }.ToString();
+            sheet.SetCell({ row, 0 }, std::to_string(row % 97));
+            terms += (row ? "+" : "") + pos;
+        }
+
+        const auto run = [&sheet](const std::string& name, const std::string& expr) {
+            const auto ast = ParseFormulaAST(expr);
+            double total = 0;
+            LOG_DURATION(name);
+            for (int i = 0; i < RUNS; ++i) {
+                total += ast.Execute(sheet);
+            }
+            return total;
+        };
+
+        const double sum = run("Sum 10000 cells 1000 times with SUM(A1:A10000)", "SUM(A1:A10000)");
+        const double added = run("Sum 10000 cells 1000 times with A1+A2+...+A10000", terms);
+        if (sum != added) {
+            std::cerr << "aggregate results differ" << std::endl;
+        }
+        run("Average, min and max of 10000 cells 1000 times",
+            "AVERAGE(A1:A10000)+MIN(A1:A10000)+MAX(A1:A10000)");
+    }
+
+    void BenchRangeDependencies() {
+        constexpr int FORMULAS = 10'000;
+        constexpr int WINDOW = 1'000;
+        constexpr int EDITS = 10'000;
+
+        Sheet sheet;
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        {
+            LOG_DURATION("Set 10000 formulas summing sliding windows of 1000 empty cells");
+            for (int row = 0; row < FORMULAS; ++row) {
+                sheet.SetCell({ row, 1 }, "=SUM(A" + std::to_string(row + 1) + ":A"
+                    + std::to_string(row + WINDOW) + ")");
+            }
+        }
+        {
+            LOG_DURATION("Edit 10000 cells covered by the windows");
+            for (int i = 0; i < EDITS; ++i) {
+                sheet.SetCell({ (i * 7919) % FORMULAS, 0 }, std::to_string(i % 10));
+            }
+        }
+        {
+            LOG_DURATION("Recalculate the windows");
+            sheet.Recalculate();
+        }
+    }
+
+    void BenchPlainCells() {
+        constexpr int SIDE = 1'000;
+        constexpr int READS = 10;
+
+        Sheet sheet;
+        {
+            LOG_DURATION("Set 1000000 numbers and texts");
+            for (int row = 0; row < SIDE; ++row) {
+                for (int col = 0; col < SIDE; ++col) {
+                    sheet.SetCell({ row, col }, col % 10 ? std::to_string(row * col % 1000) : "label");
+                }
+            }
+        }
+        double total = 0;
+        {
+            LOG_DURATION("Read 1000000 values 10 times");
+            for (int i = 0; i < READS; ++i) {
+                for (int row = 0; row < SIDE; ++row) {
+                    for (int col = 0; col < SIDE; ++col) {
+                        const auto value = sheet.GetCell({ row, col })->GetValue();
+                        if (const auto* number = std::get_if<double>(&value)) {
+                            total += *number;
+                        }
+                    }
+                }
+            }
+        }
+        if (total < 0) {
+            std::cerr << total << std::endl;
+        }
+    }
+
+    void BenchFormulaTemplates() {
+        constexpr int ROWS = Position::MAX_ROWS;
+        constexpr int COLS = 30;
+
+        std::vector<std::string> formulas;
+        formulas.reserve(ROWS);
+        for (int row = 0; row < ROWS; ++row) {
+            const std::string r = std::to_string(row + 1);
+            formulas.push_back("A" + r + "*B" + r + "+SUM(A" + r + ":B" + r + ")");
+        }
+
+        // the formulas are kept as cells keep them, so the templates stay
+        std::vector<std::unique_ptr<FormulaInterface>> parsed;
+        parsed.reserve(ROWS * COLS);
+        {
+            LOG_DURATION("Parse 491520 filled down formulas one by one");
+            for (int col = 0; col < COLS; ++col) {
+                for (int row = 0; row < ROWS; ++row) {
+                    parsed.push_back(ParseFormula(formulas[row]));
+                }
+            }
+        }
+        parsed.clear();
+        {
+            LOG_DURATION("Parse 491520 filled down formulas with shared templates");
+            for (int col = 0; col < COLS; ++col) {
+                for (int row = 0; row < ROWS; ++row) {
+                    parsed.push_back(ParseFormula(formulas[row], { row, 2 }));
+                }
+            }
+        }
+        parsed.clear();
+
+        Sheet sheet;
+        LOG_DURATION("Fill down 16384 formulas in a sheet");
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 2 }, "=" + formulas[row]);
+        }
+    }
+
+    void BenchDependencyGraph() {
+        constexpr int ROWS = Position::MAX_ROWS;
+        constexpr int COLS = 30;
+
+        // every formula reads the two cells to its left
+        auto formula = [](int row, int col, int shift) {
+            return "=" + Position{ row, col - 1 }.ToString() + "+"
+                + Position{ (row + shift) % ROWS, col - 1 }.ToString();
+        };
+
+        Sheet sheet;
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+        }
+        {
+            LOG_DURATION("Link 475136 formulas of a 16384x30 grid");
+            for (int col = 1; col < COLS; ++col) {
+                for (int row = 0; row < ROWS; ++row) {
+                    sheet.SetCell({ row, col }, formula(row, col, 1));
+                }
+            }
+        }
+        {
+            LOG_DURATION("Relink 475136 formulas to other inputs");
+            for (int col = 1; col < COLS; ++col) {
+                for (int row = 0; row < ROWS; ++row) {
+                    sheet.SetCell({ row, col }, formula(row, col, 7));
+                }
+            }
+        }
+        LOG_DURATION("Recalculate 475136 linked formulas");
+        sheet.Recalculate();
+    }
+
+    void BenchSnapshots() {
+        constexpr int ROWS = 10000;
+        constexpr int COLS = 10;
+        constexpr int EDITS = 2000;
+        constexpr int READERS = 4;
+
+        Sheet sheet;
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+            for (int col = 1; col < COLS; ++col) {
+                sheet.SetCell({ row, col }, "=" + Position{ row, col - 1 }.ToString() + "*2");
+            }
+        }
+
+        {
+            LOG_DURATION("Take the first snapshot of 100000 cells");
+            sheet.Snapshot();
+        }
+        {
+            LOG_DURATION("Take 2000 snapshots after an edit of 10 cells each");
+            for (int i = 0; i < EDITS; ++i) {
+                sheet.SetCell({ i % ROWS, 0 }, std::to_string(i));
+                sheet.Snapshot();
+            }
+        }
+
+        // the writer edits while the readers print the whole sheet, either
+        // sharing a lock with it or each from the latest snapshot
+        const auto run = [&sheet](bool snapshots) {
+            std::mutex mutex;
+            std::atomic<bool> done{ false };
+            std::atomic<int> prints{ 0 };
+            SheetView current = sheet.Snapshot();
+            std::vector<std::thread> readers;
+            for (int i = 0; i < READERS; ++i) {
+                readers.emplace_back([&] {
+                    while (!done) {
+                        std::ostringstream out;
+                        if (snapshots) {
+                            std::unique_lock lock(mutex);
+                            SheetView view = current;
+                            lock.unlock();
+                            view.PrintValues(out);
+                        }
+                        else {
+                            std::lock_guard lock(mutex);
+                            sheet.PrintValues(out);
+                        }
+                        ++prints;
+                    }
+                });
+            }
+            auto longest_edit = std::chrono::steady_clock::duration::zero();
+            for (int i = 0; i < EDITS; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                std::unique_lock lock(mutex);
+                sheet.SetCell({ i % ROWS, 0 }, std::to_string(i));
+                if (snapshots) {
+                    lock.unlock();
+                    SheetView view = sheet.Snapshot();
+                    lock.lock();
+                    current = view;
+                }
+                longest_edit = std::max(longest_edit, std::chrono::steady_clock::now() - start);
+            }
+            done = true;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            std::cerr << prints << " prints, the longest edit "
+                << std::chrono::duration_cast<std::chrono::microseconds>(longest_edit).count()
+                << " us. ";
+        };
+        {
+            LOG_DURATION("Edit 2000 times while 4 threads print under the lock");
+            run(false);
+        }
+        {
+            LOG_DURATION("Edit 2000 times while 4 threads print snapshots");
+            run(true);
+        }
+    }
+
+    void BenchWorkbook() {
+        constexpr int SHEETS = 16;
+        constexpr int ROWS = 5'000;
+
+        // every sheet is a column of formulas over the total of another one:
+        // the base sheet for independent sheets, the previous one for a chain
+        const auto build = [](Workbook& book, bool chained) {
+            book.AddSheet("Base").SetCell({ 0, 0 }, "1");
+            for (int i = 0; i < SHEETS; ++i) {
+                Sheet& sheet = book.AddSheet("S" + std::to_string(i));
+                const std::string source = chained && i > 0 ? "S" + std::to_string(i - 1) : "Base";
+                sheet.SetCell({ 0, 0 }, "=" + source + "!A1+1");
+                for (int row = 1; row < ROWS; ++row) {
+                    sheet.SetCell({ row, 0 }, "=A" + std::to_string(row) + "*1.0001");
+                }
+                sheet.SetCell({ 0, 1 }, "=SUM(A1:A" + std::to_string(ROWS) + ")");
+            }
+            book.SetRecalcMode(Workbook::RecalcMode::Manual);
+        };
+
+        for (bool chained : { false, true }) {
+            for (size_t threads : { 1, 4 }) {
+                Workbook book;
+                book.SetThreadCount(threads);
+                build(book, chained);
+                book.GetSheet("Base")->SetCell({ 0, 0 }, "2");
+                const std::string name = std::string("Recalculate 16 ")
+                    + (chained ? "chained" : "independent") + " sheets of 5000 formulas on "
+                    + std::to_string(threads) + " thread(s)";
+                LOG_DURATION(name);
+                book.Recalculate();
+            }
+        }
+    }
+#if defined(__linux__)
+    void BenchSheetServer() {
+        const std::string path = "bench_sheet_server.sock";
+        SheetServer server(path, 4);
+        std::thread loop([&server] {
+            server.Run();
+        });
+
+        // one command at a time shows the latency, a deep pipeline the throughput
+        for (size_t pipeline : { 1, 64 }) {
+            for (double write_share : { 0.0, 0.1, 0.5 }) {
+                LoadOptions options;
+                options.address = path;
+                options.connections = 16;
+                options.requests = 10'000;
+                options.pipeline = pipeline;
+                options.write_share = write_share;
+                std::cerr << "16 connections, pipeline " << pipeline << ", "
+                    << write_share * 100 << "% edits: " << RunLoad(options) << std::endl;
+            }
+        }
+
+        server.Stop();
+        loop.join();
+    }
+#endif
+
+    void BenchScriptRunner() {
+        constexpr int ROWS = 10'000;
+        constexpr int COLS = 10;
+
+        // columns of numbers A:J and formulas over them K:T, a read every
+        // thousand rows
+        std::string script;
+        for (int row = 1; row <= ROWS; ++row) {
+            const std::string index = std::to_string(row);
+            for (char col = 'A'; col < 'A' + COLS; ++col) {
+                script += "set " + (col + index) + ' ' + index + '\n';
+                script += "set " + (char(col + COLS) + index) + " =" + (col + index) + "*2+1\n";
+            }
+            if (0 == row % 1'000) {
+                script += "get " + (char('A' + 2 * COLS - 1) + index) + '\n';
+            }
+        }
+
+        {
+            Sheet sheet;
+            std::istringstream input(script);
+            std::ostringstream output;
+            UserInterfece console(input, output, sheet);
+            LOG_DURATION("Run 200010 commands through the console interface");
+            while (input) {
+                InputData data = console.Read();
+                console.Execute(data);
+            }
+        }
+        for (size_t batch_size : { 1, 4'096 }) {
+            Sheet sheet;
+            std::istringstream input(script);
+            std::ostringstream output;
+            ScriptOptions options;
+            options.batch_size = batch_size;
+            std::cerr << "Script of 200010 commands, batches of " << batch_size << " edits: "
+                << RunScript(input, output, std::cerr, sheet, options) << std::endl;
+        }
+    }
+}  // namespace
+
+void RunBenchmarks() {
+    BenchClearFromBottomRight();
+    BenchLongChain();
+    BenchWideFanIn();
+    BenchFormulaEvaluation();
+    BenchFormulaParsing();
+    BenchBinarySnapshot();
+    BenchImportTable();
+    BenchBatchEdits();
+    BenchClearColumn();
+    BenchDrawWindow();
+    BenchPrintTable();
+    BenchParallelRecalculation();
+    BenchRangeAggregates();
+    BenchRangeDependencies();
+    BenchPlainCells();
+    BenchFormulaTemplates();
+    BenchDependencyGraph();
+    BenchSnapshots();
+    BenchWorkbook();
+#if defined(__linux__)
+    BenchSheetServer();
+#endif
+    BenchScriptRunner();
+}
@@ -1,182 +1,400 @@
 #include "cell.h"
 
+#include "sheet.h"
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <optional>
 
 namespace {
 
-static bool IsNumber(const std::string& text) {
-    if (text.empty()) {
-        return false;
+static std::atomic<int64_t> next_order{ 0 };
+// orders given out by MoveToStartOfOrder(), all below next_order
+static std::atomic<int64_t> first_order{ 0 };
+
+// Digits of a number which are kept as the number itself and printed back
+// the same: no leading zeros and few enough to be exact in a double
+static constexpr size_t MAX_NUMBER_DIGITS = 15;
+
+static std::optional<double> ParseExactNumber(std::string_view text) {
+    if (text.empty() || text.size() > MAX_NUMBER_DIGITS || (text.size() > 1 && '0' == text.front())) {
+        return std::nullopt;
     }
-    const auto not_digit_it = std::find_if_not(
-        text.begin(), text.end(),
-        [](const char ch) {
-            return std::isdigit(ch);
-        });
+    int64_t number = 0;
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (ec != std::errc() || ptr != text.data() + text.size() || number < 0) {
+        return std::nullopt;
+    }
+    return static_cast<double>(number);
+}
 
-    return text.end() == not_digit_it;
+static std::string PrintExactNumber(double number) {
+    return std::to_string(static_cast<int64_t>(number));
 }
 
 }   // namespace
 
+struct Cell::FormulaData {
+    std::unique_ptr<FormulaInterface> expr;
+    const SheetInterface* sheet = nullptr;
+    mutable std::optional<Value> cache;
+};
+
+// Content
+
+Cell::Content::Content(Content&& other) noexcept
+    : kind_(std::exchange(other.kind_, Kind::Empty))
+    , data_(other.data_)
+{}
+
+Cell::Content& Cell::Content::operator=(Content&& other) noexcept {
+    if (this != &other) {
+        Destroy(kind_, data_);
+        kind_ = std::exchange(other.kind_, Kind::Empty);
+        data_ = other.data_;
+    }
+    return *this;
+}
+
+Cell::Content::~Content() {
+    Destroy(kind_, data_);
+}
+
 // public
 
-Cell::Cell() : impl_(std::make_unique<EmptyImpl>()) {}
+Cell::Cell()
+    : order_(next_order++)
+{}
+
+Cell::Cell(Position pos)
+    : Cell() {
+    row_ = static_cast<int16_t>(pos.row);
+    col_ = static_cast<int16_t>(pos.col);
+}
 
-Cell::~Cell() = default;
+Cell::~Cell() {
+    Destroy(kind_, data_);
+}
 
-void Cell::Set(std::string text, const SheetInterface* sheet) {
-    auto new_cell = std::make_unique<Cell>();
-    new_cell->sheet_ = sheet;
+Position Cell::GetPosition() const {
+    return { row_, col_ };
+}
 
-    if (!text.empty() && FORMULA_SIGN == text.front()) {
-        new_cell->impl_ = std::make_unique<FormulaImpl>(text.substr(1));
-    }
-    else {
-        new_cell->impl_ = std::make_unique<TextImpl>(text);
-        ReleaseOldCell(*new_cell);
+void Cell::Set(std::string text, const SheetInterface* sheet) {
+    Content content = MakeContent(text, sheet, GetPosition());
+    if (Kind::Formula != content.kind_) {
+        Restore(std::move(content));
         return;
     }
 
-    const auto ref = new_cell->impl_->GetReferences();
-    for (Position pos : ref) {
+    const FormulaInterface& formula = *content.data_.formula->expr;
+    std::unordered_set<const Cell*> dependencies;
+    for (Position pos : formula.GetReferencedCells()) {
         if (nullptr == sheet->GetCell(pos)) {
             const_cast<SheetInterface*>(sheet)->SetCell(pos, "");
         }
-        new_cell->dependencies_.insert(
-            reinterpret_cast<const Cell*>(sheet->GetCell(pos))
-        );
+        dependencies.insert(static_cast<const Cell*>(sheet->GetCell(pos)));
     }
+    std::vector<Rect> ranges = formula.GetReferencedRanges();
 
-    //std::unordered_set<const Cell*> road;
-    std::unordered_set<const Cell*> passed;
-    passed.insert(this);
-    new_cell->WalkByDependencies(passed);
-    ReleaseOldCell(*new_cell);
+    const auto& owner = static_cast<const Sheet&>(*sheet);
+    const auto order_changes = CheckCircularDependencies(owner, dependencies, ranges);
+    owner.CheckSheetCycles(this, dependencies, ranges, formula.GetSheetReferences());
+    Restore(std::move(content));
+    for (const auto& [cell, order] : order_changes) {
+        cell->order_ = order;
+    }
 }
 
 void Cell::Clear() {
-    Set("", sheet_);
+    Set("", nullptr);
 }
 
 Cell::Value Cell::GetValue() const {
-    return impl_->GetValue(*sheet_);
+    switch (kind_) {
+    case Kind::Empty:
+        return Value();
+    case Kind::Number:
+        return data_.number;
+    case Kind::Text:
+        if (data_.text->number) {
+            return *data_.text->number;
+        }
+        return std::string(data_.text->GetShown());
+    case Kind::Formula:
+        break;
+    }
+
+    const FormulaData& formula = *data_.formula;
+    if (!formula.cache.has_value()) {
+        const auto val = formula.expr->Evaluate(*formula.sheet);
+        if (std::holds_alternative<double>(val)) {
+            formula.cache.emplace(std::get<double>(val));
+        }
+        else {
+            formula.cache.emplace(std::get<FormulaError>(val));
+        }
+    }
+    return formula.cache.value();
 }
 std::string Cell::GetText() const {
-    return impl_->GetText();
+    switch (kind_) {
+    case Kind::Empty:
+        return "";
+    case Kind::Number:
+        return PrintExactNumber(data_.number);
+    case Kind::Text:
+        return data_.text->text;
+    case Kind::Formula:
+        break;
+    }
+    return FORMULA_SIGN + data_.formula->expr->GetExpression();
 }
-
-std::vector<Position> Cell::GetReferencedCells() const {
-    return impl_->GetReferences();
+std::optional<Cell::Value> Cell::GetCachedValue() const {
+    if (Kind::Formula == kind_) {
+        return data_.formula->cache;
+    }
+    return GetValue();
 }
 
-bool Cell::IsReferenced() const {
-    return !dependants_.empty();
+void Cell::WriteText(TableWriter& writer) const {
+    switch (kind_) {
+    case Kind::Empty:
+        break;
+    case Kind::Number:
+        writer.Write(std::string_view(PrintExactNumber(data_.number)));
+        break;
+    case Kind::Text:
+        writer.Write(std::string_view(data_.text->text));
+        break;
+    case Kind::Formula:
+        writer.Write(FORMULA_SIGN);
+        writer.Write(std::string_view(data_.formula->expr->GetExpression()));
+        break;
+    }
+}
+void Cell::WriteValue(TableWriter& writer) const {
+    switch (kind_) {
+    case Kind::Empty:
+        break;
+    case Kind::Number:
+        writer.Write(data_.number);
+        break;
+    case Kind::Text:
+        if (data_.text->number) {
+            writer.Write(*data_.text->number);
+        }
+        else {
+            writer.Write(data_.text->GetShown());
+        }
+        break;
+    case Kind::Formula:
+        writer.Write(GetValue());
+        break;
+    }
 }
 
-void Cell::EraseDependencies() {
-    for (auto& c : dependencies_) {
-        c->dependants_.erase(this);
+std::vector<Position> Cell::GetReferencedCells() const {
+    if (Kind::Formula != kind_) {
+        return {};
     }
+    return data_.formula->expr->GetReferencedCells();
 }
 
-// private
+std::vector<Rect> Cell::GetReferencedRanges() const {
+    if (Kind::Formula != kind_) {
+        return {};
+    }
+    return data_.formula->expr->GetReferencedRanges();
+}
 
-void Cell::ReleaseOldCell(Cell& new_cell) {
-    EraseDependencies();
-    for (auto& c : new_cell.dependencies_) {
-        c->dependants_.insert(this);
+std::vector<SheetReference> Cell::GetSheetReferences() const {
+    if (Kind::Formula != kind_) {
+        return {};
     }
+    return data_.formula->expr->GetSheetReferences();
+}
 
-    std::swap(sheet_, new_cell.sheet_);
-    std::swap(impl_, new_cell.impl_);
-    std::swap(dependencies_, new_cell.dependencies_);
+bool Cell::IsFormula() const {
+    return Kind::Formula == kind_;
 }
 
-void Cell::WalkByDependencies(std::unordered_set<const Cell*>& passed) const {
-    if (passed.count(this)) {
-        throw CircularDependencyException("Circular dependency found");
-    }
-    if (dependencies_.empty()) {
-        return;
+bool Cell::InvalidateValue() const {
+    if (Kind::Formula != kind_) {
+        return false;
     }
+    const bool had_value = data_.formula->cache.has_value();
+    data_.formula->cache.reset();
+    return had_value;
+}
 
-    passed.insert(this);
-    for (auto& c : dependencies_) {
-        c->WalkByDependencies(passed);
-    }
+void Cell::Load(std::string text, const SheetInterface* sheet) {
+    Restore(MakeContent(text, sheet, GetPosition()));
 }
 
-void Cell::InvalidateValue() const {
-    if (typeid(FormulaImpl) == typeid(impl_)) {
-        impl_->Invalidate();
-        for (auto& c : dependants_) {
-            c->InvalidateValue();
-        }
-    }
+void Cell::Load(std::unique_ptr<FormulaInterface> formula, FormulaInterface::Value value,
+    const SheetInterface* sheet) {
+    Content content;
+    content.kind_ = Kind::Formula;
+    content.data_.formula = new FormulaData{ std::move(formula), sheet, std::nullopt };
+    std::visit([&content](auto&& arg) {
+            content.data_.formula->cache.emplace(arg);
+        }, value);
+    Restore(std::move(content));
 }
 
-// EmptyImpl
-std::string Cell::EmptyImpl::GetText() const {
-    return "";
+Cell::Content Cell::Exchange(std::string_view text, const SheetInterface* sheet) {
+    Content content = MakeContent(text, sheet, GetPosition());
+    std::swap(kind_, content.kind_);
+    std::swap(data_, content.data_);
+    return content;
 }
-CellInterface::Value Cell::EmptyImpl::GetValue(const SheetInterface&) const {
-    return Value();
+
+void Cell::Restore(Content content) {
+    std::swap(kind_, content.kind_);
+    std::swap(data_, content.data_);
 }
-std::vector<Position> Cell::EmptyImpl::GetReferences() const {
-    return {};
+
+void Cell::MoveToEndOfOrder() const {
+    order_ = next_order++;
 }
-void Cell::EmptyImpl::Invalidate() const {}
 
-// TextImpl
-Cell::TextImpl::TextImpl(std::string input)
-    : text_(input)
-{}
-std::string Cell::TextImpl::GetText() const {
-    return text_;
+void Cell::MoveToStartOfOrder() const {
+    order_ = --first_order;
 }
-CellInterface::Value Cell::TextImpl::GetValue(const SheetInterface&) const {
-    if (!text_.empty() && ESCAPE_SIGN == text_.front()) {
-        return text_.substr(1);
+
+bool Cell::IsOrderedAfter(const Cell& other) const {
+    return order_ > other.order_;
+}
+
+// private
+
+Cell::Content Cell::MakeContent(std::string_view text, const SheetInterface* sheet, Position pos) {
+    Content content;
+    if (text.empty()) {
+        return content;
+    }
+    if (FORMULA_SIGN == text.front()) {
+        auto expr = ParseFormula(std::string(text.substr(1)), pos);
+        content.kind_ = Kind::Formula;
+        content.data_.formula = new FormulaData{ std::move(expr), sheet, std::nullopt };
     }
-    else if (IsNumber(text_)) {
-        return std::stod(text_);
+    else if (const auto number = ParseExactNumber(text)) {
+        content.kind_ = Kind::Number;
+        content.data_.number = *number;
     }
     else {
-        return text_;
+        content.kind_ = Kind::Text;
+        content.data_.text = TextPool::Intern(text);
     }
+    return content;
 }
-std::vector<Position> Cell::TextImpl::GetReferences() const {
-    return {};
-}
-void Cell::TextImpl::Invalidate() const {}
 
-// FormulaImpl
-Cell::FormulaImpl::FormulaImpl(std::string input)
-    : expr_(ParseFormula(input))
-{}
-std::string Cell::FormulaImpl::GetText() const {
-    return FORMULA_SIGN + expr_->GetExpression();
+void Cell::Destroy(Kind kind, Data data) {
+    if (Kind::Text == kind) {
+        TextPool::Release(data.text);
+    }
+    else if (Kind::Formula == kind) {
+        delete data.formula;
+    }
 }
-CellInterface::Value Cell::FormulaImpl::GetValue(const SheetInterface& sheet) const {
-    if (!cache_.has_value()) {
-        const auto val = expr_->Evaluate(sheet);
-        if (std::holds_alternative<double>(val)) {
-            cache_.emplace(std::get<double>(val));
-        }
-        else {
-            cache_.emplace(std::get<FormulaError>(val));
+
+// Only the cells whose order lies between this cell and its latest new
+// dependency are visited, every other part of the graph stays untouched.
+// Returns the new orders to apply once the dependencies are committed.
+// The cells inside the ranges are new dependencies as well.
+Cell::OrderChanges Cell::CheckCircularDependencies(const Sheet& sheet,
+    const std::unordered_set<const Cell*>& dependencies,
+    const std::vector<Rect>& ranges) const {
+
+    const auto is_dependency = [&dependencies, &ranges](const Cell* cell) {
+        return dependencies.count(cell) != 0
+            || std::any_of(ranges.begin(), ranges.end(), [cell](const Rect& range) {
+                return range.Contains(cell->GetPosition());
+            });
+    };
+    if (is_dependency(this)) {
+        throw CircularDependencyException("Circular dependency found");
+    }
+
+    int64_t upper = order_;
+    const auto raise_upper = [&upper](const Cell* dep) {
+        upper = std::max(upper, dep->order_);
+    };
+    std::for_each(dependencies.begin(), dependencies.end(), raise_upper);
+    for (const Rect& range : ranges) {
+        sheet.ForEachCellInRange(range, raise_upper);
+    }
+    if (upper == order_) {
+        return {};
+    }
+
+    // cells reachable from this one that have to move after the dependencies
+    std::vector<const Cell*> forward;
+    std::unordered_set<const Cell*> visited{ this };
+    std::vector<const Cell*> stack{ this };
+    while (!stack.empty()) {
+        const Cell* cell = stack.back();
+        stack.pop_back();
+        forward.push_back(cell);
+
+        sheet.ForEachDependant(cell, [&](const Cell* dependant) {
+            if (is_dependency(dependant)) {
+                throw CircularDependencyException("Circular dependency found");
+            }
+            if (dependant->order_ < upper && visited.insert(dependant).second) {
+                stack.push_back(dependant);
+            }
+        });
+    }
+
+    // cells the misplaced dependencies rely on that have to move before this one
+    std::vector<const Cell*> backward;
+    const auto push_misplaced = [&](const Cell* dep) {
+        if (dep->order_ > order_ && visited.insert(dep).second) {
+            stack.push_back(dep);
         }
+    };
+    std::for_each(dependencies.begin(), dependencies.end(), push_misplaced);
+    for (const Rect& range : ranges) {
+        sheet.ForEachCellInRange(range, push_misplaced);
     }
-    return cache_.value();
-}
-std::vector<Position> Cell::FormulaImpl::GetReferences() const {
-    return expr_->GetReferencedCells();
-}
-void Cell::FormulaImpl::Invalidate() const {
-    cache_.reset();
-}
+    while (!stack.empty()) {
+        const Cell* cell = stack.back();
+        stack.pop_back();
+        backward.push_back(cell);
+        sheet.ForEachDependency(cell, push_misplaced);
+    }
+
+    const auto by_order = [](const Cell* lhs, const Cell* rhs) {
+        return lhs->order_ < rhs->order_;
+    };
+    std::sort(forward.begin(), forward.end(), by_order);
+    std::sort(backward.begin(), backward.end(), by_order);
+
+    std::vector<int64_t> orders;
+    orders.reserve(forward.size() + backward.size());
+    for (const Cell* cell : backward) {
+        orders.push_back(cell->order_);
+    }
+    for (const Cell* cell : forward) {
+        orders.push_back(cell->order_);
+    }
+    std::sort(orders.begin(), orders.end());
+
+    OrderChanges changes;
+    changes.reserve(orders.size());
+    auto order_it = orders.begin();
+    for (const Cell* cell : backward) {
+        changes.emplace_back(cell, *order_it++);
+    }
+    for (const Cell* cell : forward) {
+        changes.emplace_back(cell, *order_it++);
+    }
+    return changes;
+}
\ No newline at end of file
@@ -2,72 +2,128 @@
 
 #include "common.h"
 #include "formula.h"
+#include "table_export.h"
+#include "text_pool.h"
 
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <string_view>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+
+class Sheet;
 
 class Cell : public CellInterface {
+    enum class Kind : uint8_t {
+        Empty,
+        Number,
+        Text,
+        Formula,
+    };
+    struct FormulaData;
+    union Data {
+        double number;
+        const TextPool::Entry* text;
+        FormulaData* formula;
+    };
+
 public:
+    // Content detached from a cell by Exchange(), kept to undo an edit
+    class Content {
+    public:
+        Content() = default;
+        Content(Content&& other) noexcept;
+        Content& operator=(Content&& other) noexcept;
+        ~Content();
+
+    private:
+        friend class Cell;
+
+        Kind kind_ = Kind::Empty;
+        Data data_{};
+    };
+
     Cell();
+    // Cells of a sheet know their position, ranges are looked up by it
+    explicit Cell(Position pos);
+    Cell(const Cell&) = delete;
+    Cell& operator=(const Cell&) = delete;
     ~Cell();
 
+    Position GetPosition() const;
+
+    // Creates the cells a formula refers to and checks it for cycles, also
+    // through other sheets. The sheet links the new content into its
+    // dependency graph afterwards.
     void Set(std::string text, const SheetInterface* sheet);
     void Clear();
 
     Value GetValue() const override;
     std::string GetText() const override;
+    // The value without evaluating, nullopt for a formula not evaluated yet
+    std::optional<Value> GetCachedValue() const;
+
+    // The same as GetText() and GetValue(), written into the output buffer
+    // without temporary strings
+    void WriteText(TableWriter& writer) const;
+    void WriteValue(TableWriter& writer) const;
 
     std::vector<Position> GetReferencedCells() const override;
-    bool IsReferenced() const;
-    void EraseDependencies();
+    // Ranges of the content, their cells are not in GetReferencedCells()
+    std::vector<Rect> GetReferencedRanges() const;
+    // Cells and ranges of other sheets of the workbook
+    std::vector<SheetReference> GetSheetReferences() const;
+    bool IsFormula() const;
 
-private:
-    void ReleaseOldCell(Cell& old_cell);
-    void WalkByDependencies(std::unordered_set<const Cell*>& passed) const;
-    void InvalidateValue() const;
+    // Drops the cached formula value, returns true if there was one
+    bool InvalidateValue() const;
 
-    class Impl {
-    public:
-        virtual Value GetValue(const SheetInterface&) const = 0;
-        virtual std::string GetText() const = 0;
-        virtual std::vector<Position> GetReferences() const = 0;
-        virtual void Invalidate() const = 0;
-    };
+    // Restore a cell from a snapshot without parsing, the cell is not
+    // linked to its dependencies until the sheet links it
+    void Load(std::string text, const SheetInterface* sheet);
+    void Load(std::unique_ptr<FormulaInterface> formula, FormulaInterface::Value value,
+        const SheetInterface* sheet);
 
-    class EmptyImpl : public Impl {
-    public:
-        std::string GetText() const override;
-        Value GetValue(const SheetInterface&) const override;
-        std::vector<Position> GetReferences() const override;
-        void Invalidate() const override;
-    };
+    // Batch edits replace the content without touching the dependency
+    // graph, the sheet relinks the cells once the whole batch is applied.
+    // Throws FormulaException and keeps the content if the formula is wrong.
+    Content Exchange(std::string_view text, const SheetInterface* sheet);
+    void Restore(Content content);
+    // Moves the cell after every other one in the topological order
+    void MoveToEndOfOrder() const;
+    // Moves the cell before every other one, valid for a cell without
+    // dependencies such as a new empty one
+    void MoveToStartOfOrder() const;
+    // True if the cell goes after the other one in the topological order
+    bool IsOrderedAfter(const Cell& other) const;
 
-    class TextImpl : public Impl {
-    private:
-        std::string text_;
-    public:
-        explicit TextImpl(std::string input);
-        std::string GetText() const override;
-        Value GetValue(const SheetInterface&) const override;
-        std::vector<Position> GetReferences() const override;
-        void Invalidate() const override;
-    };
+private:
+    friend class DependencyGraph;
 
-    class FormulaImpl : public Impl {
-    private:
-        std::unique_ptr<FormulaInterface> expr_;
-        mutable std::optional<Value> cache_;
-    public:
-        explicit FormulaImpl(std::string input);
-        std::string GetText() const override;
-        Value GetValue(const SheetInterface& sheet) const override;
-        std::vector<Position> GetReferences() const override;
-        void Invalidate() const override;
-    };
+    using OrderChanges = std::vector<std::pair<const Cell*, int64_t>>;
+    using GraphId = uint32_t;
+    static constexpr GraphId NO_GRAPH_ID = UINT32_MAX;
+
+    // A formula is parsed, a text is classified once: digits without
+    // leading zeros are kept as a number, other texts are interned.
+    // Formulas of cells filled down or across share a template.
+    // Throws FormulaException for a wrong formula.
+    static Content MakeContent(std::string_view text, const SheetInterface* sheet, Position pos);
+    static void Destroy(Kind kind, Data data);
 
-    const SheetInterface* sheet_;
-    std::unique_ptr<Impl> impl_;
+    OrderChanges CheckCircularDependencies(const Sheet& sheet,
+        const std::unordered_set<const Cell*>& dependencies,
+        const std::vector<Rect>& ranges) const;
 
-    mutable std::unordered_set<const Cell*> dependencies_;
-    mutable std::unordered_set<const Cell*> dependants_;
+    Data data_{};
+    // position in a topological order of the dependency graph, every cell
+    // goes after all of its dependencies (Pearce-Kelly)
+    mutable int64_t order_;
+    // id in the dependency graph of the sheet while the cell has links
+    mutable GraphId graph_id_ = NO_GRAPH_ID;
+    int16_t row_ = -1;
+    int16_t col_ = -1;
+    Kind kind_ = Kind::Empty;
 };
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "cell_table.h"
+
+const Cell* CellTable::Get(Position pos) const {
+    const Block* block = FindBlock(BlockKey(pos));
+    return block ? block->cells[Offset(pos)].get() : nullptr;
+}
+
+Cell* CellTable::Get(Position pos) {
+    return const_cast<Cell*>(static_cast<const CellTable&>(*this).Get(pos));
+}
+
+Cell& CellTable::GetOrCreate(Position pos) {
+    auto& block = blocks_[BlockKey(pos)];
+    if (!block) {
+        block = std::make_unique<Block>();
+    }
+
+    auto& cell = block->cells[Offset(pos)];
+    if (!cell) {
+        cell = std::make_unique<Cell>(pos);
+        ++block->count;
+        ++size_;
+        Occupy(pos);
+    }
+    return *cell;
+}
+
+void CellTable::Erase(Position pos) {
+    const auto it = blocks_.find(BlockKey(pos));
+    if (blocks_.end() == it) {
+        return;
+    }
+
+    auto& cell = it->second->cells[Offset(pos)];
+    if (!cell) {
+        return;
+    }
+    cell.reset();
+    --size_;
+    Release(pos);
+
+    if (0 == --it->second->count) {
+        blocks_.erase(it);
+    }
+}
+
+size_t CellTable::Size() const {
+    return size_;
+}
+
+Size CellTable::GetBounds() const {
+    if (rows_.empty()) {
+        return {};
+    }
+    return { rows_.rbegin()->first + 1, cols_.rbegin()->first + 1 };
+}
+
+// private
+
+uint32_t CellTable::BlockKey(int block_row, int block_col) {
+    return static_cast<uint32_t>(block_row * (Position::MAX_COLS / BLOCK_SIDE) + block_col);
+}
+
+uint32_t CellTable::BlockKey(Position pos) {
+    return BlockKey(pos.row / BLOCK_SIDE, pos.col / BLOCK_SIDE);
+}
+
+int CellTable::Offset(Position pos) {
+    return pos.row % BLOCK_SIDE * BLOCK_SIDE + pos.col % BLOCK_SIDE;
+}
+
+const CellTable::Block* CellTable::FindBlock(uint32_t key) const {
+    const auto it = blocks_.find(key);
+    return blocks_.end() == it ? nullptr : it->second.get();
+}
+
+void CellTable::Occupy(Position pos) {
+    ++rows_[pos.row];
+    ++cols_[pos.col];
+}
+
+void CellTable::Release(Position pos) {
+    const auto release = [](std::map<int, int>& counts, int index) {
+        const auto it = counts.find(index);
+        if (0 == --it->second) {
+            counts.erase(it);
+        }
+    };
+    release(rows_, pos.row);
+    release(cols_, pos.col);
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+// Sparse cell storage. The sheet is split into square blocks which are
+// allocated on first use, so memory follows the populated cells rather
+// than the bounding box of the table.
+class CellTable {
+public:
+    static constexpr int BLOCK_SIDE = 64;
+
+    const Cell* Get(Position pos) const;
+    Cell* Get(Position pos);
+
+    // Returns the cell at pos, creating an empty one if there is none
+    Cell& GetOrCreate(Position pos);
+    void Erase(Position pos);
+
+    size_t Size() const;
+    // Bounding box of the stored cells, kept up to date on every insert
+    // and erase in O(log n)
+    ::Size GetBounds() const;
+
+    // Calls func(pos, cell) for every stored cell in no particular order
+    template <typename Func>
+    void ForEach(Func&& func) const;
+
+    // Calls func(col, cell) for cols [0, cols) of the row, cell may be nullptr
+    template <typename Func>
+    void ForEachInRow(int row, int cols, Func&& func) const;
+    // The same for cols [first_col, end_col)
+    template <typename Func>
+    void ForEachInRow(int row, int first_col, int end_col, Func&& func) const;
+
+    // Calls func(pos, cell) for every stored cell inside the rectangle. Only
+    // allocated blocks are visited, so a huge sparse range stays cheap.
+    template <typename Func>
+    void ForEachInRect(Rect rect, Func&& func) const;
+
+private:
+    struct Block {
+        std::array<std::unique_ptr<Cell>, BLOCK_SIDE * BLOCK_SIDE> cells;
+        int count = 0;
+    };
+
+    static uint32_t BlockKey(int block_row, int block_col);
+    static uint32_t BlockKey(Position pos);
+    static int Offset(Position pos);
+
+    const Block* FindBlock(uint32_t key) const;
+
+    void Occupy(Position pos);
+    void Release(Position pos);
+
+    std::unordered_map<uint32_t, std::unique_ptr<Block>> blocks_;
+    size_t size_ = 0;
+
+    // number of stored cells per row and per column index
+    std::map<int, int> rows_;
+    std::map<int, int> cols_;
+};
+
+template <typename Func>
+void CellTable::ForEach(Func&& func) const {
+    for (const auto& [key, block] : blocks_) {
+        const int blocks_in_row = Position::MAX_COLS / BLOCK_SIDE;
+        const int base_row = static_cast<int>(key) / blocks_in_row * BLOCK_SIDE;
+        const int base_col = static_cast<int>(key) % blocks_in_row * BLOCK_SIDE;
+
+        for (int i = 0; i < BLOCK_SIDE * BLOCK_SIDE; ++i) {
+            if (const auto& cell = block->cells[i]) {
+                func(Position{ base_row + i / BLOCK_SIDE, base_col + i % BLOCK_SIDE },
+                    static_cast<const Cell*>(cell.get()));
+            }
+        }
+    }
+}
+
+template <typename Func>
+void CellTable::ForEachInRect(Rect rect, Func&& func) const {
+    const int blocks_in_row = Position::MAX_COLS / BLOCK_SIDE;
+    const int first_block_row = rect.top_left.row / BLOCK_SIDE;
+    const int first_block_col = rect.top_left.col / BLOCK_SIDE;
+    const int last_block_row = rect.bottom_right.row / BLOCK_SIDE;
+    const int last_block_col = rect.bottom_right.col / BLOCK_SIDE;
+
+    const auto visit = [&](uint32_t key, const Block& block) {
+        const int base_row = static_cast<int>(key) / blocks_in_row * BLOCK_SIDE;
+        const int base_col = static_cast<int>(key) % blocks_in_row * BLOCK_SIDE;
+        const int end_row = std::min(rect.bottom_right.row + 1, base_row + BLOCK_SIDE);
+        const int end_col = std::min(rect.bottom_right.col + 1, base_col + BLOCK_SIDE);
+
+        for (int row = std::max(rect.top_left.row, base_row); row < end_row; ++row) {
+            for (int col = std::max(rect.top_left.col, base_col); col < end_col; ++col) {
+                if (const auto& cell = block.cells[(row - base_row) * BLOCK_SIDE + col - base_col]) {
+                    func(Position{ row, col }, static_cast<const Cell*>(cell.get()));
+                }
+            }
+        }
+    };
+
+    const size_t block_count = static_cast<size_t>(last_block_row - first_block_row + 1)
+        * static_cast<size_t>(last_block_col - first_block_col + 1);
+    if (block_count > blocks_.size()) {
+        for (const auto& [key, block] : blocks_) {
+            const int block_row = static_cast<int>(key) / blocks_in_row;
+            const int block_col = static_cast<int>(key) % blocks_in_row;
+            if (first_block_row <= block_row && block_row <= last_block_row
+                && first_block_col <= block_col && block_col <= last_block_col) {
+                visit(key, *block);
+            }
+        }
+        return;
+    }
+    for (int block_row = first_block_row; block_row <= last_block_row; ++block_row) {
+        for (int block_col = first_block_col; block_col <= last_block_col; ++block_col) {
+            const uint32_t key = BlockKey(block_row, block_col);
+            if (const Block* block = FindBlock(key)) {
+                visit(key, *block);
+            }
+        }
+    }
+}
+
+template <typename Func>
+void CellTable::ForEachInRow(int row, int cols, Func&& func) const {
+    ForEachInRow(row, 0, cols, std::forward<Func>(func));
+}
+
+template <typename Func>
+void CellTable::ForEachInRow(int row, int first_col, int end_col, Func&& func) const {
+    const int block_row = row / BLOCK_SIDE;
+    const int row_offset = row % BLOCK_SIDE * BLOCK_SIDE;
+
+    for (int col = first_col; col < end_col; ) {
+        const int block_end = std::min(end_col, (col / BLOCK_SIDE + 1) * BLOCK_SIDE);
+        const Block* block = FindBlock(BlockKey(block_row, col / BLOCK_SIDE));
+
+        for (; col < block_end; ++col) {
+            const Cell* cell = block
+                ? block->cells[row_offset + col % BLOCK_SIDE].get()
+                : nullptr;
+            func(col, cell);
+        }
+    }
+}
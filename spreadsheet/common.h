@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -15,6 +18,17 @@ std::string IndexToColumn(int index);
 
 }   // namespace pos_convert
 
+namespace num_convert {
+
+// Наибольшая длина записи числа функцией ToChars
+inline constexpr size_t MAX_LENGTH = 24;
+
+// Записывает число так же, как operator<< с точностью по умолчанию
+// (printf "%g"), и возвращает указатель за последним символом
+char* ToChars(char* first, double value);
+
+}   // namespace num_convert
+
 // Позиция ячейки. Индексация с нуля.
 struct Position {
     int row = 0;
@@ -41,6 +55,33 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Прямоугольная область таблицы, угловые ячейки входят в неё.
+struct Rect {
+    Position top_left;
+    Position bottom_right;
+
+    bool operator==(Rect rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    // Запись вида "A1:H40", для одной ячейки - её позиция
+    std::string ToString() const;
+
+    // Принимает "A1:H40" или "A1". Для некорректной записи возвращает
+    // прямоугольник, у которого IsValid() == false.
+    static Rect FromString(std::string_view str);
+};
+
+// Ссылка формулы на ячейки другого листа книги: Sheet2!A1 или Sheet2!A1:B3.
+// Ссылка на одну ячейку - диапазон из одной ячейки.
+struct SheetReference {
+    std::string sheet;
+    Rect range;
+
+    bool operator==(const SheetReference& rhs) const;
+    bool operator<(const SheetReference& rhs) const;
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
 public:
@@ -110,6 +151,26 @@ public:
 inline constexpr char FORMULA_SIGN = '=';
 inline constexpr char ESCAPE_SIGN = '\'';
 
+// Числовые значения одного столбца блоками по CHUNK_ROWS строк. Блок есть
+// только у строк, где есть числа или значения, которые нужно получить через
+// GetCell(), остальные блоки равны nullptr. Строке row соответствует бит
+// (row % CHUNK_ROWS) блока row / CHUNK_ROWS. Бит в numbers означает, что
+// values[row % CHUNK_ROWS] - значение ячейки. Бит в others означает, что это
+// ошибка или ещё не вычисленная формула. Ячейки без обоих битов пусты или
+// содержат текст, строки начиная с rows пусты.
+struct NumericColumn {
+    static constexpr int CHUNK_ROWS = 64;
+
+    struct Chunk {
+        double values[CHUNK_ROWS];
+        uint64_t numbers = 0;
+        uint64_t others = 0;
+    };
+
+    const std::unique_ptr<Chunk>* chunks = nullptr;
+    int rows = 0;
+};
+
 // Интерфейс таблицы
 class SheetInterface {
 public:
@@ -151,6 +212,20 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Возвращает числа столбца, если таблица хранит их отдельно от ячеек.
+    // Иначе возвращает std::nullopt, и значения читаются через GetCell().
+    // Указатели действительны до следующего изменения таблицы.
+    virtual std::optional<NumericColumn> GetNumericColumn(int col) const {
+        return std::nullopt;
+    }
+
+    // Возвращает лист той же книги с именем name для ссылок вида Sheet2!A1.
+    // Таблица вне книги и лист с неизвестным именем дают nullptr, такая
+    // ссылка вычисляется в ошибку #REF!.
+    virtual const SheetInterface* FindSheet(std::string_view name) const {
+        return nullptr;
+    }
 };
 
 // Создаёт готовую к работе пустую таблицу.
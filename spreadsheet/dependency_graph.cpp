@@ -0,0 +1,307 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <utility>
+
+namespace {
+
+// changed rows are packed once there are this many or a half of the ids
+static constexpr size_t MIN_CHANGED_ROWS = 1024;
+// longer rows keep the places of their targets
+static constexpr size_t INDEXED_ROW_SIZE = 32;
+
+}   // namespace
+
+void DependencyGraph::Link(const Cell* cell, const std::vector<const Cell*>& dependencies,
+    std::vector<Rect> ranges) {
+    if (Cell::NO_GRAPH_ID == cell->graph_id_ && dependencies.empty() && ranges.empty()) {
+        return;
+    }
+    const Id id = Acquire(cell);
+
+    // reused between calls, linking is the hot path of every edit
+    thread_local std::vector<Id> new_ids;
+    thread_local std::vector<Id> sorted_new_ids;
+    thread_local std::vector<Id> old_ids;
+    thread_local std::vector<Id> removed;
+    thread_local std::vector<Id> added;
+    new_ids.clear();
+    removed.clear();
+    added.clear();
+    for (const Cell* dep : dependencies) {
+        new_ids.push_back(Acquire(dep));
+    }
+    const Span old_row = dependencies_.GetRow(id);
+    old_ids.assign(old_row.begin(), old_row.end());
+
+    // only the changed links touch the rows of the dependencies
+    if (old_ids.empty()) {
+        added.assign(new_ids.begin(), new_ids.end());
+    }
+    else {
+        sorted_new_ids.assign(new_ids.begin(), new_ids.end());
+        std::sort(sorted_new_ids.begin(), sorted_new_ids.end());
+        std::sort(old_ids.begin(), old_ids.end());
+        std::set_difference(old_ids.begin(), old_ids.end(),
+            sorted_new_ids.begin(), sorted_new_ids.end(), std::back_inserter(removed));
+        std::set_difference(sorted_new_ids.begin(), sorted_new_ids.end(),
+            old_ids.begin(), old_ids.end(), std::back_inserter(added));
+    }
+
+    if (!removed.empty() || !added.empty()) {
+        dependencies_.Assign(id, new_ids);
+    }
+    for (Id dep : removed) {
+        dependants_.Erase(dep, id);
+    }
+    for (Id dep : added) {
+        dependants_.Insert(dep, id);
+    }
+    if (ranges.empty()) {
+        ranges_.erase(id);
+    }
+    else {
+        ranges_[id] = std::move(ranges);
+    }
+
+    for (Id dep : removed) {
+        ReleaseIfUnlinked(dep);
+    }
+    ReleaseIfUnlinked(id);
+    CompactIfNeeded();
+}
+
+void DependencyGraph::Unlink(const Cell* cell) {
+    Link(cell, {}, {});
+}
+
+bool DependencyGraph::HasDependants(const Cell* cell) const {
+    return Cell::NO_GRAPH_ID != cell->graph_id_ && !dependants_.GetRow(cell->graph_id_).empty();
+}
+
+const std::vector<Rect>& DependencyGraph::GetRanges(const Cell* cell) const {
+    static const std::vector<Rect> none;
+    if (Cell::NO_GRAPH_ID == cell->graph_id_) {
+        return none;
+    }
+    const auto it = ranges_.find(cell->graph_id_);
+    return ranges_.end() == it ? none : it->second;
+}
+
+size_t DependencyGraph::GetNodeCount() const {
+    return cells_.size() - free_ids_.size();
+}
+
+size_t DependencyGraph::GetChangedRowCount() const {
+    return dependencies_.GetChangedRowCount() + dependants_.GetChangedRowCount();
+}
+
+// private
+
+DependencyGraph::Id DependencyGraph::Acquire(const Cell* cell) {
+    if (Cell::NO_GRAPH_ID != cell->graph_id_) {
+        return cell->graph_id_;
+    }
+    Id id = static_cast<Id>(cells_.size());
+    if (free_ids_.empty()) {
+        cells_.push_back(cell);
+    }
+    else {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+        cells_[id] = cell;
+    }
+    cell->graph_id_ = id;
+    return id;
+}
+
+// The rows of a freed id stay changed and empty until the next compaction
+void DependencyGraph::ReleaseIfUnlinked(Id id) {
+    if (!dependencies_.GetRow(id).empty() || !dependants_.GetRow(id).empty()
+        || ranges_.count(id) != 0) {
+        return;
+    }
+    cells_[id]->graph_id_ = Cell::NO_GRAPH_ID;
+    cells_[id] = nullptr;
+    free_ids_.push_back(id);
+}
+
+void DependencyGraph::CompactIfNeeded() {
+    if (GetChangedRowCount() < std::max(MIN_CHANGED_ROWS, cells_.size() / 2)) {
+        return;
+    }
+    dependencies_.Compact(cells_.size());
+    dependants_.Compact(cells_.size());
+}
+
+// EdgeList
+
+DependencyGraph::EdgeList::EdgeList(EdgeList&& other) noexcept
+    : size_(std::exchange(other.size_, 0))
+    , capacity_(std::exchange(other.capacity_, INLINE_SIZE)) {
+    if (capacity_ > INLINE_SIZE) {
+        heap_ = other.heap_;
+    }
+    else {
+        std::copy(other.inline_, other.inline_ + size_, inline_);
+    }
+}
+
+DependencyGraph::EdgeList& DependencyGraph::EdgeList::operator=(EdgeList&& other) noexcept {
+    if (this != &other) {
+        this->~EdgeList();
+        new (this) EdgeList(std::move(other));
+    }
+    return *this;
+}
+
+DependencyGraph::EdgeList::~EdgeList() {
+    if (capacity_ > INLINE_SIZE) {
+        delete[] heap_;
+    }
+}
+
+DependencyGraph::Span DependencyGraph::EdgeList::GetSpan() const {
+    return { Data(), Data() + size_ };
+}
+
+size_t DependencyGraph::EdgeList::Size() const {
+    return size_;
+}
+
+DependencyGraph::Id& DependencyGraph::EdgeList::operator[](size_t index) {
+    return Data()[index];
+}
+
+void DependencyGraph::EdgeList::PushBack(Id id) {
+    if (size_ == capacity_) {
+        Id* data = new Id[capacity_ * 2];
+        std::copy(Data(), Data() + size_, data);
+        if (capacity_ > INLINE_SIZE) {
+            delete[] heap_;
+        }
+        heap_ = data;
+        capacity_ *= 2;
+    }
+    Data()[size_++] = id;
+}
+
+void DependencyGraph::EdgeList::PopBack() {
+    --size_;
+}
+
+void DependencyGraph::EdgeList::Clear() {
+    size_ = 0;
+}
+
+DependencyGraph::Id* DependencyGraph::EdgeList::Data() {
+    return capacity_ > INLINE_SIZE ? heap_ : inline_;
+}
+
+const DependencyGraph::Id* DependencyGraph::EdgeList::Data() const {
+    return capacity_ > INLINE_SIZE ? heap_ : inline_;
+}
+
+// Adjacency
+
+DependencyGraph::Span DependencyGraph::Adjacency::GetRow(Id id) const {
+    if (id < row_places_.size() && NO_ROW != row_places_[id]) {
+        return rows_[row_places_[id]].edges.GetSpan();
+    }
+    if (id + 1 < offsets_.size()) {
+        return { targets_.data() + offsets_[id], targets_.data() + offsets_[id + 1] };
+    }
+    return { nullptr, nullptr };
+}
+
+void DependencyGraph::Adjacency::Assign(Id id, const std::vector<Id>& targets) {
+    Row& row = GetChangedRow(id);
+    row.edges.Clear();
+    row.places.reset();
+    for (Id target : targets) {
+        row.edges.PushBack(target);
+    }
+}
+
+void DependencyGraph::Adjacency::Insert(Id id, Id target) {
+    Row& row = GetChangedRow(id);
+    row.edges.PushBack(target);
+    if (row.places) {
+        row.places->emplace(target, static_cast<uint32_t>(row.edges.Size() - 1));
+    }
+}
+
+// The last target takes the place of the erased one
+void DependencyGraph::Adjacency::Erase(Id id, Id target) {
+    Row& row = GetChangedRow(id);
+    const size_t size = row.edges.Size();
+    if (!row.places && size > INDEXED_ROW_SIZE) {
+        row.places = std::make_unique<std::unordered_map<Id, uint32_t>>();
+        row.places->reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            row.places->emplace(row.edges[i], static_cast<uint32_t>(i));
+        }
+    }
+
+    size_t place = 0;
+    if (row.places) {
+        const auto it = row.places->find(target);
+        place = it->second;
+        row.places->erase(it);
+    }
+    else {
+        while (row.edges[place] != target) {
+            ++place;
+        }
+    }
+
+    const Id last = row.edges[size - 1];
+    row.edges.PopBack();
+    if (place + 1 != size) {
+        row.edges[place] = last;
+        if (row.places) {
+            (*row.places)[last] = static_cast<uint32_t>(place);
+        }
+    }
+}
+
+size_t DependencyGraph::Adjacency::GetChangedRowCount() const {
+    return rows_.size();
+}
+
+void DependencyGraph::Adjacency::Compact(size_t count) {
+    std::vector<uint32_t> offsets(count + 1);
+    for (size_t id = 0; id < count; ++id) {
+        const Span row = GetRow(static_cast<Id>(id));
+        offsets[id + 1] = offsets[id] + static_cast<uint32_t>(row.last - row.first);
+    }
+    std::vector<Id> targets(offsets[count]);
+    for (size_t id = 0; id < count; ++id) {
+        const Span row = GetRow(static_cast<Id>(id));
+        std::copy(row.begin(), row.end(), targets.begin() + offsets[id]);
+    }
+
+    offsets_ = std::move(offsets);
+    targets_ = std::move(targets);
+    rows_.clear();
+    std::fill(row_places_.begin(), row_places_.end(), NO_ROW);
+}
+
+DependencyGraph::Adjacency::Row& DependencyGraph::Adjacency::GetChangedRow(Id id) {
+    if (id >= row_places_.size()) {
+        row_places_.resize(id + 1, NO_ROW);
+    }
+    if (NO_ROW != row_places_[id]) {
+        return rows_[row_places_[id]];
+    }
+
+    const Span packed = GetRow(id);
+    Row& row = rows_.emplace_back();
+    for (Id target : packed) {
+        row.edges.PushBack(target);
+    }
+    row_places_[id] = static_cast<uint32_t>(rows_.size() - 1);
+    return row;
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Dependency links of the formulas of a sheet. A cell gets a dense id while
+// it has any links, the graph refers to cells by these ids only. Rows of
+// both directions are packed into CSR arrays, the rows changed since then
+// are kept aside in small vectors and packed again once there are many.
+class DependencyGraph {
+public:
+    DependencyGraph() = default;
+    DependencyGraph(const DependencyGraph&) = delete;
+    DependencyGraph& operator=(const DependencyGraph&) = delete;
+
+    // Replaces the links of the cell. The dependencies have to be distinct,
+    // cells inside the ranges are not linked one by one.
+    void Link(const Cell* cell, const std::vector<const Cell*>& dependencies,
+        std::vector<Rect> ranges);
+    void Unlink(const Cell* cell);
+
+    // True if another cell links to this one, ranges covering it do not count
+    bool HasDependants(const Cell* cell) const;
+    const std::vector<Rect>& GetRanges(const Cell* cell) const;
+
+    template <typename Func>
+    void ForEachDependency(const Cell* cell, Func&& func) const;
+    template <typename Func>
+    void ForEachDependant(const Cell* cell, Func&& func) const;
+
+    // Cells with links and the rows not packed yet
+    size_t GetNodeCount() const;
+    size_t GetChangedRowCount() const;
+
+private:
+    using Id = Cell::GraphId;
+
+    struct Span {
+        const Id* first;
+        const Id* last;
+
+        const Id* begin() const {
+            return first;
+        }
+        const Id* end() const {
+            return last;
+        }
+        bool empty() const {
+            return first == last;
+        }
+    };
+
+    // Ids of a changed row, most rows fit the inline part
+    class EdgeList {
+    public:
+        EdgeList() = default;
+        EdgeList(EdgeList&& other) noexcept;
+        EdgeList& operator=(EdgeList&& other) noexcept;
+        ~EdgeList();
+
+        Span GetSpan() const;
+        size_t Size() const;
+        Id& operator[](size_t index);
+
+        void PushBack(Id id);
+        void PopBack();
+        void Clear();
+
+    private:
+        static constexpr uint32_t INLINE_SIZE = 4;
+
+        Id* Data();
+        const Id* Data() const;
+
+        uint32_t size_ = 0;
+        uint32_t capacity_ = INLINE_SIZE;
+        union {
+            Id inline_[INLINE_SIZE];
+            Id* heap_;
+        };
+    };
+
+    // One direction of the graph
+    class Adjacency {
+    public:
+        Span GetRow(Id id) const;
+        void Assign(Id id, const std::vector<Id>& targets);
+        void Insert(Id id, Id target);
+        void Erase(Id id, Id target);
+
+        size_t GetChangedRowCount() const;
+        // Packs every row of the ids below count into the arrays
+        void Compact(size_t count);
+
+    private:
+        struct Row {
+            EdgeList edges;
+            // place of every target in a long row, erasing from it stays O(1)
+            std::unique_ptr<std::unordered_map<Id, uint32_t>> places;
+        };
+
+        static constexpr uint32_t NO_ROW = UINT32_MAX;
+
+        // The changed row of the id, a packed one is copied on first change
+        Row& GetChangedRow(Id id);
+
+        std::vector<uint32_t> offsets_{ 0 };
+        std::vector<Id> targets_;
+        std::vector<Row> rows_;
+        // place of the changed row of every id in rows_, NO_ROW for a packed one
+        std::vector<uint32_t> row_places_;
+    };
+
+    Id Acquire(const Cell* cell);
+    // Frees the id of a cell without links
+    void ReleaseIfUnlinked(Id id);
+    void CompactIfNeeded();
+
+    // cells by id, nullptr for free ids
+    std::vector<const Cell*> cells_;
+    std::vector<Id> free_ids_;
+    Adjacency dependencies_;
+    Adjacency dependants_;
+    std::unordered_map<Id, std::vector<Rect>> ranges_;
+};
+
+template <typename Func>
+void DependencyGraph::ForEachDependency(const Cell* cell, Func&& func) const {
+    if (Cell::NO_GRAPH_ID == cell->graph_id_) {
+        return;
+    }
+    for (Id id : dependencies_.GetRow(cell->graph_id_)) {
+        func(cells_[id]);
+    }
+}
+
+template <typename Func>
+void DependencyGraph::ForEachDependant(const Cell* cell, Func&& func) const {
+    if (Cell::NO_GRAPH_ID == cell->graph_id_) {
+        return;
+    }
+    for (Id id : dependants_.GetRow(cell->graph_id_)) {
+        func(cells_[id]);
+    }
+}
\ No newline at end of file
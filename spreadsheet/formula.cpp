@@ -5,7 +5,12 @@
 #include <algorithm>
 #include <cassert>
 #include <cctype>
-#include <sstream>
+#include <charconv>
+#include <iterator>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
 
 using namespace std::literals;
 
@@ -31,21 +36,226 @@ public:
     }
 
     std::string GetExpression() const override {
-        std::stringstream out;
-        ast_.PrintFormula(out);
-        return out.str();
+        std::string expression;
+        ast_.PrintFormula(expression);
+        return expression;
     }
 
-    std::vector<Position> GetReferencedCells() const {
-        auto ref = ast_.GetCells();
-        ref.unique();
-        return { ref.begin(), ref.end() };
+    std::vector<Position> GetReferencedCells() const override {
+        const auto cells = ast_.GetCells();
+        return { cells.begin(), cells.end() };
+    }
+
+    std::vector<Rect> GetReferencedRanges() const override {
+        return ASTImpl::GetRanges(ast_.GetProgram());
+    }
+
+    std::vector<SheetReference> GetSheetReferences() const override {
+        return ASTImpl::GetSheetReferences(ast_.GetProgram(), ast_.GetSheets());
     }
 
 private:
     FormulaAST ast_;
 };
 
+// Formula restored from a snapshot, it keeps only the compiled program
+class LoadedFormula : public FormulaInterface {
+public:
+    explicit LoadedFormula(const FormulaProgram& program)
+        : program_(program)
+    {}
+
+    Value Evaluate(const SheetInterface& sheet) const override {
+        try {
+            return ASTImpl::Execute(program_.program, program_.stack_size, sheet);
+        }
+        catch (FormulaError& err) {
+            return err;
+        }
+    }
+
+    std::string GetExpression() const override {
+        return std::string(program_.expression);
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        return { program_.cells.begin(), program_.cells.end() };
+    }
+
+    std::vector<Rect> GetReferencedRanges() const override {
+        return ASTImpl::GetRanges(program_.program);
+    }
+
+private:
+    FormulaProgram program_;
+};
+
+// Formula parsed once for all the cells whose formulas differ from it only
+// by a shift of every reference along with the cell
+struct FormulaTemplate {
+    FormulaTemplate(const std::string& expression, Position anchor)
+        : ast(ParseFormulaAST(expression))
+        , anchor(anchor) {
+        ast.PrintFormula(this->expression);
+        cell_tokens = ASTImpl::FindCellTokens(this->expression);
+        ranges = ASTImpl::GetRanges(ast.GetProgram());
+    }
+
+    FormulaAST ast;
+    // the cell of the parsed formula
+    Position anchor;
+    // printed without spaces, with the references found in it
+    std::string expression;
+    std::vector<ASTImpl::CellToken> cell_tokens;
+    std::vector<Rect> ranges;
+};
+
+// Templates by the R1C1 form of their text: every reference is written as
+// its offset from the cell, e.g. R[0]C[-2]*R[0]C[-1]. A template lives as
+// long as some formula uses it.
+class TemplateRegistry {
+public:
+    static TemplateRegistry& Instance() {
+        // never destroyed, formulas of static sheets may outlive it otherwise
+        static TemplateRegistry* registry = new TemplateRegistry;
+        return *registry;
+    }
+
+    std::shared_ptr<const FormulaTemplate> Get(const std::string& key,
+        const std::string& expression, Position anchor) {
+        {
+            std::lock_guard lock(mutex_);
+            const auto it = templates_.find(key);
+            if (templates_.end() != it) {
+                if (auto found = it->second.lock()) {
+                    return found;
+                }
+            }
+        }
+
+        // parsed outside the lock, a template made meanwhile by another
+        // thread wins
+        auto made = std::make_shared<const FormulaTemplate>(expression, anchor);
+        std::lock_guard lock(mutex_);
+        auto& entry = templates_[key];
+        if (auto found = entry.lock()) {
+            return found;
+        }
+        entry = made;
+        if (templates_.size() >= purge_size_) {
+            Purge();
+        }
+        return made;
+    }
+
+private:
+    void Purge() {
+        for (auto it = templates_.begin(); it != templates_.end(); ) {
+            it = it->second.expired() ? templates_.erase(it) : std::next(it);
+        }
+        purge_size_ = std::max(MIN_PURGE_SIZE, templates_.size() * 2);
+    }
+
+    static constexpr size_t MIN_PURGE_SIZE = 1024;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<const FormulaTemplate>> templates_;
+    size_t purge_size_ = MIN_PURGE_SIZE;
+};
+
+// Formula of a cell sharing its template, only the shift is its own
+class TemplateFormula : public FormulaInterface {
+public:
+    TemplateFormula(std::shared_ptr<const FormulaTemplate> formula_template, Position offset)
+        : template_(std::move(formula_template))
+        , offset_(offset)
+    {}
+
+    Value Evaluate(const SheetInterface& sheet) const override {
+        try {
+            return ASTImpl::Execute(template_->ast.GetProgram(), template_->ast.GetStackSize(),
+                sheet, offset_, template_->ast.GetSheets());
+        }
+        catch (FormulaError& err) {
+            return err;
+        }
+    }
+
+    std::string GetExpression() const override {
+        const std::string& expression = template_->expression;
+        std::string result;
+        result.reserve(expression.size() + template_->cell_tokens.size() * 2);
+        size_t copied = 0;
+        for (const auto& token : template_->cell_tokens) {
+            result.append(expression, copied, token.offset - copied);
+            result += Shift(token.pos).ToString();
+            copied = token.offset + token.length;
+        }
+        result.append(expression, copied);
+        return result;
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        // a shift keeps the order of the cells
+        std::vector<Position> cells;
+        cells.reserve(template_->ast.GetCells().size());
+        for (Position pos : template_->ast.GetCells()) {
+            cells.push_back(Shift(pos));
+        }
+        return cells;
+    }
+
+    std::vector<Rect> GetReferencedRanges() const override {
+        std::vector<Rect> ranges;
+        ranges.reserve(template_->ranges.size());
+        for (const Rect& range : template_->ranges) {
+            ranges.push_back({ Shift(range.top_left), Shift(range.bottom_right) });
+        }
+        return ranges;
+    }
+
+    std::vector<SheetReference> GetSheetReferences() const override {
+        auto references = ASTImpl::GetSheetReferences(template_->ast.GetProgram(),
+            template_->ast.GetSheets());
+        for (auto& reference : references) {
+            reference.range = { Shift(reference.range.top_left), Shift(reference.range.bottom_right) };
+        }
+        return references;
+    }
+
+private:
+    Position Shift(Position pos) const {
+        return { pos.row + offset_.row, pos.col + offset_.col };
+    }
+
+    std::shared_ptr<const FormulaTemplate> template_;
+    Position offset_;
+};
+
+// The R1C1 form of the text of a formula in the cell pos
+std::string MakeTemplateKey(std::string_view expression, Position pos) {
+    const auto append_offset = [](std::string& out, int offset) {
+        char buffer[16];
+        const auto result = std::to_chars(std::begin(buffer), std::end(buffer), offset);
+        out.append(buffer, result.ptr);
+    };
+
+    std::string key;
+    key.reserve(expression.size() * 2);
+    size_t copied = 0;
+    for (const auto& token : ASTImpl::FindCellTokens(expression)) {
+        key.append(expression, copied, token.offset - copied);
+        key += "R[";
+        append_offset(key, token.pos.row - pos.row);
+        key += "]C[";
+        append_offset(key, token.pos.col - pos.col);
+        key += ']';
+        copied = token.offset + token.length;
+    }
+    key.append(expression, copied);
+    return key;
+}
+
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
@@ -55,4 +265,27 @@ std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
     catch (...) {
         throw FormulaException("Wrong formula");
     }
+}
+
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression, Position pos) {
+    if (!pos.IsValid()) {
+        return ParseFormula(std::move(expression));
+    }
+    try {
+        auto formula_template = TemplateRegistry::Instance().Get(
+            MakeTemplateKey(expression, pos), expression, pos);
+        const Position anchor = formula_template->anchor;
+        return std::make_unique<TemplateFormula>(std::move(formula_template),
+            Position{ pos.row - anchor.row, pos.col - anchor.col });
+    }
+    catch (...) {
+        throw FormulaException("Wrong formula");
+    }
+}
+
+std::unique_ptr<FormulaInterface> LoadFormula(const FormulaProgram& program) {
+    if (ASTImpl::HasSheetReferences(program.program)) {
+        return ParseFormula(std::string(program.expression));
+    }
+    return std::make_unique<LoadedFormula>(program);
 }
\ No newline at end of file
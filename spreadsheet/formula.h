@@ -9,6 +9,7 @@
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Функции SUM, AVERAGE, MIN, MAX, COUNT от выражений и диапазонов: SUM(A1:B3,C1)
 // Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
@@ -34,8 +35,33 @@ public:
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает диапазоны из аргументов функций, например A1:B100 из
+    // SUM(A1:B100). Ячейки диапазонов не входят в GetReferencedCells().
+    // Список отсортирован и не содержит повторяющихся диапазонов.
+    virtual std::vector<Rect> GetReferencedRanges() const = 0;
+
+    // Возвращает ссылки на ячейки и диапазоны других листов книги, например
+    // Sheet2!A1 и Sheet2!A1:B3 из Sheet2!A1+SUM(Sheet2!A1:B3). Они не входят
+    // в GetReferencedCells() и GetReferencedRanges(). Список отсортирован и
+    // не содержит повторяющихся ссылок.
+    virtual std::vector<SheetReference> GetSheetReferences() const {
+        return {};
+    }
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
\ No newline at end of file
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Парсит формулу ячейки pos. Формулы, которые совпадают с точностью до сдвига
+// всех ссылок вместе с ячейкой, как A1*B1 в C1 и A2*B2 в C2, разделяют один
+// разобранный шаблон, а формула ячейки хранит только сдвиг относительно него.
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression, Position pos);
+
+struct FormulaProgram;
+
+// Создаёт формулу из уже скомпилированной программы без разбора выражения.
+// Программа, выражение и список ячеек не копируются и должны пережить формулу.
+// Формула со ссылками на другие листы разбирается заново, в программе нет их имён.
+std::unique_ptr<FormulaInterface> LoadFormula(const FormulaProgram& program);
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "load_generator.h"
+
+#if defined(__linux__)
+
+#include "sheet_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct ClientResult {
+    size_t errors = 0;
+    std::vector<double> latencies;
+};
+
+// Keeps the pipeline full: sends the commands it has room for at once and
+// waits for one answer
+static ClientResult RunClient(const LoadOptions& options, size_t index) {
+    SheetClient client(options.address);
+    std::mt19937 random(static_cast<uint32_t>(index));
+    std::uniform_int_distribution<int> rows(1, options.rows);
+    std::bernoulli_distribution is_write(options.write_share);
+
+    ClientResult result;
+    result.latencies.reserve(options.requests);
+    std::deque<Clock::time_point> sent_times;
+    std::string batch;
+    size_t sent = 0;
+    while (result.latencies.size() < options.requests) {
+        batch.clear();
+        const auto now = Clock::now();
+        while (sent < options.requests && sent_times.size() < std::max<size_t>(options.pipeline, 1)) {
+            const std::string cell = "A" + std::to_string(rows(random));
+            if (is_write(random)) {
+                batch += "set " + cell + ' ' + std::to_string(sent) + '\n';
+            }
+            else {
+                batch += "get " + cell + '\n';
+            }
+            sent_times.push_back(now);
+            ++sent;
+        }
+        if (!batch.empty()) {
+            client.Send(batch);
+        }
+
+        const auto response = client.Receive();
+        result.errors += response.ok ? 0 : 1;
+        result.latencies.push_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - sent_times.front()).count());
+        sent_times.pop_front();
+    }
+    return result;
+}
+
+}   // namespace
+
+LoadReport RunLoad(const LoadOptions& options) {
+    std::mutex mutex;
+    std::vector<double> latencies;
+    size_t errors = 0;
+    std::exception_ptr error;
+
+    const auto start = Clock::now();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < options.connections; ++i) {
+        clients.emplace_back([&, i] {
+            try {
+                ClientResult result = RunClient(options, i);
+                std::lock_guard lock(mutex);
+                errors += result.errors;
+                latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+            }
+            catch (...) {
+                std::lock_guard lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    LoadReport report;
+    report.requests = latencies.size();
+    report.errors = errors;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (latencies.empty()) {
+        return report;
+    }
+    report.requests_per_second = report.requests / report.seconds;
+    std::sort(latencies.begin(), latencies.end());
+    report.median_us = latencies[latencies.size() / 2];
+    report.p99_us = latencies[latencies.size() * 99 / 100];
+    report.max_us = latencies.back();
+    return report;
+}
+
+std::ostream& operator<<(std::ostream& output, const LoadReport& report) {
+    return output << report.requests << " requests, " << report.errors << " errors in "
+        << report.seconds << " s: " << static_cast<size_t>(report.requests_per_second)
+        << " requests/s, latency median " << report.median_us << " us, p99 "
+        << report.p99_us << " us, max " << report.max_us << " us";
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+#if defined(__linux__)
+
+// Load of a SheetServer: every connection keeps a number of commands in
+// flight, edits of a cell and reads of a cell mixed at random
+struct LoadOptions {
+    std::string address;
+    size_t connections = 8;
+    // commands of every connection
+    size_t requests = 20'000;
+    // commands of a connection sent before the first answer comes
+    size_t pipeline = 32;
+    // share of the edits, the rest are reads
+    double write_share = 0.1;
+    // the commands go to cells A1:A<rows>
+    int rows = 1'000;
+};
+
+struct LoadReport {
+    size_t requests = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    double requests_per_second = 0;
+    // time from sending a command to its answer
+    double median_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+// Runs a thread per connection until every command is answered. Throws
+// std::system_error if the server is not there.
+LoadReport RunLoad(const LoadOptions& options);
+
+std::ostream& operator<<(std::ostream& output, const LoadReport& report);
+
+#endif
\ No newline at end of file
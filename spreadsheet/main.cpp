@@ -2,22 +2,78 @@
 
 #include "common.h"
 #include "formula.h"
+#include "load_generator.h"
+#include "script_runner.h"
+#include "sheet_server.h"
 #include "user_interface.h"
 
+#include "benchmarks.h"
 #include "tests.h"
 
-int main() {
+#include <cstdlib>
+#include <fstream>
+#include <string_view>
+
+int main(int argc, char* argv[]) {
 
 	setlocale(LC_ALL, "Russian");
 
+	if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+		RunBenchmarks();
+		return 0;
+	}
+
+	// --batch [script], the commands are read from the input without a script
+	if (argc > 1 && std::string_view(argv[1]) == "--batch") {
+		std::ios::sync_with_stdio(false);
+		std::ifstream file;
+		if (argc > 2) {
+			file.open(argv[2], std::ios::binary);
+			if (!file) {
+				std::cerr << "Cannot open " << argv[2] << '\n';
+				return 1;
+			}
+		}
+		Sheet sheet;
+		const ScriptReport report = RunScript(argc > 2 ? file : std::cin, std::cout, std::cerr, sheet);
+		std::cout.flush();
+		std::cerr << report << std::endl;
+		return 0 == report.errors ? 0 : 1;
+	}
+
+#if defined(__linux__)
+	// --serve <socket path or port> [reader threads]
+	if (argc > 2 && std::string_view(argv[1]) == "--serve") {
+		SheetServer server(argv[2], argc > 3 ? std::strtoul(argv[3], nullptr, 10) : std::thread::hardware_concurrency());
+		server.Run();
+		return 0;
+	}
+	// --load <socket path or port> [connections] [commands per connection] [pipeline]
+	if (argc > 2 && std::string_view(argv[1]) == "--load") {
+		LoadOptions options;
+		options.address = argv[2];
+		if (argc > 3) {
+			options.connections = std::strtoul(argv[3], nullptr, 10);
+		}
+		if (argc > 4) {
+			options.requests = std::strtoul(argv[4], nullptr, 10);
+		}
+		if (argc > 5) {
+			options.pipeline = std::strtoul(argv[5], nullptr, 10);
+		}
+		std::cout << RunLoad(options) << std::endl;
+		return 0;
+	}
+#endif
+
 	try {
 		RunTests();
-		std::cout << "\n   ,  \"Enter\"  \n";
+		std::cout << "\nВсе тесты пройдены успешно, нажми \"Enter\" чтобы продолжить\n";
 		std::cin.get();
 		system("cls");
 	}
 	catch (...) {
-		std::cout << "\n   ,  ,  \"Enter\"  \n";
+		std::cout << "\nПройдены не все тесты, завершение программы, нажми \"Enter\" чтобы продолжить\n";
 		std::cin.get();
 		return 0;
 	}
@@ -0,0 +1,88 @@
+#include "numeric_columns.h"
+
+#include "cell.h"
+
+#include <variant>
+
+namespace {
+
+static constexpr int CHUNK_ROWS = NumericColumn::CHUNK_ROWS;
+static_assert(CHUNK_ROWS == 64, "a chunk has one word of bits per bitmap");
+
+static uint64_t RowBit(int row) {
+    return uint64_t{ 1 } << (row % CHUNK_ROWS);
+}
+
+}   // namespace
+
+void NumericColumns::Update(Position pos, const Cell& cell) {
+    const auto value = cell.GetCachedValue();
+    if (!value) {
+        MarkStale(pos);
+        return;
+    }
+    if (const auto* number = std::get_if<double>(&*value)) {
+        Chunk& chunk = Reset(pos);
+        chunk.values[pos.row % CHUNK_ROWS] = *number;
+        chunk.numbers |= RowBit(pos.row);
+    }
+    else if (std::holds_alternative<FormulaError>(*value)) {
+        MarkStale(pos);
+    }
+    else {
+        Clear(pos);
+    }
+}
+
+void NumericColumns::MarkStale(Position pos) {
+    Reset(pos).others |= RowBit(pos.row);
+}
+
+void NumericColumns::Clear(Position pos) {
+    const auto column = columns_.find(pos.col);
+    if (columns_.end() == column) {
+        return;
+    }
+    auto& chunks = column->second.chunks;
+    const size_t index = pos.row / CHUNK_ROWS;
+    if (index >= chunks.size() || !chunks[index]) {
+        return;
+    }
+
+    Chunk& chunk = *chunks[index];
+    chunk.numbers &= ~RowBit(pos.row);
+    chunk.others &= ~RowBit(pos.row);
+    if (0 == chunk.numbers && 0 == chunk.others) {
+        chunks[index].reset();
+        if (0 == --column->second.count) {
+            columns_.erase(column);
+        }
+    }
+}
+
+NumericColumn NumericColumns::Get(int col) const {
+    const auto column = columns_.find(col);
+    if (columns_.end() == column) {
+        return {};
+    }
+    const auto& chunks = column->second.chunks;
+    return { chunks.data(), static_cast<int>(chunks.size()) * CHUNK_ROWS };
+}
+
+// private
+
+NumericColumns::Chunk& NumericColumns::Reset(Position pos) {
+    Column& column = columns_[pos.col];
+    const size_t index = pos.row / CHUNK_ROWS;
+    if (index >= column.chunks.size()) {
+        column.chunks.resize(index + 1);
+    }
+    auto& chunk = column.chunks[index];
+    if (!chunk) {
+        chunk = std::make_unique<Chunk>();
+        ++column.count;
+    }
+    chunk->numbers &= ~RowBit(pos.row);
+    chunk->others &= ~RowBit(pos.row);
+    return *chunk;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Copy of the values of a sheet by columns: chunks of 64 doubles with a
+// bitmap of the rows holding numbers and a bitmap of the rows whose value
+// has to be read from the cell. Range scans read numbers from here instead
+// of visiting every cell and parsing its text. Only the columns and chunks
+// holding such rows are allocated.
+class NumericColumns {
+public:
+    // Copies the current value of the cell, a formula without a cached
+    // value is marked to be read from the cell
+    void Update(Position pos, const Cell& cell);
+    // The value of the cell is going to change
+    void MarkStale(Position pos);
+    // The cell is empty or erased
+    void Clear(Position pos);
+
+    NumericColumn Get(int col) const;
+
+private:
+    using Chunk = NumericColumn::Chunk;
+
+    struct Column {
+        // up to the last chunk ever used, empty chunks are freed
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        size_t count = 0;
+    };
+
+    // Allocates the chunk of pos and clears the row bits
+    Chunk& Reset(Position pos);
+
+    std::unordered_map<int, Column> columns_;
+};
\ No newline at end of file
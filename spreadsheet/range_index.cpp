@@ -0,0 +1,82 @@
+#include "range_index.h"
+
+#include "cell.h"
+
+#include <algorithm>
+
+void RangeIndex::Add(const Cell* cell, const std::vector<Rect>& ranges) {
+    for (const Rect& range : ranges) {
+        Add(range, cell);
+    }
+}
+
+void RangeIndex::Remove(const Cell* cell, const std::vector<Rect>& ranges) {
+    for (const Rect& range : ranges) {
+        Remove(range, cell);
+    }
+}
+
+bool RangeIndex::Covers(Position pos) const {
+    bool covered = false;
+    ForEachCovering(pos, [&covered](const Cell*) {
+        covered = true;
+    });
+    return covered;
+}
+
+// private
+
+int RangeIndex::GetLevel(int length) {
+    int level = 0;
+    while (level + 1 < LEVELS && (1 << (MIN_SIZE_LOG + level)) < length) {
+        ++level;
+    }
+    return level;
+}
+
+uint32_t RangeIndex::BucketKey(int row_level, int col_level, int row, int col) {
+    // 256 buckets at most along each side of a grid
+    return static_cast<uint32_t>(((row_level * LEVELS + col_level) << 16) | (row << 8) | col);
+}
+
+void RangeIndex::Add(Rect range, const Cell* cell) {
+    ForEachBucket(range, [&](std::vector<Entry>& bucket) {
+        bucket.push_back({ range, cell });
+    });
+}
+
+void RangeIndex::Remove(Rect range, const Cell* cell) {
+    ForEachBucket(range, [&](std::vector<Entry>& bucket) {
+        const auto it = std::find_if(bucket.begin(), bucket.end(), [&](const Entry& entry) {
+            return cell == entry.cell && range == entry.range;
+        });
+        if (bucket.end() != it) {
+            *it = bucket.back();
+            bucket.pop_back();
+        }
+    });
+}
+
+// Calls func for the buckets of the range and keeps the grid sizes,
+// func adds or removes one entry in every bucket
+template <typename Func>
+void RangeIndex::ForEachBucket(Rect range, Func&& func) {
+    const int row_level = GetLevel(range.bottom_right.row - range.top_left.row + 1);
+    const int col_level = GetLevel(range.bottom_right.col - range.top_left.col + 1);
+    const int row_shift = MIN_SIZE_LOG + row_level;
+    const int col_shift = MIN_SIZE_LOG + col_level;
+
+    size_t& grid_size = grid_sizes_[row_level * LEVELS + col_level];
+    for (int row = range.top_left.row >> row_shift; row <= range.bottom_right.row >> row_shift; ++row) {
+        for (int col = range.top_left.col >> col_shift; col <= range.bottom_right.col >> col_shift; ++col) {
+            const uint32_t key = BucketKey(row_level, col_level, row, col);
+            auto& bucket = buckets_[key];
+            grid_size -= bucket.size();
+            func(bucket);
+            grid_size += bucket.size();
+            if (bucket.empty()) {
+                buckets_.erase(key);
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Finds the formulas whose ranges cover a position, so a range costs one
+// entry instead of an edge per cell. There is a grid for every pair of
+// row and column bucket sizes from 64 to 16384 cells. A range goes to the
+// grid with the smallest buckets at least as large as the range and takes
+// at most four buckets there, a lookup checks one bucket per grid in use.
+class RangeIndex {
+public:
+    // Adds or removes the linked ranges of the cell
+    void Add(const Cell* cell, const std::vector<Rect>& ranges);
+    void Remove(const Cell* cell, const std::vector<Rect>& ranges);
+
+    bool Covers(Position pos) const;
+
+    // Calls func(cell) for every formula with a range covering pos, a
+    // formula with several such ranges comes once per range
+    template <typename Func>
+    void ForEachCovering(Position pos, Func&& func) const;
+
+private:
+    struct Entry {
+        Rect range;
+        const Cell* cell;
+    };
+
+    static constexpr int MIN_SIZE_LOG = 6;
+    static constexpr int LEVELS = 9;
+
+    // the smallest level whose buckets are at least length cells long
+    static int GetLevel(int length);
+    static uint32_t BucketKey(int row_level, int col_level, int row, int col);
+
+    void Add(Rect range, const Cell* cell);
+    void Remove(Rect range, const Cell* cell);
+
+    template <typename Func>
+    void ForEachBucket(Rect range, Func&& func);
+
+    std::unordered_map<uint32_t, std::vector<Entry>> buckets_;
+    // number of entries in every grid, empty grids are skipped by lookups
+    std::array<size_t, LEVELS * LEVELS> grid_sizes_{};
+};
+
+template <typename Func>
+void RangeIndex::ForEachCovering(Position pos, Func&& func) const {
+    for (int row_level = 0; row_level < LEVELS; ++row_level) {
+        for (int col_level = 0; col_level < LEVELS; ++col_level) {
+            if (0 == grid_sizes_[row_level * LEVELS + col_level]) {
+                continue;
+            }
+            const auto it = buckets_.find(BucketKey(row_level, col_level,
+                pos.row >> (MIN_SIZE_LOG + row_level), pos.col >> (MIN_SIZE_LOG + col_level)));
+            if (buckets_.end() == it) {
+                continue;
+            }
+            for (const Entry& entry : it->second) {
+                if (entry.range.Contains(pos)) {
+                    func(entry.cell);
+                }
+            }
+        }
+    }
+}
\ No newline at end of file
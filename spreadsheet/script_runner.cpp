@@ -0,0 +1,222 @@
+#include "script_runner.h"
+
+#include "user_interface.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Splits the input into lines read in large chunks. A line is a view into
+// the chunk and is only valid until the next call to Next().
+class LineReader {
+public:
+    LineReader(std::istream& input, size_t chunk_size)
+        : input_(input)
+        , chunk_size_(std::max<size_t>(chunk_size, 1))
+    {}
+
+    // Returns false at the end of input, the line break is not included
+    bool Next(std::string_view& line) {
+        while (true) {
+            const char* first = buffer_.data() + begin_;
+            const char* last = buffer_.data() + end_;
+            const char* stop = std::find(first, last, '\n');
+            if (last != stop || (eof_ && first != last)) {
+                size_t length = stop - first;
+                if (0 != length && '\r' == first[length - 1]) {
+                    --length;
+                }
+                line = { first, length };
+                begin_ = last == stop ? end_ : stop - buffer_.data() + 1;
+                return true;
+            }
+            if (eof_) {
+                return false;
+            }
+            Refill();
+        }
+    }
+
+private:
+    // Keeps the unfinished line at the front of the buffer and appends the
+    // next chunk after it
+    void Refill() {
+        const size_t tail = end_ - begin_;
+        if (0 != tail && 0 != begin_) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, tail);
+        }
+        begin_ = 0;
+        end_ = tail;
+
+        if (buffer_.size() < tail + chunk_size_) {
+            buffer_.resize(tail + chunk_size_);
+        }
+        input_.read(buffer_.data() + end_, static_cast<std::streamsize>(chunk_size_));
+        end_ += static_cast<size_t>(input_.gcount());
+        if (!input_) {
+            eof_ = true;
+        }
+    }
+
+    std::istream& input_;
+    size_t chunk_size_;
+
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+};
+
+class ScriptRunner {
+public:
+    ScriptRunner(std::ostream& output, std::ostream& errors, Sheet& sheet, const ScriptOptions& options)
+        : errors_(errors)
+        , sheet_(sheet)
+        , executor_(output, sheet, false)
+        , batch_size_(std::max<size_t>(options.batch_size, 1))
+    {}
+
+    // Returns false on "exit"
+    bool Execute(size_t line, InputData data) {
+        ++report_.commands;
+        switch (data.action) {
+        case Actions::BAD_ACTION:
+            ReportError(line, "Wrong command");
+            return true;
+        case Actions::EXIT:
+            Flush();
+            return false;
+        case Actions::SET_CELL:
+        case Actions::CLEAR_CELL:
+            // a wrong position must not reach the batch, it would stay open
+            if (!data.pos.IsValid()) {
+                ReportError(line, "Wrong position");
+                return true;
+            }
+            ++report_.edits;
+            edits_.push_back({ line, std::move(data) });
+            if (edits_.size() >= batch_size_) {
+                Flush();
+            }
+            return true;
+        default:
+            break;
+        }
+
+        // the other commands read the sheet, so it must be up to date
+        Flush();
+        try {
+            executor_.Execute(data);
+        }
+        catch (const std::exception& e) {
+            ReportError(line, e.what());
+        }
+        return true;
+    }
+
+    // Applies the edits read so far
+    void Flush() {
+        if (edits_.empty()) {
+            return;
+        }
+
+        ++report_.batches;
+        try {
+            sheet_.BeginBatch();
+            for (const Edit& edit : edits_) {
+                Apply(edit);
+            }
+            sheet_.CommitBatch();
+        }
+        catch (const std::exception&) {
+            // the failed batch is rolled back, one by one shows the wrong edits
+            for (const Edit& edit : edits_) {
+                try {
+                    Apply(edit);
+                }
+                catch (const std::exception& e) {
+                    ReportError(edit.line, e.what());
+                }
+            }
+        }
+        edits_.clear();
+    }
+
+    ScriptReport& GetReport() {
+        return report_;
+    }
+
+private:
+    struct Edit {
+        size_t line;
+        InputData data;
+    };
+
+    void Apply(const Edit& edit) {
+        if (Actions::SET_CELL == edit.data.action) {
+            sheet_.SetCell(edit.data.pos, edit.data.data);
+        }
+        else {
+            sheet_.ClearCell(edit.data.pos);
+        }
+    }
+
+    void ReportError(size_t line, std::string_view message) {
+        ++report_.errors;
+        errors_ << "line " << line << ": " << message << '\n';
+    }
+
+    std::ostream& errors_;
+    Sheet& sheet_;
+    Executor executor_;
+    size_t batch_size_;
+
+    std::vector<Edit> edits_;
+    ScriptReport report_;
+};
+
+}   // namespace
+
+ScriptReport RunScript(std::istream& input, std::ostream& output, std::ostream& errors,
+    Sheet& sheet, const ScriptOptions& options) {
+    const auto start = Clock::now();
+    ScriptRunner runner(output, errors, sheet, options);
+    LineReader reader(input, options.chunk_size);
+
+    size_t line_number = 0;
+    for (std::string_view line; reader.Next(line); ) {
+        ++line_number;
+        if (line.find_first_not_of(" \t\v\f") == std::string_view::npos) {
+            continue;
+        }
+        if (!runner.Execute(line_number, InputReader::Parse(line))) {
+            break;
+        }
+    }
+    runner.Flush();
+
+    ScriptReport& report = runner.GetReport();
+    report.lines = line_number;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (0 != report.seconds) {
+        report.commands_per_second = report.commands / report.seconds;
+    }
+    return report;
+}
+
+std::ostream& operator<<(std::ostream& output, const ScriptReport& report) {
+    return output << report.lines << " lines, " << report.commands << " commands, "
+        << report.edits << " edits in " << report.batches << " batches, "
+        << report.errors << " errors in " << report.seconds << " s: "
+        << static_cast<size_t>(report.commands_per_second) << " commands/s";
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <cstddef>
+#include <iosfwd>
+
+struct ScriptOptions {
+    // bytes read from the script at once
+    size_t chunk_size = 1 << 20;
+    // edits in a row applied as one Sheet batch
+    size_t batch_size = 4'096;
+};
+
+struct ScriptReport {
+    size_t lines = 0;
+    size_t commands = 0;
+    size_t edits = 0;
+    // Sheet batches committed, a failed one counts too
+    size_t batches = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    double commands_per_second = 0;
+};
+
+// Runs the console commands of a script without a console. Edits are not
+// confirmed: the edits between two other commands are applied in batches,
+// so a cycle only counts if it is still there at the end of a batch. A
+// batch which fails is rolled back and applied again edit by edit to find
+// the wrong ones. Only the output of the commands goes to the output, the
+// wrong commands are reported to the errors with their line numbers.
+// Empty lines are skipped, "exit" ends the script.
+ScriptReport RunScript(std::istream& input, std::ostream& output, std::ostream& errors,
+    Sheet& sheet, const ScriptOptions& options = {});
+
+std::ostream& operator<<(std::ostream& output, const ScriptReport& report);
\ No newline at end of file
@@ -2,16 +2,25 @@
 
 #include "cell.h"
 #include "common.h"
+#include "table_export.h"
+#include "workbook.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std::literals;
 
 namespace {
 
+// smaller recalculations are not worth waking the threads
+static constexpr size_t PARALLEL_MIN_CELLS = 1024;
+
 static void CheckIfValid(Position pos) {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Wrong position");
@@ -24,6 +33,18 @@ Sheet::~Sheet() = default;
 
 void Sheet::SetCell(Position pos, std::string text) {
     CheckIfValid(pos);
+    LinkLoadedCells();
+
+    if (batch_active_) {
+        try {
+            StageEdit(pos, text);
+        }
+        catch (...) {
+            RollbackBatch();
+            throw;
+        }
+        return;
+    }
 
     if (!IsInScope(pos)) {
         Size new_scope{
@@ -33,12 +54,35 @@ void Sheet::SetCell(Position pos, std::string text) {
         ResizeScope(new_scope);
     }
 
-    auto& cell = sheet_.at(pos.row).at(pos.col);
-    if (!cell) {
-        cell = std::make_unique<Cell>();
+    // taken before the cell is created: a new cell goes away if Set() fails
+    const bool created = nullptr == sheet_.Get(pos);
+    auto& cell = GetOrCreateCell(pos);
+    align_.at(pos.col).Remove(cell);
+    ranges_.Remove(&cell, graph_.GetRanges(&cell));
+    // Set() creates the cells a formula refers to, which may widen the scope,
+    // so the column widths are looked up again afterwards
+    try {
+        cell.Set(text, this);
     }
-    cell->Set(text, this);
-    align_.at(pos.col).Max(sheet_draw::GetCellAlign(pos.col, GetConcreteCell(pos)));
+    catch (...) {
+        if (created) {
+            // nothing links to a cell that did not exist, and ranges
+            // covering it must not see a cell the sheet never set
+            sheet_.Erase(pos);
+            if (IsEdgePos(pos)) {
+                RecomputeScope();
+            }
+            throw;
+        }
+        ranges_.Add(&cell, graph_.GetRanges(&cell));
+        align_.at(pos.col).Add(cell);
+        throw;
+    }
+    LinkCell(&cell);
+    ranges_.Add(&cell, graph_.GetRanges(&cell));
+    align_.at(pos.col).Add(cell);
+    UpdateValue(pos, cell);
+    OnCellChanged(&cell);
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const {
@@ -48,7 +92,7 @@ const CellInterface* Sheet::GetCell(Position pos) const {
         return nullptr;
     }
 
-    return sheet_.at(pos.row).at(pos.col).get();
+    return GetConcreteCell(pos);
 }
 CellInterface* Sheet::GetCell(Position pos) {
     CheckIfValid(pos);
@@ -57,25 +101,45 @@ CellInterface* Sheet::GetCell(Position pos) {
         return nullptr;
     }
 
-    return sheet_.at(pos.row).at(pos.col).get();
+    return GetConcreteCell(pos);
 }
 
 void Sheet::ClearCell(Position pos) {
     CheckIfValid(pos);
+    LinkLoadedCells();
+
+    if (batch_active_) {
+        if (sheet_.Get(pos)) {
+            StageEdit(pos, "");
+            staged_.back().cleared = true;
+        }
+        return;
+    }
 
     if (!IsInScope(pos)) {
         return;
     }
 
-    auto& cell(sheet_.at(pos.row).at(pos.col));
+    auto cell = sheet_.Get(pos);
     if (cell) {
+        align_.at(pos.col).Remove(*cell);
+        ranges_.Remove(cell, graph_.GetRanges(cell));
         cell->Clear();
+        graph_.Unlink(cell);
+        if (workbook_) {
+            workbook_->Unlink(cell);
+        }
+        ClearValue(pos);
+        OnCellChanged(cell);
+        if (graph_.HasDependants(cell)) {
+            // formulas link to the cell, leave it empty in place
+            return;
+        }
 
-        cell.reset();
+        sheet_.Erase(pos);
         if (IsEdgePos(pos)) {
             RecomputeScope();
         }
-        FindAndSetMaxAlign(pos.col);
     }
 }
 
@@ -90,26 +154,356 @@ void Sheet::PrintTexts(std::ostream& output) const {
     PrintCells(output, true);
 }
 
+std::optional<NumericColumn> Sheet::GetNumericColumn(int col) const {
+    if (!snapshot_loaded_) {
+        return std::nullopt;
+    }
+    return numbers_.Get(col);
+}
+
+const SheetInterface* Sheet::FindSheet(std::string_view name) const {
+    return workbook_ ? workbook_->GetSheet(name) : nullptr;
+}
+
 void Sheet::DrawSheet(std::ostream& output, bool is_text) const {
     using namespace sheet_draw;
 
-    SheetDrawer drawer(output, align_);
+    LoadAllCells();
+    std::vector<Align> align;
+    align.reserve(scope_.cols);
+    for (int col = 0; col < scope_.cols; ++col) {
+        align.push_back(align_[col].Get(col));
+    }
+    // values of formulas change on recalculation, they are measured here
+    sheet_.ForEach([&align](Position pos, const Cell* cell) {
+        if (cell->IsFormula()) {
+            align[pos.col].Max({ GetValueSize(cell->GetValue()), 0 });
+        }
+    });
+
+    SheetDrawer drawer(output, align);
 
     //drawer.DrawEdgeLine(is_text);
     drawer.DrawHeader(is_text);
     for (int i{}; i < scope_.rows; ++i) {
         drawer.DrawDelimLine(is_text);
-        drawer.DrawRow(i + 1, sheet_.at(i), is_text);
+        drawer.DrawRow(i, sheet_, is_text);
     }
     //drawer.DrawEdgeLine(is_text);
 }
 
+void Sheet::DrawSheet(std::ostream& output, bool is_text, Rect window) const {
+    using namespace sheet_draw;
+
+    if (!window.IsValid()) {
+        throw InvalidPositionException("Wrong window");
+    }
+    const int first_row = window.top_left.row;
+    const int first_col = window.top_left.col;
+    const int end_row = std::max(first_row, std::min(window.bottom_right.row + 1, scope_.rows));
+    const int end_col = std::max(first_col, std::min(window.bottom_right.col + 1, scope_.cols));
+
+    if (!snapshot_loaded_) {
+        for (int row = first_row; row < end_row; ++row) {
+            for (int col = first_col; col < end_col; ++col) {
+                GetConcreteCell({ row, col });
+            }
+        }
+    }
+
+    std::vector<Align> align(end_col - first_col);
+    for (int col = first_col; col < end_col; ++col) {
+        const int col_id_size = GetColumnIdSize(col);
+        align[col - first_col].Max({ col_id_size, col_id_size });
+    }
+    for (int row = first_row; row < end_row; ++row) {
+        sheet_.ForEachInRow(row, first_col, end_col,
+            [&align, first_col](int col, const Cell* cell) {
+                const std::string text = cell ? cell->GetText() : std::string();
+                if (!text.empty()) {
+                    align[col - first_col].Max({
+                        GetValueSize(cell->GetValue()), static_cast<int>(text.size()) });
+                }
+            });
+    }
+
+    SheetDrawer drawer(output, align, first_col);
+    drawer.DrawHeader(is_text);
+    for (int row = first_row; row < end_row; ++row) {
+        drawer.DrawDelimLine(is_text);
+        drawer.DrawRow(row, sheet_, is_text);
+    }
+}
+
 const Cell* Sheet::GetConcreteCell(Position pos) const {
-    return sheet_.at(pos.row).at(pos.col).get();
+    const Cell* cell = sheet_.Get(pos);
+    return cell || snapshot_loaded_ ? cell : LoadCell(pos);
 }
 
 Cell* Sheet::GetConcreteCell(Position pos) {
-    return sheet_.at(pos.row).at(pos.col).get();
+    Cell* cell = sheet_.Get(pos);
+    return cell || snapshot_loaded_ ? cell : LoadCell(pos);
+}
+
+void Sheet::SetRecalcMode(RecalcMode mode) {
+    LinkLoadedCells();
+    recalc_mode_ = mode;
+    RecalculateIfAutomatic();
+}
+
+Sheet::RecalcMode Sheet::GetRecalcMode() const {
+    return recalc_mode_;
+}
+
+void Sheet::Recalculate() {
+    LinkLoadedCells();
+    if (CanRecalculateInParallel()) {
+        RecalculateInParallel();
+        return;
+    }
+
+    // number of dirty dependencies every dirty formula still waits for
+    std::unordered_map<const Cell*, int> waiting;
+    waiting.reserve(dirty_.size());
+    std::vector<const Cell*> ready;
+
+    for (const Cell* cell : dirty_) {
+        int count = 0;
+        ForEachDependency(cell, [this, &count](const Cell* dep) {
+            count += static_cast<int>(dirty_.count(dep));
+        });
+        waiting.emplace(cell, count);
+        if (0 == count) {
+            ready.push_back(cell);
+        }
+    }
+
+    while (!ready.empty()) {
+        const Cell* cell = ready.back();
+        ready.pop_back();
+
+        // dependencies are already evaluated, so this does not recurse
+        cell->GetValue();
+        UpdateValue(cell->GetPosition(), *cell);
+
+        ForEachDependant(cell, [&waiting, &ready](const Cell* dependant) {
+            const auto it = waiting.find(dependant);
+            if (waiting.end() != it && 0 == --it->second) {
+                ready.push_back(dependant);
+            }
+        });
+    }
+
+    dirty_.clear();
+}
+
+void Sheet::SetThreadCount(size_t threads) {
+    if (threads == GetThreadCount()) {
+        return;
+    }
+    pool_ = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+}
+
+size_t Sheet::GetThreadCount() const {
+    return pool_ ? pool_->GetThreadCount() : 1;
+}
+
+void Sheet::SaveBinary(const std::string& path) const {
+    LoadAllCells();
+
+    snapshot::Writer writer(scope_);
+    sheet_.ForEach([&writer](Position pos, const Cell* cell) {
+        writer.AddCell(pos, *cell, cell->GetReferencedRanges());
+    });
+    writer.Write(path);
+}
+
+void Sheet::Import(std::istream& input, TableFormat format) {
+    const bool own_batch = !batch_active_;
+    if (own_batch) {
+        BeginBatch();
+    }
+
+    TableReader reader(input, format);
+    try {
+        for (TableReader::Field field; reader.Next(field); ) {
+            CheckIfValid(field.pos);
+            StageEdit(field.pos, field.text);
+        }
+    }
+    catch (...) {
+        RollbackBatch();
+        throw;
+    }
+
+    if (own_batch) {
+        CommitBatch();
+    }
+}
+
+void Sheet::BeginBatch() {
+    if (batch_active_) {
+        throw std::logic_error("Batch is already started");
+    }
+    LinkLoadedCells();
+    batch_active_ = true;
+}
+
+// Links the staged cells in one pass. Only the cells reachable from them
+// can form a cycle or need a new place in the topological order.
+void Sheet::CommitBatch() {
+    if (!batch_active_) {
+        throw std::logic_error("Batch is not started");
+    }
+
+    std::vector<Cell*> edited;
+    edited.reserve(staged_.size());
+    for (const auto& edit : staged_) {
+        edited.push_back(edit.cell);
+    }
+    std::sort(edited.begin(), edited.end());
+    edited.erase(std::unique(edited.begin(), edited.end()), edited.end());
+
+    // referenced cells which do not exist yet are created empty, as SetCell does
+    for (size_t i = 0, count = edited.size(); i < count; ++i) {
+        for (Position pos : edited[i]->GetReferencedCells()) {
+            if (!sheet_.Get(pos)) {
+                staged_.push_back({ pos, &GetOrCreateCell(pos), std::nullopt, true, false });
+                staged_.back().cell->Exchange("", this);
+            }
+        }
+    }
+
+    ResizeScope(sheet_.GetBounds());
+    UnlinkCells(edited);
+    LinkCells(edited);
+
+    const auto affected = SortAffectedCells(edited);
+    if ((!affected.empty() && nullptr == affected.back())
+        || (workbook_ && workbook_->HasCycle(*this, edited))) {
+        // relink the old contents before the cells created by the batch go away
+        UnlinkCells(edited);
+        RestoreStagedContents();
+        LinkCells(edited);
+        RollbackBatch();
+        throw CircularDependencyException("Circular dependency found");
+    }
+
+    const bool has_sheet_dependants = workbook_ && workbook_->HasDependants(*this);
+    for (const Cell* cell : affected) {
+        cell->MoveToEndOfOrder();
+        cell->InvalidateValue();
+        if (cell->IsFormula()) {
+            dirty_.insert(cell);
+        }
+        else {
+            dirty_.erase(cell);
+        }
+        if (has_sheet_dependants) {
+            workbook_->InvalidateDependants(*this, cell->GetPosition());
+        }
+    }
+
+    if (RecalcMode::Automatic == recalc_mode_) {
+        if (CanRecalculateInParallel()) {
+            RecalculateInParallel();
+        }
+        else {
+            // the cells are already sorted, dependencies first
+            for (const Cell* cell : affected) {
+                cell->GetValue();
+                dirty_.erase(cell);
+            }
+        }
+    }
+    for (const Cell* cell : affected) {
+        UpdateValue(cell->GetPosition(), *cell);
+    }
+    if (workbook_ && RecalcMode::Automatic == recalc_mode_) {
+        workbook_->Recalculate();
+    }
+
+    // the last edit of a cell decides whether it stays, cleared cells which
+    // formulas refer to stay empty in place as in ClearCell
+    const bool has_clears = std::any_of(staged_.begin(), staged_.end(),
+        [](const StagedEdit& edit) {
+            return edit.cleared;
+        });
+    if (has_clears) {
+        std::unordered_set<const Cell*> last_edits;
+        for (auto it = staged_.rbegin(); it != staged_.rend(); ++it) {
+            if (!last_edits.insert(it->cell).second) {
+                it->cell = nullptr;
+            }
+            else if (it->cleared && !graph_.HasDependants(it->cell)) {
+                sheet_.Erase(it->pos);
+                it->cell = nullptr;
+            }
+        }
+        ResizeScope(sheet_.GetBounds());
+    }
+
+    staged_.clear();
+    batch_active_ = false;
+}
+
+// Puts the old contents back and drops the cells created by the batch,
+// the dependency links are not touched
+void Sheet::RollbackBatch() {
+    RestoreStagedContents();
+    for (const auto& edit : staged_) {
+        if (edit.created) {
+            ClearValue(edit.pos);
+            sheet_.Erase(edit.pos);
+        }
+    }
+    staged_.clear();
+    batch_active_ = false;
+    ResizeScope(sheet_.GetBounds());
+}
+
+std::unique_ptr<Sheet> Sheet::LoadBinary(const std::string& path) {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->snapshot_ = std::make_unique<SheetSnapshot>(path);
+    sheet->snapshot_loaded_ = false;
+    sheet->snapshot_linked_ = false;
+
+    sheet->ResizeScope(sheet->snapshot_->GetSize());
+    return sheet;
+}
+
+SheetView Sheet::Snapshot() {
+    if (batch_active_) {
+        throw std::logic_error("Snapshot inside a batch");
+    }
+    Recalculate();
+
+    if (!versions_) {
+        versions_ = std::make_shared<VersionStore>();
+        sheet_.ForEach([this](Position pos, const Cell* cell) {
+            versions_->Set(pos, cell);
+        });
+    }
+    else {
+        for (uint32_t key : version_changes_) {
+            const Position pos{ static_cast<int>(key / Position::MAX_COLS),
+                static_cast<int>(key % Position::MAX_COLS) };
+            versions_->Set(pos, sheet_.Get(pos));
+        }
+    }
+    version_changes_.clear();
+    return versions_->Publish(scope_);
+}
+
+bool Sheet::IsReferenced(const Cell* cell) const {
+    return graph_.HasDependants(cell);
+}
+
+void Sheet::CheckSheetCycles(const Cell* cell, const std::unordered_set<const Cell*>& dependencies,
+    const std::vector<Rect>& ranges, const std::vector<SheetReference>& references) const {
+    if (workbook_ && workbook_->HasCycle(*this, cell, dependencies, ranges, references)) {
+        throw CircularDependencyException("Circular dependency found");
+    }
 }
 
 bool Sheet::IsInScope(Position pos) const {
@@ -124,68 +518,364 @@ void Sheet::ResizeScope(Size val) {
     if (scope_ == val) {
         return;
     }
-    sheet_.resize(val.rows);
     align_.resize(val.cols);
-    for (auto& row : sheet_) {
-        row.resize(val.cols);
-    }
     scope_ = val;
 }
 
 void Sheet::RecomputeScope() {
-    // new scope
-    Size ns{};
-
-    for (int r = scope_.rows; r != 0; --r) {
-        for (int c = scope_.cols; c != 0; --c) {
-            if (sheet_.at(r - 1).at(c - 1)) {
-                ns.rows = std::max(ns.rows, r);
-                ns.cols = std::max(ns.cols, c);
-                break;
-            }
-            else if (c < ns.cols) {
-                break;
-            }
+    ResizeScope(sheet_.GetBounds());
+}
+
+// A new cell is empty, so it may go first in the topological order. That
+// keeps the order valid for the formulas whose ranges cover the cell.
+Cell& Sheet::GetOrCreateCell(Position pos) {
+    if (Cell* cell = sheet_.Get(pos)) {
+        return *cell;
+    }
+    Cell& cell = sheet_.GetOrCreate(pos);
+    if (ranges_.Covers(pos)) {
+        cell.MoveToStartOfOrder();
+    }
+    return cell;
+}
+
+void Sheet::LinkCell(const Cell* cell) {
+    std::vector<const Cell*> dependencies;
+    for (Position pos : cell->GetReferencedCells()) {
+        dependencies.push_back(sheet_.Get(pos));
+    }
+    graph_.Link(cell, dependencies, cell->GetReferencedRanges());
+    if (workbook_) {
+        workbook_->Link(*this, cell, cell->GetSheetReferences());
+    }
+}
+
+void Sheet::LinkCells(const std::vector<Cell*>& cells) {
+    for (Cell* cell : cells) {
+        LinkCell(cell);
+        ranges_.Add(cell, graph_.GetRanges(cell));
+    }
+}
+
+void Sheet::UnlinkCells(const std::vector<Cell*>& cells) {
+    for (Cell* cell : cells) {
+        ranges_.Remove(cell, graph_.GetRanges(cell));
+        graph_.Unlink(cell);
+        if (workbook_) {
+            workbook_->Unlink(cell);
         }
     }
+}
 
-    ResizeScope(ns);
-    return;
+// The numeric columns follow every value, the snapshots only the changes
+// made since the last one was taken
+void Sheet::UpdateValue(Position pos, const Cell& cell) const {
+    numbers_.Update(pos, cell);
+    if (versions_) {
+        version_changes_.insert(pos.row * Position::MAX_COLS + pos.col);
+    }
 }
 
-void Sheet::FindAndSetMaxAlign(int col) {
-    if (align_.empty()) {
-        return;
+void Sheet::MarkValueStale(Position pos) const {
+    numbers_.MarkStale(pos);
+    if (versions_) {
+        version_changes_.insert(pos.row * Position::MAX_COLS + pos.col);
     }
+}
 
-    sheet_draw::Align new_align{};
-    for (int i = 0; i < scope_.rows; ++i) {
-        const auto cell{ sheet_.at(i).at(col).get() };
-        new_align.Max(sheet_draw::GetCellAlign(col, cell));
+void Sheet::ClearValue(Position pos) const {
+    numbers_.Clear(pos);
+    if (versions_) {
+        version_changes_.insert(pos.row * Position::MAX_COLS + pos.col);
     }
-    align_.at(col) = new_align;
 }
 
-void Sheet::PrintCells(std::ostream& output, bool is_text) const {
-    for (const auto& row : sheet_) {
-        for (const auto& cell : row) {
-            if (cell) {
-                if (is_text) {
-                    output << cell->GetText();
-                }
-                else {
-                    std::visit(
-                        [&output](auto&& arg) {
-                            output << arg;
-                        }, cell->GetValue());
+bool Sheet::CanRecalculateInParallel() const {
+    return pool_ && dirty_.size() >= PARALLEL_MIN_CELLS
+        && !(workbook_ && workbook_->ReadsDirtySheet(*this));
+}
+
+// Kahn's algorithm one level at a time: the formulas of a level depend
+// only on earlier levels, so they are evaluated concurrently and every
+// cell is written by one thread. Levels are contiguous ranges of order,
+// the next one is appended while the current one is evaluated.
+void Sheet::RecalculateInParallel() {
+    const std::vector<const Cell*> cells(dirty_.begin(), dirty_.end());
+    std::unordered_map<const Cell*, size_t> ids;
+    ids.reserve(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+        ids.emplace(cells[i], i);
+    }
+
+    // number of dirty dependencies every dirty formula still waits for
+    const auto waiting = std::make_unique<std::atomic<int>[]>(cells.size());
+    std::vector<const Cell*> order(cells.size());
+    size_t end = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        int count = 0;
+        ForEachDependency(cells[i], [&ids, &count](const Cell* dep) {
+            count += static_cast<int>(ids.count(dep));
+        });
+        waiting[i].store(count, std::memory_order_relaxed);
+        if (0 == count) {
+            order[end++] = cells[i];
+        }
+    }
+
+    std::atomic<size_t> next_end{ end };
+    for (size_t begin = 0; begin != end; ) {
+        pool_->ParallelFor(end - begin, [&, begin](size_t i) {
+            const Cell* cell = order[begin + i];
+            cell->GetValue();
+
+            ForEachDependant(cell, [&](const Cell* dependant) {
+                const auto it = ids.find(dependant);
+                if (ids.end() != it && 1 == waiting[it->second].fetch_sub(1, std::memory_order_acq_rel)) {
+                    order[next_end.fetch_add(1, std::memory_order_relaxed)] = dependant;
                 }
+            });
+        });
+        begin = end;
+        end = next_end.load();
+    }
+
+    // the columns are shared by the threads, they are updated afterwards
+    for (size_t i = 0; i < end; ++i) {
+        UpdateValue(order[i]->GetPosition(), *order[i]);
+    }
+    dirty_.clear();
+}
+
+void Sheet::InvalidateDependants(const Cell* cell) {
+    const bool has_sheet_dependants = workbook_ && workbook_->HasDependants(*this);
+    std::vector<const Cell*> stack{ cell };
+
+    while (!stack.empty()) {
+        const Cell* current = stack.back();
+        stack.pop_back();
+        if (has_sheet_dependants) {
+            workbook_->InvalidateDependants(*this, current->GetPosition());
+        }
+
+        ForEachDependant(current, [this, &stack](const Cell* dependant) {
+            // a dirty formula without a cached value has no cached dependants
+            const bool had_value = dependant->InvalidateValue();
+            MarkValueStale(dependant->GetPosition());
+            if (dirty_.insert(dependant).second || had_value) {
+                stack.push_back(dependant);
             }
-            if (&row.back() != &cell) {
-                output << '\t';
+        });
+    }
+}
+
+void Sheet::OnCellChanged(const Cell* cell) {
+    if (cell->IsFormula()) {
+        dirty_.insert(cell);
+    }
+    else {
+        dirty_.erase(cell);
+    }
+    InvalidateDependants(cell);
+    RecalculateIfAutomatic();
+}
+
+void Sheet::InvalidateSheetReference(const Cell* cell) {
+    const bool had_value = cell->InvalidateValue();
+    MarkValueStale(cell->GetPosition());
+    if (dirty_.insert(cell).second || had_value) {
+        InvalidateDependants(cell);
+    }
+}
+
+void Sheet::RecalculateIfAutomatic() {
+    if (RecalcMode::Automatic != recalc_mode_) {
+        return;
+    }
+    if (workbook_) {
+        workbook_->Recalculate();
+    }
+    else {
+        Recalculate();
+    }
+}
+
+void Sheet::PrintCells(std::ostream& output, bool is_text) const {
+    LoadAllCells();
+    {
+        TableWriter writer(output);
+        for (int row = 0; row < scope_.rows; ++row) {
+            sheet_.ForEachInRow(row, scope_.cols,
+                [&writer, is_text](int col, const Cell* cell) {
+                    if (0 != col) {
+                        writer.Write('\t');
+                    }
+                    if (cell) {
+                        if (is_text) {
+                            cell->WriteText(writer);
+                        }
+                        else {
+                            cell->WriteValue(writer);
+                        }
+                    }
+                });
+            writer.Write('\n');
+        }
+    }
+    output.flush();
+}
+
+void Sheet::StageEdit(Position pos, std::string_view text) {
+    const bool created = !sheet_.Get(pos);
+    Cell& cell = GetOrCreateCell(pos);
+    if (created) {
+        ResizeScope(sheet_.GetBounds());
+    }
+    staged_.push_back({ pos, &cell, std::nullopt, created, false });
+
+    auto& align = align_.at(pos.col);
+    align.Remove(cell);
+    try {
+        staged_.back().old_content = cell.Exchange(text, this);
+    }
+    catch (...) {
+        align.Add(cell);
+        throw;
+    }
+    align.Add(cell);
+    MarkValueStale(pos);
+}
+
+// Undoes the staged edits in reverse order
+void Sheet::RestoreStagedContents() {
+    for (auto it = staged_.rbegin(); it != staged_.rend(); ++it) {
+        if (it->old_content) {
+            auto& align = align_.at(it->pos.col);
+            align.Remove(*it->cell);
+            it->cell->Restore(std::move(*it->old_content));
+            it->old_content.reset();
+            align.Add(*it->cell);
+            UpdateValue(it->pos, *it->cell);
+        }
+    }
+}
+
+// Cells reachable from the edited ones through dependants, dependencies
+// first (Kahn). A trailing nullptr means some of them form a cycle.
+std::vector<const Cell*> Sheet::SortAffectedCells(const std::vector<Cell*>& edited) const {
+    if (IsStagedInOrder(edited.size())) {
+        std::vector<const Cell*> sorted;
+        sorted.reserve(edited.size());
+        for (size_t i = 0; i < edited.size(); ++i) {
+            sorted.push_back(staged_[i].cell);
+        }
+        return sorted;
+    }
+
+    std::unordered_map<const Cell*, int> waiting;
+    waiting.reserve(edited.size());
+    std::vector<const Cell*> stack(edited.begin(), edited.end());
+    for (const Cell* cell : stack) {
+        waiting.emplace(cell, 0);
+    }
+    while (!stack.empty()) {
+        const Cell* cell = stack.back();
+        stack.pop_back();
+        ForEachDependant(cell, [&waiting, &stack](const Cell* dependant) {
+            if (waiting.emplace(dependant, 0).second) {
+                stack.push_back(dependant);
+            }
+        });
+    }
+
+    std::vector<const Cell*> sorted;
+    sorted.reserve(waiting.size());
+    for (auto& [cell, count] : waiting) {
+        ForEachDependency(cell, [&waiting, &count = count](const Cell* dep) {
+            count += static_cast<int>(waiting.count(dep));
+        });
+        if (0 == count) {
+            sorted.push_back(cell);
+        }
+    }
+    for (size_t next = 0; next < sorted.size(); ++next) {
+        ForEachDependant(sorted[next], [&waiting, &sorted](const Cell* dependant) {
+            if (0 == --waiting[dependant]) {
+                sorted.push_back(dependant);
             }
+        });
+    }
+
+    if (sorted.size() != waiting.size()) {
+        sorted.push_back(nullptr);
+    }
+    return sorted;
+}
+
+// The usual import into empty cells needs no search. Nothing outside the
+// batch depends on a new cell out of the ranges, so if the first count
+// edits created every edited cell, each after its dependencies, the
+// staging order is already a topological one.
+bool Sheet::IsStagedInOrder(size_t count) const {
+    for (size_t i = 0; i < count; ++i) {
+        const StagedEdit& edit = staged_[i];
+        if (!edit.created || ranges_.Covers(edit.pos)) {
+            return false;
+        }
+        bool in_order = true;
+        ForEachDependency(edit.cell, [&edit, &in_order](const Cell* dep) {
+            in_order = in_order && edit.cell->IsOrderedAfter(*dep);
+        });
+        if (!in_order) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Cell* Sheet::LoadCell(Position pos) const {
+    const auto index = snapshot_->Find(pos);
+    if (!index) {
+        return nullptr;
+    }
+
+    auto& cell = sheet_.GetOrCreate(pos);
+    if (snapshot_->IsFormula(*index)) {
+        cell.Load(LoadFormula(snapshot_->GetFormula(*index)), snapshot_->GetValue(*index), this);
+    }
+    else {
+        cell.Load(std::string(snapshot_->GetText(*index)), this);
+    }
+    align_.at(pos.col).Add(cell);
+    UpdateValue(pos, cell);
+    return &cell;
+}
+
+void Sheet::LoadAllCells() const {
+    if (snapshot_loaded_) {
+        return;
+    }
+    for (uint32_t i = 0; i < snapshot_->GetCellCount(); ++i) {
+        const Position pos = snapshot_->GetPosition(i);
+        if (!sheet_.Get(pos)) {
+            LoadCell(pos);
         }
-        output << std::endl;
     }
+    snapshot_loaded_ = true;
+}
+
+// Edits need the dependency graph, which is only built for a whole sheet
+void Sheet::LinkLoadedCells() {
+    if (snapshot_linked_) {
+        return;
+    }
+    LoadAllCells();
+    for (size_t i = 0; i < snapshot_->GetCellCount(); ++i) {
+        Cell* cell = sheet_.Get(snapshot_->GetPosition(snapshot_->GetOrdered(i)));
+        LinkCell(cell);
+        ranges_.Add(cell, graph_.GetRanges(cell));
+        cell->MoveToEndOfOrder();
+    }
+    snapshot_linked_ = true;
 }
 
 std::unique_ptr<SheetInterface> CreateSheet() {
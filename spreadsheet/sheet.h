@@ -1,17 +1,37 @@
 #pragma once
 
 #include "cell.h"
+#include "cell_table.h"
 #include "common.h"
+#include "dependency_graph.h"
+#include "numeric_columns.h"
+#include "range_index.h"
 #include "sheet_draw.h"
-
+#include "sheet_view.h"
+#include "snapshot.h"
+#include "table_import.h"
+#include "thread_pool.h"
+
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
 #include <functional>
 
+class Workbook;
+
 class Sheet : public SheetInterface {
 public:
-    using Row = std::vector<std::unique_ptr<Cell>>;
-    using Table = std::vector<Row>;
+    // Automatic mode re-evaluates changed formulas after every edit, manual
+    // mode leaves them for Recalculate() or for the first read of a value
+    enum class RecalcMode {
+        Automatic,
+        Manual,
+    };
 
     ~Sheet();
 
@@ -27,23 +47,176 @@ public:
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
+    // Numbers of the column, nullopt until the cells of a snapshot are read
+    std::optional<NumericColumn> GetNumericColumn(int col) const override;
+    // Another sheet of the workbook, nullptr outside a workbook
+    const SheetInterface* FindSheet(std::string_view name) const override;
+
     void DrawSheet(std::ostream& output, bool is_text) const;
+    // Draws the part of the window inside the printable area. Only the
+    // visible cells are evaluated and the columns are as wide as their
+    // visible cells. Throws InvalidPositionException for an invalid window.
+    void DrawSheet(std::ostream& output, bool is_text, Rect window) const;
 
     const Cell* GetConcreteCell(Position pos) const;
     Cell* GetConcreteCell(Position pos);
 
+    void SetRecalcMode(RecalcMode mode);
+    RecalcMode GetRecalcMode() const;
+
+    // Evaluates every dirty formula exactly once, dependencies first
+    void Recalculate();
+
+    // Large recalculations are split into topological levels, the formulas
+    // of a level are evaluated on a pool of that many threads. One thread,
+    // the default, evaluates everything on the calling thread.
+    void SetThreadCount(size_t threads);
+    size_t GetThreadCount() const;
+
+    // Writes the cells with their compiled formulas and values to a binary
+    // file, throws SnapshotException on I/O errors
+    void SaveBinary(const std::string& path) const;
+    // Maps a file written by SaveBinary. Cells are restored one by one as
+    // they are read, the first edit restores the rest and their dependencies
+    static std::unique_ptr<Sheet> LoadBinary(const std::string& path);
+
+    // Edits between BeginBatch() and CommitBatch() are staged in the cells
+    // and linked at once: one cycle check, one invalidation pass and one
+    // alignment refresh. A parse error while staging or a cycle found by
+    // CommitBatch() rolls the whole batch back before the exception leaves.
+    void BeginBatch();
+    void CommitBatch();
+    void RollbackBatch();
+
+    // Immutable view of the current contents and values which other threads
+    // may read while the sheet changes. Dirty formulas are evaluated first.
+    // Taking it copies only the cells changed since the previous one, and
+    // must not overlap with edits. Throws std::logic_error inside a batch.
+    SheetView Snapshot();
+
+    // Reads delimited text in the layout of PrintTexts, every non-empty field
+    // sets a cell. Runs as a batch of its own or joins the current one.
+    void Import(std::istream& input, TableFormat format);
+
+    // Walks of the dependency graph. Dependencies through ranges are not
+    // links of the cells: the dependants come from the range index, the
+    // dependencies are the cells stored inside the ranges.
+    template <typename Func>
+    void ForEachDependant(const Cell* cell, Func&& func) const;
+    template <typename Func>
+    void ForEachDependency(const Cell* cell, Func&& func) const;
+    // Calls func(cell) for every stored cell inside the range
+    template <typename Func>
+    void ForEachCellInRange(Rect range, Func&& func) const;
+    // True if a formula links to the cell, ranges covering it do not count
+    bool IsReferenced(const Cell* cell) const;
+    // Throws CircularDependencyException if the new links of the cell close
+    // a cycle through other sheets of the workbook
+    void CheckSheetCycles(const Cell* cell, const std::unordered_set<const Cell*>& dependencies,
+        const std::vector<Rect>& ranges, const std::vector<SheetReference>& references) const;
+
 private:
+    friend class Workbook;
+
     bool IsInScope(Position pos) const;
     bool IsEdgePos(Position pos) const;
 
     void ResizeScope(Size val);
     void RecomputeScope();
 
-    void FindAndSetMaxAlign(int col);
+    Cell& GetOrCreateCell(Position pos);
+    // Links the cell to the cells its content refers to, all of them exist
+    void LinkCell(const Cell* cell);
+    void LinkCells(const std::vector<Cell*>& cells);
+    void UnlinkCells(const std::vector<Cell*>& cells);
+
+    // Every change of a value goes to the numeric columns and, once the
+    // snapshots are taken, to the positions the next version copies
+    void UpdateValue(Position pos, const Cell& cell) const;
+    void MarkValueStale(Position pos) const;
+    void ClearValue(Position pos) const;
+
+    // Large recalculations go to the pool unless the formulas read dirty
+    // cells of other sheets, which are evaluated on first read
+    bool CanRecalculateInParallel() const;
+    void RecalculateInParallel();
+    void InvalidateDependants(const Cell* cell);
+    // A formula of the sheet refers to a changed cell of another sheet
+    void InvalidateSheetReference(const Cell* cell);
+    void OnCellChanged(const Cell* cell);
+    // In the automatic mode, the dependants in other sheets are evaluated too
+    void RecalculateIfAutomatic();
 
     void PrintCells(std::ostream& output, bool is_text) const;
 
+    // Edit of a batch: the new content is in the cell, the old one is kept
+    // until the batch is committed
+    struct StagedEdit {
+        Position pos;
+        Cell* cell;
+        std::optional<Cell::Content> old_content;
+        bool created;
+        bool cleared;
+    };
+
+    void StageEdit(Position pos, std::string_view text);
+    void RestoreStagedContents();
+    std::vector<const Cell*> SortAffectedCells(const std::vector<Cell*>& edited) const;
+    bool IsStagedInOrder(size_t count) const;
+
+    Cell* LoadCell(Position pos) const;
+    void LoadAllCells() const;
+    void LinkLoadedCells();
+
+    // declared before the cells, loaded formulas point into the mapping
+    std::unique_ptr<SheetSnapshot> snapshot_;
+    mutable bool snapshot_loaded_ = true;
+    bool snapshot_linked_ = true;
+
     Size scope_;
-    Table sheet_;
-    std::vector<sheet_draw::Align> align_;
-};
\ No newline at end of file
+    // cells of a snapshot are added on first read, hence mutable
+    mutable CellTable sheet_;
+    mutable std::vector<sheet_draw::ColumnAlign> align_;
+    // links between the cells and the ranges of every formula
+    DependencyGraph graph_;
+    // formulas by the ranges they refer to
+    RangeIndex ranges_;
+    // values of the cells by columns, updated on every change of a value
+    mutable NumericColumns numbers_;
+    // versions of the sheet, created by the first snapshot
+    std::shared_ptr<VersionStore> versions_;
+    // positions changed since the last snapshot, by row * MAX_COLS + col
+    mutable std::unordered_set<uint32_t> version_changes_;
+
+    RecalcMode recalc_mode_ = RecalcMode::Automatic;
+    // formulas whose values are out of date, closed under dependants
+    std::unordered_set<const Cell*> dirty_;
+    std::unique_ptr<ThreadPool> pool_;
+
+    bool batch_active_ = false;
+    std::vector<StagedEdit> staged_;
+
+    // the workbook owning the sheet, it links the references between sheets
+    Workbook* workbook_ = nullptr;
+};
+
+template <typename Func>
+void Sheet::ForEachDependant(const Cell* cell, Func&& func) const {
+    graph_.ForEachDependant(cell, func);
+    ranges_.ForEachCovering(cell->GetPosition(), func);
+}
+
+template <typename Func>
+void Sheet::ForEachDependency(const Cell* cell, Func&& func) const {
+    graph_.ForEachDependency(cell, func);
+    for (const Rect& range : graph_.GetRanges(cell)) {
+        ForEachCellInRange(range, func);
+    }
+}
+
+template <typename Func>
+void Sheet::ForEachCellInRange(Rect range, Func&& func) const {
+    sheet_.ForEachInRect(range, [&func](Position, const Cell* cell) {
+        func(cell);
+    });
+}
\ No newline at end of file
@@ -1,22 +1,25 @@
 #pragma once
 
 #include "cell.h"
+#include "cell_table.h"
 #include "common.h"
 
 #include <iostream>
 #include <iomanip>
+#include <map>
 #include <sstream>
+#include <string>
 #include <vector>
 
 namespace sheet_draw {
 
 using namespace std;
 
-//    
+// Вырвнивание для номера строки
 static constexpr int ROW_ID_ALIGN = 3;
-//     
+// Базовое выравнивание для пустой ячейки
 static constexpr int BASIC_ALLIGN = 3;
-//  
+// Разделитель ячеек
 static const char DELIM('|');
 
 struct Align {
@@ -30,35 +33,99 @@ struct Align {
     }
 };
 
-static Align GetCellAlign(int col, const Cell* cell) {
-    Align align{};
-
-    const int col_id_size = pos_convert::IndexToColumn(col).size();
-    align.Max({ col_id_size, col_id_size });
-
-    if (cell) {
-        visit(
-            [&align](auto&& args) {
-                ostringstream txt_stream;
-                txt_stream << args;
-                align.val = max(align.val, static_cast<int>(txt_stream.str().size()));
-            }, cell->GetValue()
-                );
-        align.txt = max(align.txt, static_cast<int>(cell->GetText().size()));
+// Длина имени столбца, без построения самого имени
+static int GetColumnIdSize(int col) {
+    int size = 1;
+    for (int letters = 26; col >= letters; col -= letters, letters *= 26) {
+        ++size;
     }
-    return align;
+    return size;
 }
 
+// Ширина значения в том виде, в каком его выводит operator<<
+static int GetValueSize(const CellInterface::Value& value) {
+    if (const auto* text = get_if<string>(&value)) {
+        return static_cast<int>(text->size());
+    }
+    if (const auto* number = get_if<double>(&value)) {
+        char buffer[num_convert::MAX_LENGTH];
+        return static_cast<int>(num_convert::ToChars(buffer, *number) - buffer);
+    }
+    return static_cast<int>(get<FormulaError>(value).ToString().size());
+}
+
+// Число ячеек каждой ширины, самая широкая известна за O(1).
+// Пустые ячейки не учитываются.
+class WidthHistogram {
+public:
+    void Change(int width, int delta) {
+        if (width <= 0) {
+            return;
+        }
+        const auto it = counts_.emplace(width, 0).first;
+        if (0 == (it->second += delta)) {
+            counts_.erase(it);
+        }
+    }
+
+    int Max() const {
+        return counts_.empty() ? 0 : counts_.rbegin()->first;
+    }
+
+private:
+    map<int, int> counts_;
+};
+
+// Ширины ячеек столбца, обновляются при каждом изменении ячейки.
+// Значения формул меняются при пересчёте, поэтому их ширина здесь
+// не хранится и измеряется только при отрисовке.
+class ColumnAlign {
+public:
+    void Add(const Cell& cell) {
+        Count(cell, 1);
+    }
+
+    void Remove(const Cell& cell) {
+        Count(cell, -1);
+    }
+
+    Align Get(int col) const {
+        const int col_id_size = GetColumnIdSize(col);
+        Align align{};
+        align.Max({ col_id_size, col_id_size });
+        align.Max({ val_.Max(), txt_.Max() });
+        return align;
+    }
+
+private:
+    void Count(const Cell& cell, int delta) {
+        const string text = cell.GetText();
+        if (text.empty()) {
+            return;
+        }
+        txt_.Change(static_cast<int>(text.size()), delta);
+        if (!cell.IsFormula()) {
+            val_.Change(GetValueSize(cell.GetValue()), delta);
+        }
+    }
+
+    WidthHistogram val_;
+    WidthHistogram txt_;
+};
+
 class SheetDrawer {
 private:
     ostream& out_;
     const vector<Align>& align_;
+    // столбец, выравнивание которого лежит в align_[0]
+    int first_col_;
 public:
     SheetDrawer() = delete;
     SheetDrawer(SheetDrawer&) = delete;
-    explicit SheetDrawer(ostream& output, const vector<Align>& align)
+    explicit SheetDrawer(ostream& output, const vector<Align>& align, int first_col = 0)
         : out_(output)
         , align_(align)
+        , first_col_(first_col)
     {}
 
     SheetDrawer& operator=(const SheetDrawer&) = delete;
@@ -108,7 +175,7 @@ public:
             else {
                 a = align_.at(i).val;
             }
-            const auto index = pos_convert::IndexToColumn(i);
+            const auto index = pos_convert::IndexToColumn(first_col_ + i);
             a = index.size() < a ? a - index.size() : 0;
             out_ << string(a / 2, ' ')
                  << index
@@ -118,6 +185,7 @@ public:
     }
 
     void DrawCell(int col, const Cell* cell, bool is_text) const {
+        col -= first_col_;
         out_ << DELIM;
         if (cell) {
             if (is_text) {
@@ -142,12 +210,12 @@ public:
         }
     }
 
-    using Row = std::vector<std::unique_ptr<Cell>>;
-    void DrawRow(int row_id, const Row& row, bool is_text) const {
-        out_ /* << '|' */ << setw(ROW_ID_ALIGN) << row_id;
-        for (int i{}; i < row.size(); ++i) {
-            DrawCell(i, row.at(i).get(), is_text);
-        }
+    void DrawRow(int row, const CellTable& cells, bool is_text) const {
+        out_ /* << '|' */ << setw(ROW_ID_ALIGN) << row + 1;
+        cells.ForEachInRow(row, first_col_, first_col_ + static_cast<int>(align_.size()),
+            [this, is_text](int col, const Cell* cell) {
+                DrawCell(col, cell, is_text);
+            });
         out_ /* << '|' */ << endl;
     }
 };
@@ -0,0 +1,714 @@
+#include "sheet_server.h"
+
+#if defined(__linux__)
+
+#include "table_export.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+
+static constexpr std::string_view DEFAULT_SHEET = "Sheet1"sv;
+// commands of a connection in flight, reading stops at the limit
+static constexpr size_t MAX_PIPELINE = 1024;
+// a line longer than that closes the connection
+static constexpr size_t MAX_REQUEST_SIZE = 1 << 20;
+// answers the client does not read, reading stops at the limit
+static constexpr size_t MAX_OUTPUT = 4 << 20;
+static constexpr size_t READ_SIZE = 64 * 1024;
+// reads a reader thread takes from the queue at once
+static constexpr size_t READER_BATCH = 32;
+
+[[noreturn]] static void ThrowSystemError(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+struct SocketAddress {
+    sockaddr_storage storage{};
+    socklen_t length = 0;
+    int family = AF_UNSPEC;
+};
+
+// Digits are a TCP port on 127.0.0.1, anything else is a path
+static SocketAddress ParseAddress(const std::string& address) {
+    SocketAddress result;
+    const bool is_port = !address.empty() && address.size() <= 5
+        && std::all_of(address.begin(), address.end(), [](char c) {
+            return '0' <= c && c <= '9';
+        });
+    if (is_port) {
+        const int port = std::stoi(address);
+        if (port > UINT16_MAX) {
+            throw std::invalid_argument("Wrong port " + address);
+        }
+        auto* inet = reinterpret_cast<sockaddr_in*>(&result.storage);
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons(static_cast<uint16_t>(port));
+        inet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        result.length = sizeof(sockaddr_in);
+        result.family = AF_INET;
+        return result;
+    }
+
+    auto* local = reinterpret_cast<sockaddr_un*>(&result.storage);
+    if (address.empty() || address.size() >= sizeof(local->sun_path)) {
+        throw std::invalid_argument("Wrong socket path " + address);
+    }
+    local->sun_family = AF_UNIX;
+    std::memcpy(local->sun_path, address.data(), address.size());
+    result.length = sizeof(sockaddr_un);
+    result.family = AF_UNIX;
+    return result;
+}
+
+static void SetNoDelay(int fd) {
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static std::string Ok(std::string_view output = {}) {
+    std::string response = "ok "s + std::to_string(output.size()) + '\n';
+    response += output;
+    return response;
+}
+
+static std::string Error(std::string_view message) {
+    std::string response = "error "s;
+    response += message;
+    response += '\n';
+    return response;
+}
+
+// The commands a sheet and its snapshot both answer
+template <typename Table>
+static std::string ExecuteRead(const Table& table, const InputData& input) {
+    std::ostringstream output;
+    switch (input.action) {
+    case Actions::GET_VALUE: {
+        const CellInterface* cell = table.GetCell(input.pos);
+        {
+            TableWriter writer(output, 64);
+            if (cell) {
+                writer.Write(cell->GetValue());
+            }
+            writer.Write('\n');
+        }
+        break;
+    }
+    case Actions::GET_SCOPE: {
+        const Size size = table.GetPrintableSize();
+        output << size.rows << ' ' << size.cols << '\n';
+        break;
+    }
+    case Actions::PRINT_VALUE:
+        table.PrintValues(output);
+        break;
+    case Actions::PRINT_TEXT:
+        table.PrintTexts(output);
+        break;
+    default:
+        throw std::invalid_argument("Wrong command");
+    }
+    return output.str();
+}
+
+static bool IsWrite(const InputData& input) {
+    return Actions::SET_CELL == input.action || Actions::CLEAR_CELL == input.action
+        || Actions::VIEW == input.action;
+}
+
+}   // namespace
+
+// SheetServer
+
+SheetServer::SheetServer(const std::string& address, size_t reader_threads) {
+    Sheet& sheet = workbook_.AddSheet(std::string(DEFAULT_SHEET));
+    Views views;
+    views.emplace(DEFAULT_SHEET, sheet.Snapshot());
+    views_ = std::make_shared<const Views>(std::move(views));
+
+    try {
+        const SocketAddress target = ParseAddress(address);
+        listen_fd_ = socket(target.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) {
+            ThrowSystemError("socket");
+        }
+        if (AF_UNIX == target.family) {
+            // a socket file left by a previous run
+            unlink(address.c_str());
+            socket_path_ = address;
+        }
+        else {
+            const int one = 1;
+            setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (0 != bind(listen_fd_, reinterpret_cast<const sockaddr*>(&target.storage), target.length)) {
+            ThrowSystemError("bind");
+        }
+        if (0 != listen(listen_fd_, SOMAXCONN)) {
+            ThrowSystemError("listen");
+        }
+
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ < 0 || wake_fd_ < 0) {
+            ThrowSystemError("epoll");
+        }
+        for (int fd : { listen_fd_, wake_fd_ }) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (0 != epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+                ThrowSystemError("epoll_ctl");
+            }
+        }
+    }
+    catch (...) {
+        CloseSockets();
+        throw;
+    }
+
+    writer_ = std::thread(&SheetServer::WriterLoop, this);
+    for (size_t i = 0; i < std::max<size_t>(reader_threads, 1); ++i) {
+        readers_.emplace_back(&SheetServer::ReaderLoop, this);
+    }
+}
+
+SheetServer::~SheetServer() {
+    {
+        std::scoped_lock lock(writer_mutex_, reader_mutex_);
+        stop_workers_ = true;
+    }
+    writer_wake_.notify_all();
+    reader_wake_.notify_all();
+    writer_.join();
+    for (auto& reader : readers_) {
+        reader.join();
+    }
+
+    for (const auto& [fd, connection] : connections_) {
+        close(fd);
+    }
+    CloseSockets();
+}
+
+void SheetServer::Run() {
+    std::array<epoll_event, 64> events;
+    while (!stopping_.load()) {
+        const int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            ThrowSystemError("epoll_wait");
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const int fd = events[i].data.fd;
+            if (listen_fd_ == fd) {
+                Accept();
+                continue;
+            }
+            if (wake_fd_ == fd) {
+                uint64_t value;
+                [[maybe_unused]] const auto size = read(wake_fd_, &value, sizeof(value));
+                DeliverCompletions();
+                continue;
+            }
+
+            const auto it = connections_.find(fd);
+            if (connections_.end() == it) {
+                continue;
+            }
+            // the peer is gone, its answers have nowhere to go
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                Close(fd);
+                continue;
+            }
+            Connection& connection = it->second;
+            if ((events[i].events & EPOLLIN) && !ReadInput(connection, fd)) {
+                Close(fd);
+                continue;
+            }
+            Serve(connection, fd);
+        }
+    }
+}
+
+void SheetServer::Stop() {
+    stopping_.store(true);
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto size = write(wake_fd_, &one, sizeof(one));
+}
+
+// private
+
+void SheetServer::CloseSockets() {
+    for (int fd : { listen_fd_, epoll_fd_, wake_fd_ }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (!socket_path_.empty()) {
+        unlink(socket_path_.c_str());
+    }
+}
+
+void SheetServer::Accept() {
+    while (true) {
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            // EAGAIN once the backlog is empty, the other errors leave the
+            // connection in the backlog until the next wake up
+            return;
+        }
+        if (socket_path_.empty()) {
+            SetNoDelay(fd);
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (0 != epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+            close(fd);
+            continue;
+        }
+        Connection& connection = connections_[fd];
+        connection.id = next_connection_++;
+        connection.sheet = DEFAULT_SHEET;
+        connection.events = EPOLLIN;
+    }
+}
+
+bool SheetServer::CanRead(const Connection& connection) {
+    return !connection.closed_input && connection.pending.size() < MAX_PIPELINE
+        && connection.output.size() < MAX_OUTPUT;
+}
+
+bool SheetServer::ReadInput(Connection& connection, int fd) {
+    std::array<char, READ_SIZE> buffer;
+    while (CanRead(connection)) {
+        const ssize_t size = recv(fd, buffer.data(), buffer.size(), 0);
+        if (size > 0) {
+            connection.input.append(buffer.data(), size);
+            ProcessInput(connection, fd);
+            if (connection.input.size() > MAX_REQUEST_SIZE) {
+                return false;
+            }
+            continue;
+        }
+        if (0 == size) {
+            // the client sent everything, the last line may lack its end
+            connection.closed_input = true;
+            if (!connection.input.empty() && '\n' != connection.input.back()) {
+                connection.input += '\n';
+            }
+            ProcessInput(connection, fd);
+            return true;
+        }
+        if (EINTR == errno) {
+            continue;
+        }
+        return EAGAIN == errno || EWOULDBLOCK == errno;
+    }
+    return true;
+}
+
+void SheetServer::ProcessInput(Connection& connection, int fd) {
+    size_t begin = 0;
+    while (connection.pending.size() < MAX_PIPELINE) {
+        const size_t end = connection.input.find('\n', begin);
+        if (std::string::npos == end) {
+            break;
+        }
+        std::string_view line(connection.input.data() + begin, end - begin);
+        if (!line.empty() && '\r' == line.back()) {
+            line.remove_suffix(1);
+        }
+        begin = end + 1;
+        Dispatch(connection, fd, line);
+    }
+    connection.input.erase(0, begin);
+}
+
+void SheetServer::Dispatch(Connection& connection, int fd, std::string_view line) {
+    Request request{ fd, connection.id, connection.first_sequence + connection.pending.size(),
+        connection.sheet, {}, false };
+    connection.pending.emplace_back();
+
+    if (line.substr(0, 6) == "sheet "sv) {
+        line.remove_prefix(6);
+        const auto begin = line.find_first_not_of(' ');
+        const auto end = line.find_last_not_of(' ');
+        request.sheet = std::string::npos == begin ? ""s : std::string(line.substr(begin, end - begin + 1));
+        request.select_sheet = true;
+        connection.sheet = request.sheet;
+    }
+    else {
+        request.input = InputReader::Parse(line);
+        if (Actions::BAD_ACTION == request.input.action || Actions::EXIT == request.input.action) {
+            connection.pending.back() = Error("Wrong command");
+            return;
+        }
+    }
+
+    // a read waits for the edits of its connection, the writer runs it after them
+    if (request.select_sheet || IsWrite(request.input) || connection.writer_commands > 0) {
+        ++connection.writer_commands;
+        {
+            std::lock_guard lock(writer_mutex_);
+            writer_queue_.push_back(std::move(request));
+        }
+        writer_wake_.notify_one();
+    }
+    else {
+        {
+            std::lock_guard lock(reader_mutex_);
+            reader_queue_.push_back(std::move(request));
+        }
+        reader_wake_.notify_one();
+    }
+}
+
+void SheetServer::Serve(Connection& connection, int fd) {
+    FlushAnswers(connection);
+    ProcessInput(connection, fd);
+    FlushAnswers(connection);
+    if (!SendOutput(connection, fd)) {
+        Close(fd);
+        return;
+    }
+    if (connection.closed_input && connection.pending.empty() && connection.output.empty()
+        && connection.input.empty()) {
+        Close(fd);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (CanRead(connection)) {
+        events |= EPOLLIN;
+    }
+    if (!connection.output.empty()) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+        connection.events = events;
+    }
+}
+
+void SheetServer::FlushAnswers(Connection& connection) {
+    while (!connection.pending.empty() && connection.pending.front()) {
+        connection.output += *connection.pending.front();
+        connection.pending.pop_front();
+        ++connection.first_sequence;
+    }
+}
+
+bool SheetServer::SendOutput(Connection& connection, int fd) {
+    size_t sent = 0;
+    while (sent < connection.output.size()) {
+        const ssize_t size = send(fd, connection.output.data() + sent,
+            connection.output.size() - sent, MSG_NOSIGNAL);
+        if (size >= 0) {
+            sent += size;
+            continue;
+        }
+        if (EINTR == errno) {
+            continue;
+        }
+        if (EAGAIN != errno && EWOULDBLOCK != errno) {
+            return false;
+        }
+        break;
+    }
+    connection.output.erase(0, sent);
+    return true;
+}
+
+void SheetServer::Close(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections_.erase(fd);
+}
+
+// Answers of a closed connection are dropped, a new connection on the same
+// descriptor has another id
+void SheetServer::DeliverCompletions() {
+    std::vector<Completion> completions;
+    {
+        std::lock_guard lock(completions_mutex_);
+        completions.swap(completions_);
+    }
+
+    std::vector<int> served;
+    for (Completion& completion : completions) {
+        const auto it = connections_.find(completion.fd);
+        if (connections_.end() == it || completion.connection != it->second.id) {
+            continue;
+        }
+        Connection& connection = it->second;
+        connection.pending[completion.sequence - connection.first_sequence] = std::move(completion.response);
+        if (completion.from_writer) {
+            --connection.writer_commands;
+        }
+        served.push_back(completion.fd);
+    }
+
+    std::sort(served.begin(), served.end());
+    served.erase(std::unique(served.begin(), served.end()), served.end());
+    for (int fd : served) {
+        Serve(connections_.at(fd), fd);
+    }
+}
+
+void SheetServer::Complete(std::vector<Completion> completions) {
+    {
+        std::lock_guard lock(completions_mutex_);
+        if (completions_.empty()) {
+            completions_ = std::move(completions);
+        }
+        else {
+            std::move(completions.begin(), completions.end(), std::back_inserter(completions_));
+        }
+    }
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto size = write(wake_fd_, &one, sizeof(one));
+}
+
+// Takes all the queued commands at once, so the snapshots are published
+// once per round instead of once per edit
+void SheetServer::WriterLoop() {
+    while (true) {
+        std::deque<Request> requests;
+        {
+            std::unique_lock lock(writer_mutex_);
+            writer_wake_.wait(lock, [this] {
+                return stop_workers_ || !writer_queue_.empty();
+            });
+            if (stop_workers_) {
+                return;
+            }
+            requests.swap(writer_queue_);
+        }
+
+        std::vector<Completion> completions;
+        completions.reserve(requests.size());
+        bool changed = false;
+        for (const Request& request : requests) {
+            completions.push_back({ request.fd, request.connection, request.sequence, true,
+                ExecuteOnSheet(request, changed) });
+        }
+
+        // an edit may change the values of other sheets, all of them are published
+        if (changed) {
+            auto views = std::make_shared<Views>();
+            for (const std::string& name : workbook_.GetSheetNames()) {
+                views->emplace(name, workbook_.GetSheet(name)->Snapshot());
+            }
+            std::lock_guard lock(views_mutex_);
+            views_ = std::move(views);
+        }
+        // the edits are answered once the readers can see them
+        Complete(std::move(completions));
+    }
+}
+
+void SheetServer::ReaderLoop() {
+    while (true) {
+        std::vector<Request> requests;
+        {
+            std::unique_lock lock(reader_mutex_);
+            reader_wake_.wait(lock, [this] {
+                return stop_workers_ || !reader_queue_.empty();
+            });
+            if (stop_workers_) {
+                return;
+            }
+            const size_t count = std::min(reader_queue_.size(), READER_BATCH);
+            std::move(reader_queue_.begin(), reader_queue_.begin() + count, std::back_inserter(requests));
+            reader_queue_.erase(reader_queue_.begin(), reader_queue_.begin() + count);
+        }
+
+        std::shared_ptr<const Views> views;
+        {
+            std::lock_guard lock(views_mutex_);
+            views = views_;
+        }
+        std::vector<Completion> completions;
+        completions.reserve(requests.size());
+        for (const Request& request : requests) {
+            completions.push_back({ request.fd, request.connection, request.sequence, false,
+                ExecuteOnView(*views, request) });
+        }
+        Complete(std::move(completions));
+    }
+}
+
+std::string SheetServer::ExecuteOnSheet(const Request& request, bool& changed) {
+    try {
+        if (request.select_sheet) {
+            if (!workbook_.GetSheet(request.sheet)) {
+                workbook_.AddSheet(request.sheet);
+                changed = true;
+            }
+            return Ok();
+        }
+
+        Sheet* sheet = workbook_.GetSheet(request.sheet);
+        if (!sheet) {
+            return Error("Unknown sheet " + request.sheet);
+        }
+        const InputData& input = request.input;
+        switch (input.action) {
+        case Actions::SET_CELL:
+            sheet->SetCell(input.pos, input.data);
+            changed = true;
+            return Ok();
+        case Actions::CLEAR_CELL:
+            sheet->ClearCell(input.pos);
+            changed = true;
+            return Ok();
+        case Actions::VIEW: {
+            std::ostringstream output;
+            sheet->DrawSheet(output, false, input.window);
+            return Ok(output.str());
+        }
+        default:
+            return Ok(ExecuteRead(*sheet, input));
+        }
+    }
+    catch (const std::exception& e) {
+        return Error(e.what());
+    }
+}
+
+std::string SheetServer::ExecuteOnView(const Views& views, const Request& request) const {
+    const auto it = views.find(request.sheet);
+    if (views.end() == it) {
+        return Error("Unknown sheet " + request.sheet);
+    }
+    try {
+        return Ok(ExecuteRead(it->second, request.input));
+    }
+    catch (const std::exception& e) {
+        return Error(e.what());
+    }
+}
+
+// SheetClient
+
+SheetClient::SheetClient(const std::string& address)
+    : fd_(ConnectToServer(address))
+{}
+
+SheetClient::~SheetClient() {
+    close(fd_);
+}
+
+void SheetClient::Send(std::string_view commands) {
+    while (!commands.empty()) {
+        const ssize_t size = send(fd_, commands.data(), commands.size(), MSG_NOSIGNAL);
+        if (size < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            ThrowSystemError("send");
+        }
+        commands.remove_prefix(size);
+    }
+}
+
+SheetClient::Response SheetClient::Receive() {
+    if (begin_ == buffer_.size()) {
+        buffer_.clear();
+        begin_ = 0;
+    }
+    else if (begin_ >= READ_SIZE) {
+        buffer_.erase(0, begin_);
+        begin_ = 0;
+    }
+
+    size_t end;
+    while (std::string::npos == (end = buffer_.find('\n', begin_))) {
+        Fill();
+    }
+    const std::string_view header(buffer_.data() + begin_, end - begin_);
+    if (header.substr(0, 6) == "error "sv) {
+        Response response{ false, std::string(header.substr(6)) };
+        begin_ = end + 1;
+        return response;
+    }
+    if (header.substr(0, 3) != "ok "sv) {
+        throw std::runtime_error("Wrong answer of the server");
+    }
+    const size_t length = std::stoul(std::string(header.substr(3)));
+    while (buffer_.size() - (end + 1) < length) {
+        Fill();
+    }
+    Response response{ true, buffer_.substr(end + 1, length) };
+    begin_ = end + 1 + length;
+    return response;
+}
+
+// private
+
+void SheetClient::Fill() {
+    std::array<char, READ_SIZE> buffer;
+    while (true) {
+        const ssize_t size = recv(fd_, buffer.data(), buffer.size(), 0);
+        if (size > 0) {
+            buffer_.append(buffer.data(), size);
+            return;
+        }
+        if (0 == size) {
+            throw std::runtime_error("The server closed the connection");
+        }
+        if (EINTR != errno) {
+            ThrowSystemError("recv");
+        }
+    }
+}
+
+int ConnectToServer(const std::string& address) {
+    const SocketAddress target = ParseAddress(address);
+    const int fd = socket(target.family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ThrowSystemError("socket");
+    }
+    if (0 != connect(fd, reinterpret_cast<const sockaddr*>(&target.storage), target.length)) {
+        const int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "connect");
+    }
+    if (AF_INET == target.family) {
+        SetNoDelay(fd);
+    }
+    return fd;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "sheet_view.h"
+#include "user_interface.h"
+#include "workbook.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+
+// Serves the commands of the console interface to many clients over a Unix
+// socket or a localhost TCP port, one command per line. Clients may send
+// commands without waiting for the answers, the answers come in the order
+// of the commands:
+//     ok <length>\n<output of that length>
+//     error <message>\n
+// Besides the console commands there are "get A1", the value of one cell,
+// and "sheet Name", which switches the connection to another sheet of the
+// shared workbook and adds it if there is none. Connections start on Sheet1.
+//
+// One thread runs the epoll loop and does all the socket I/O. Edits and the
+// commands which need the live sheets go to the only writer thread, which
+// publishes new snapshots of the sheets before answering an edit. Reads are
+// answered from the latest snapshots by a pool of reader threads, unless an
+// edit of the same connection is still in flight.
+class SheetServer {
+public:
+    // The address is a path of a Unix socket or a TCP port on 127.0.0.1.
+    // Throws std::system_error if the socket cannot be opened.
+    explicit SheetServer(const std::string& address,
+        size_t reader_threads = std::thread::hardware_concurrency());
+    SheetServer(const SheetServer&) = delete;
+    SheetServer& operator=(const SheetServer&) = delete;
+    ~SheetServer();
+
+    // Serves the clients until Stop() is called from another thread
+    void Run();
+    void Stop();
+
+private:
+    struct Request {
+        int fd;
+        uint64_t connection;
+        uint64_t sequence;
+        std::string sheet;
+        InputData input;
+        // "sheet Name", the writer adds the sheet if there is none
+        bool select_sheet;
+    };
+
+    struct Completion {
+        int fd;
+        uint64_t connection;
+        uint64_t sequence;
+        bool from_writer;
+        std::string response;
+    };
+
+    struct Connection {
+        uint64_t id;
+        std::string sheet;
+        std::string input;
+        std::string output;
+        // answers of the commands in flight from first_sequence on
+        std::deque<std::optional<std::string>> pending;
+        uint64_t first_sequence = 0;
+        // commands sent to the writer and not answered yet
+        size_t writer_commands = 0;
+        // the client has sent everything, the connection closes once answered
+        bool closed_input = false;
+        uint32_t events = 0;
+    };
+
+    // Snapshots of all the sheets taken by the writer
+    using Views = std::unordered_map<std::string, SheetView>;
+
+    void CloseSockets();
+    void Accept();
+    static bool CanRead(const Connection& connection);
+    // Returns false if the connection fails
+    bool ReadInput(Connection& connection, int fd);
+    // Sends the complete lines of the input to the workers while the
+    // pipeline has room
+    void ProcessInput(Connection& connection, int fd);
+    void Dispatch(Connection& connection, int fd, std::string_view line);
+    // Sends the answers in order, takes more commands and chooses the
+    // events to wait for. Closes the connection once it is done.
+    void Serve(Connection& connection, int fd);
+    void FlushAnswers(Connection& connection);
+    bool SendOutput(Connection& connection, int fd);
+    void Close(int fd);
+    void DeliverCompletions();
+
+    // Passes the answers of a worker to the loop
+    void Complete(std::vector<Completion> completions);
+    void WriterLoop();
+    void ReaderLoop();
+    // Runs a command on the live sheets, only on the writer thread
+    std::string ExecuteOnSheet(const Request& request, bool& changed);
+    std::string ExecuteOnView(const Views& views, const Request& request) const;
+
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    // wakes the loop for completions and for Stop()
+    int wake_fd_ = -1;
+    std::string socket_path_;
+
+    std::unordered_map<int, Connection> connections_;
+    uint64_t next_connection_ = 0;
+    std::atomic<bool> stopping_{ false };
+
+    Workbook workbook_;
+
+    std::mutex views_mutex_;
+    std::shared_ptr<const Views> views_;
+
+    std::mutex writer_mutex_;
+    std::condition_variable writer_wake_;
+    std::deque<Request> writer_queue_;
+
+    std::mutex reader_mutex_;
+    std::condition_variable reader_wake_;
+    std::deque<Request> reader_queue_;
+
+    std::mutex completions_mutex_;
+    std::vector<Completion> completions_;
+
+    bool stop_workers_ = false;
+    std::thread writer_;
+    std::vector<std::thread> readers_;
+};
+
+// Blocking connection to a SheetServer, used by the load generator and tests
+class SheetClient {
+public:
+    struct Response {
+        bool ok;
+        // the output of the command or the error message
+        std::string text;
+    };
+
+    // Throws std::system_error if the server is not there
+    explicit SheetClient(const std::string& address);
+    SheetClient(const SheetClient&) = delete;
+    SheetClient& operator=(const SheetClient&) = delete;
+    ~SheetClient();
+
+    // Sends the commands as they are, several lines may go at once
+    void Send(std::string_view commands);
+    // Waits for the next answer, throws std::runtime_error if the server
+    // closes the connection
+    Response Receive();
+
+private:
+    // Reads more data into the buffer
+    void Fill();
+
+    int fd_ = -1;
+    std::string buffer_;
+    size_t begin_ = 0;
+};
+
+// Opens a socket connected to the address in the format of SheetServer
+int ConnectToServer(const std::string& address);
+
+#endif
\ No newline at end of file
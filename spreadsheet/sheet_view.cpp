@@ -0,0 +1,278 @@
+#include "sheet_view.h"
+
+#include "table_export.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+template <typename Child, int SIDE_LOG>
+struct GridNode {
+    static constexpr int SIDE = 1 << SIDE_LOG;
+
+    uint32_t refs = 1;
+    uint64_t stamp = 0;
+    std::array<Child*, SIDE * SIDE> children{};
+};
+
+}   // namespace
+
+struct VersionStore::Record final : public CellInterface {
+    Value GetValue() const override {
+        return value;
+    }
+    std::string GetText() const override {
+        return text;
+    }
+    std::vector<Position> GetReferencedCells() const override {
+        return referenced;
+    }
+
+    uint32_t refs = 1;
+    std::string text;
+    Value value;
+    std::vector<Position> referenced;
+};
+
+struct VersionStore::Leaf : GridNode<Record, 4> {
+    static int Index(Position pos) {
+        return (pos.row & (SIDE - 1)) << 4 | (pos.col & (SIDE - 1));
+    }
+};
+
+struct VersionStore::Middle : GridNode<Leaf, 5> {
+    static int Index(Position pos) {
+        return (pos.row >> 4 & (SIDE - 1)) << 5 | (pos.col >> 4 & (SIDE - 1));
+    }
+};
+
+struct VersionStore::Root : GridNode<Middle, 5> {
+    static int Index(Position pos) {
+        return (pos.row >> 9) << 5 | pos.col >> 9;
+    }
+};
+
+struct SheetView::Version {
+    // views of the version, the writer frees a retired version without any
+    std::atomic<uint32_t> readers{ 0 };
+    VersionStore::Root* root = nullptr;
+    Size size;
+    uint64_t number = 0;
+};
+
+// SheetView
+
+SheetView::SheetView(const SheetView& other)
+    : SheetView(other.store_, other.version_)
+{}
+
+SheetView& SheetView::operator=(const SheetView& other) {
+    SheetView copy(other);
+    std::swap(store_, copy.store_);
+    std::swap(version_, copy.version_);
+    return *this;
+}
+
+SheetView::~SheetView() {
+    // pairs with the acquire of the writer freeing the version
+    version_->readers.fetch_sub(1, std::memory_order_release);
+}
+
+const CellInterface* SheetView::GetCell(Position pos) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Wrong position");
+    }
+    if (pos.row >= version_->size.rows || pos.col >= version_->size.cols) {
+        return nullptr;
+    }
+    return VersionStore::Find(version_->root, pos);
+}
+
+Size SheetView::GetPrintableSize() const {
+    return version_->size;
+}
+
+void SheetView::PrintValues(std::ostream& output) const {
+    PrintCells(output, false);
+}
+
+void SheetView::PrintTexts(std::ostream& output) const {
+    PrintCells(output, true);
+}
+
+uint64_t SheetView::GetVersion() const {
+    return version_->number;
+}
+
+// private
+
+SheetView::SheetView(std::shared_ptr<VersionStore> store, Version* version)
+    : store_(std::move(store))
+    , version_(version) {
+    version_->readers.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The same layout as Sheet::PrintValues() and Sheet::PrintTexts()
+void SheetView::PrintCells(std::ostream& output, bool is_text) const {
+    const Size size = version_->size;
+    {
+        TableWriter writer(output);
+        for (int row = 0; row < size.rows; ++row) {
+            for (int col = 0; col < size.cols; ++col) {
+                if (0 != col) {
+                    writer.Write('\t');
+                }
+                if (const auto* record = VersionStore::Find(version_->root, { row, col })) {
+                    if (is_text) {
+                        writer.Write(std::string_view(record->text));
+                    }
+                    else {
+                        writer.Write(record->value);
+                    }
+                }
+            }
+            writer.Write('\n');
+        }
+    }
+    output.flush();
+}
+
+// VersionStore
+
+VersionStore::~VersionStore() {
+    for (SheetView::Version* version : versions_) {
+        Release(version->root);
+        delete version;
+    }
+    Release(next_);
+}
+
+void VersionStore::Set(Position pos, const CellInterface* cell) {
+    if (!next_) {
+        if (!cell) {
+            return;
+        }
+        next_ = MakeNode<Root>();
+    }
+    next_ = MakeExclusive(next_);
+
+    Middle*& middle = next_->children[Root::Index(pos)];
+    if (!middle) {
+        if (!cell) {
+            return;
+        }
+        middle = MakeNode<Middle>();
+    }
+    middle = MakeExclusive(middle);
+
+    Leaf*& leaf = middle->children[Middle::Index(pos)];
+    if (!leaf) {
+        if (!cell) {
+            return;
+        }
+        leaf = MakeNode<Leaf>();
+    }
+    leaf = MakeExclusive(leaf);
+
+    Record*& record = leaf->children[Leaf::Index(pos)];
+    Release(record);
+    record = nullptr;
+    if (cell) {
+        record = new Record;
+        record->text = cell->GetText();
+        record->value = cell->GetValue();
+        record->referenced = cell->GetReferencedCells();
+    }
+}
+
+SheetView VersionStore::Publish(Size size) {
+    auto* version = new SheetView::Version;
+    version->root = next_;
+    if (next_) {
+        ++next_->refs;
+    }
+    version->size = size;
+    version->number = ++published_;
+    versions_.push_back(version);
+
+    // the next version copies whatever it changes from now on
+    ++stamp_;
+    Collect();
+    return SheetView(shared_from_this(), version);
+}
+
+size_t VersionStore::GetVersionCount() const {
+    return versions_.size();
+}
+
+// private
+
+const VersionStore::Record* VersionStore::Find(const Root* root, Position pos) {
+    if (!root) {
+        return nullptr;
+    }
+    const Middle* middle = root->children[Root::Index(pos)];
+    if (!middle) {
+        return nullptr;
+    }
+    const Leaf* leaf = middle->children[Middle::Index(pos)];
+    return leaf ? leaf->children[Leaf::Index(pos)] : nullptr;
+}
+
+template <typename Node>
+Node* VersionStore::MakeNode() const {
+    Node* node = new Node;
+    node->stamp = stamp_;
+    return node;
+}
+
+// A node shared with a published version is replaced by a copy holding
+// references to the same children
+template <typename Node>
+Node* VersionStore::MakeExclusive(Node* node) {
+    if (stamp_ == node->stamp) {
+        return node;
+    }
+    Node* copy = new Node(*node);
+    copy->refs = 1;
+    copy->stamp = stamp_;
+    for (auto* child : copy->children) {
+        if (child) {
+            ++child->refs;
+        }
+    }
+    Release(node);
+    return copy;
+}
+
+template <typename Node>
+void VersionStore::Release(Node* node) {
+    if (!node || 0 != --node->refs) {
+        return;
+    }
+    if constexpr (!std::is_same_v<Node, Record>) {
+        for (auto* child : node->children) {
+            Release(child);
+        }
+    }
+    delete node;
+}
+
+// The newest version stays for the next snapshot to share its nodes
+void VersionStore::Collect() {
+    const auto newest = std::prev(versions_.end());
+    const auto end = std::remove_if(versions_.begin(), newest, [](SheetView::Version* version) {
+        if (0 != version->readers.load(std::memory_order_acquire)) {
+            return false;
+        }
+        Release(version->root);
+        delete version;
+        return true;
+    });
+    versions_.erase(end, newest);
+}
\ No newline at end of file
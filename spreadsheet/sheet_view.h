@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+class VersionStore;
+
+// Immutable version of a sheet taken by Sheet::Snapshot(). Any number of
+// threads may read and print it without locks while the sheet goes on
+// changing, the version stays alive while a view refers to it.
+class SheetView {
+public:
+    SheetView(const SheetView& other);
+    SheetView& operator=(const SheetView& other);
+    ~SheetView();
+
+    // nullptr for an empty position, throws InvalidPositionException for
+    // an invalid one
+    const CellInterface* GetCell(Position pos) const;
+    Size GetPrintableSize() const;
+
+    void PrintValues(std::ostream& output) const;
+    void PrintTexts(std::ostream& output) const;
+
+    // Versions of a sheet are numbered from 1 in the order of the snapshots
+    uint64_t GetVersion() const;
+
+private:
+    friend class VersionStore;
+    struct Version;
+
+    SheetView(std::shared_ptr<VersionStore> store, Version* version);
+
+    void PrintCells(std::ostream& output, bool is_text) const;
+
+    std::shared_ptr<VersionStore> store_;
+    Version* version_;
+};
+
+// Versions of the cells of a sheet, a persistent grid of 16x16 leaves under
+// two levels of 32x32 nodes. The writer changes the next version in place
+// and copies a node it shares with the published versions on first change.
+// Only the writer touches the reference counts of the nodes: a published
+// version is retired by the next one and freed by the writer once no view
+// refers to it, views just count themselves.
+class VersionStore : public std::enable_shared_from_this<VersionStore> {
+public:
+    VersionStore() = default;
+    VersionStore(const VersionStore&) = delete;
+    VersionStore& operator=(const VersionStore&) = delete;
+    ~VersionStore();
+
+    // The text and the value of the cell go to the next version, the value
+    // has to be evaluated. nullptr erases the cell.
+    void Set(Position pos, const CellInterface* cell);
+    // Freezes the next version and frees the retired ones nobody reads
+    SheetView Publish(Size size);
+
+    // Published versions which are not freed yet
+    size_t GetVersionCount() const;
+
+private:
+    friend class SheetView;
+
+    struct Record;
+    struct Leaf;
+    struct Middle;
+    struct Root;
+
+    static const Record* Find(const Root* root, Position pos);
+
+    template <typename Node>
+    Node* MakeNode() const;
+    template <typename Node>
+    Node* MakeExclusive(Node* node);
+    template <typename Node>
+    static void Release(Node* node);
+    void Collect();
+
+    Root* next_ = nullptr;
+    // nodes made since the last publication carry the stamp, the others are shared
+    uint64_t stamp_ = 1;
+    uint64_t published_ = 0;
+    std::vector<SheetView::Version*> versions_;
+};
\ No newline at end of file
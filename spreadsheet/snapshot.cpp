@@ -0,0 +1,416 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <variant>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace snapshot;
+
+namespace {
+
+struct Layout {
+    size_t positions;
+    size_t order;
+    size_t texts;
+    size_t formulas;
+    size_t records;
+    size_t program;
+    size_t references;
+    size_t text_offsets;
+    size_t chars;
+    size_t end;
+};
+
+static size_t AlignUp(size_t offset) {
+    return (offset + 7) / 8 * 8;
+}
+
+// Offsets of the sections follow from the counts in the header
+static Layout ComputeLayout(const Header& header) {
+    Layout layout{};
+    size_t offset = AlignUp(sizeof(Header));
+    const auto next = [&offset](size_t bytes) {
+        const size_t begin = offset;
+        offset = AlignUp(offset + bytes);
+        return begin;
+    };
+
+    layout.positions = next(sizeof(Position) * header.cell_count);
+    layout.order = next(sizeof(uint32_t) * header.cell_count);
+    layout.texts = next(sizeof(uint32_t) * header.cell_count);
+    layout.formulas = next(sizeof(uint32_t) * header.cell_count);
+    layout.records = next(sizeof(FormulaRecord) * header.formula_count);
+    layout.program = next(sizeof(ASTImpl::Instruction) * header.instruction_count);
+    layout.references = next(sizeof(Position) * header.reference_count);
+    layout.text_offsets = next(sizeof(uint32_t) * (header.text_count + size_t{ 1 }));
+    layout.chars = next(header.char_count);
+    layout.end = offset;
+    return layout;
+}
+
+static void WriteSection(std::ostream& out, const void* data, size_t bytes) {
+    static const char padding[8]{};
+    out.write(static_cast<const char*>(data), bytes);
+    out.write(padding, AlignUp(bytes) - bytes);
+}
+
+template <typename T>
+static void WriteSection(std::ostream& out, const std::vector<T>& data) {
+    WriteSection(out, data.data(), sizeof(T) * data.size());
+}
+
+static bool IsFormulaText(const std::string& text) {
+    return text.size() > 1 && FORMULA_SIGN == text.front();
+}
+
+}   // namespace
+
+// MappedFile
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == file_) {
+        throw SnapshotException("Cannot open " + path);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) {
+        CloseHandle(file_);
+        throw SnapshotException("Cannot read the size of " + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (0 == size_) {
+        return;
+    }
+
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_) {
+        data_ = static_cast<const std::byte*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!data_) {
+        if (mapping_) {
+            CloseHandle(mapping_);
+        }
+        CloseHandle(file_);
+        throw SnapshotException("Cannot map " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+    }
+    CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw SnapshotException("Cannot open " + path);
+    }
+
+    struct stat info;
+    if (0 != fstat(fd, &info)) {
+        close(fd);
+        throw SnapshotException("Cannot read the size of " + path);
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if (0 == size_) {
+        close(fd);
+        return;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data) {
+        throw SnapshotException("Cannot map " + path);
+    }
+    data_ = static_cast<const std::byte*>(data);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(const_cast<std::byte*>(data_), size_);
+    }
+}
+
+#endif
+
+const std::byte* MappedFile::Data() const {
+    return data_;
+}
+
+size_t MappedFile::Size() const {
+    return size_;
+}
+
+// Writer
+
+Writer::Writer(Size size)
+    : size_(size)
+{}
+
+void Writer::AddCell(Position pos, const CellInterface& cell, std::vector<Rect> ranges) {
+    entries_.push_back({ pos, &cell, std::move(ranges) });
+}
+
+void Writer::Write(const std::string& path) {
+    std::sort(entries_.begin(), entries_.end(),
+        [](const Entry& lhs, const Entry& rhs) {
+            return lhs.pos < rhs.pos;
+        });
+
+    std::vector<Position> positions;
+    positions.reserve(entries_.size());
+    for (const auto& entry : entries_) {
+        positions.push_back(entry.pos);
+    }
+
+    std::vector<uint32_t> order = SortTopologically();
+    std::vector<uint32_t> texts(entries_.size());
+    std::vector<uint32_t> formulas(entries_.size(), NO_FORMULA);
+    std::vector<FormulaRecord> records;
+    std::vector<ASTImpl::Instruction> program;
+    std::vector<Position> references;
+
+    // dependencies go first, so evaluating a formula never recurses deeply
+    for (const uint32_t index : order) {
+        const CellInterface& cell = *entries_[index].cell;
+        const std::string text = cell.GetText();
+        if (!IsFormulaText(text)) {
+            texts[index] = InternText(text);
+            continue;
+        }
+
+        const std::string_view expression = std::string_view(text).substr(1);
+        texts[index] = InternText(expression);
+        formulas[index] = static_cast<uint32_t>(records.size());
+
+        // the cell only exposes its expression, compile it once more here
+        const FormulaAST ast = ParseFormulaAST(std::string(expression));
+        FormulaRecord record{};
+        record.program_begin = static_cast<uint32_t>(program.size());
+        record.program_size = static_cast<uint32_t>(ast.GetProgram().size());
+        record.references_begin = static_cast<uint32_t>(references.size());
+        record.references_size = static_cast<uint32_t>(ast.GetCells().size());
+        record.stack_size = static_cast<uint32_t>(ast.GetStackSize());
+        program.insert(program.end(), ast.GetProgram().begin(), ast.GetProgram().end());
+        references.insert(references.end(), ast.GetCells().begin(), ast.GetCells().end());
+
+        const auto value = cell.GetValue();
+        if (const double* number = std::get_if<double>(&value)) {
+            record.value_type = NUMBER_VALUE;
+            record.value = *number;
+        }
+        else {
+            record.value_type = static_cast<uint32_t>(std::get<FormulaError>(value).GetCategory());
+        }
+        records.push_back(record);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.instruction_size = sizeof(ASTImpl::Instruction);
+    header.rows = size_.rows;
+    header.cols = size_.cols;
+    header.cell_count = static_cast<uint32_t>(entries_.size());
+    header.formula_count = static_cast<uint32_t>(records.size());
+    header.text_count = static_cast<uint32_t>(text_offsets_.size() - 1);
+    header.instruction_count = program.size();
+    header.reference_count = references.size();
+    header.char_count = chars_.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw SnapshotException("Cannot open " + path + " for writing");
+    }
+    WriteSection(out, &header, sizeof(header));
+    WriteSection(out, positions);
+    WriteSection(out, order);
+    WriteSection(out, texts);
+    WriteSection(out, formulas);
+    WriteSection(out, records);
+    WriteSection(out, program);
+    WriteSection(out, references);
+    WriteSection(out, text_offsets_);
+    WriteSection(out, chars_.data(), chars_.size());
+    if (!out.flush()) {
+        throw SnapshotException("Cannot write " + path);
+    }
+}
+
+uint32_t Writer::InternText(std::string_view text) {
+    const auto [it, inserted] = text_ids_.emplace(text, static_cast<uint32_t>(text_ids_.size()));
+    if (inserted) {
+        chars_.append(text);
+        text_offsets_.push_back(static_cast<uint32_t>(chars_.size()));
+    }
+    return it->second;
+}
+
+// Kahn's algorithm over the references, entries_ have to be sorted
+std::vector<uint32_t> Writer::SortTopologically() const {
+    constexpr uint32_t NOT_FOUND = UINT32_MAX;
+    const auto find = [this](Position pos) {
+        const auto it = std::lower_bound(entries_.begin(), entries_.end(), pos,
+            [](const Entry& entry, Position pos) {
+                return entry.pos < pos;
+            });
+        return entries_.end() != it && it->pos == pos
+            ? static_cast<uint32_t>(it - entries_.begin())
+            : NOT_FOUND;
+    };
+
+    // dependants of every entry in compressed rows
+    std::vector<uint32_t> waiting(entries_.size(), 0);
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        for (const Position pos : entries_[i].cell->GetReferencedCells()) {
+            const uint32_t dep = find(pos);
+            if (NOT_FOUND != dep) {
+                edges.emplace_back(dep, i);
+                ++waiting[i];
+            }
+        }
+        // entries go column by column, so a range is a run of entries per column
+        for (const Rect& range : entries_[i].ranges) {
+            for (int col = range.top_left.col; col <= range.bottom_right.col; ++col) {
+                auto it = std::lower_bound(entries_.begin(), entries_.end(),
+                    Position{ range.top_left.row, col },
+                    [](const Entry& entry, Position pos) {
+                        return entry.pos < pos;
+                    });
+                for (; entries_.end() != it && col == it->pos.col
+                    && it->pos.row <= range.bottom_right.row; ++it) {
+                    edges.emplace_back(static_cast<uint32_t>(it - entries_.begin()), i);
+                    ++waiting[i];
+                }
+            }
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<uint32_t> order;
+    order.reserve(entries_.size());
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        if (0 == waiting[i]) {
+            order.push_back(i);
+        }
+    }
+    for (size_t next = 0; next < order.size(); ++next) {
+        const uint32_t index = order[next];
+        auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(index, uint32_t{ 0 }));
+        for (; edges.end() != it && it->first == index; ++it) {
+            if (0 == --waiting[it->second]) {
+                order.push_back(it->second);
+            }
+        }
+    }
+    return order;
+}
+
+// SheetSnapshot
+
+SheetSnapshot::SheetSnapshot(const std::string& path)
+    : file_(path) {
+    if (file_.Size() < sizeof(Header)) {
+        throw SnapshotException(path + " is not a sheet snapshot");
+    }
+    std::memcpy(&header_, file_.Data(), sizeof(Header));
+    if (0 != std::memcmp(header_.magic, MAGIC, sizeof(MAGIC))) {
+        throw SnapshotException(path + " is not a sheet snapshot");
+    }
+    if (VERSION != header_.version || sizeof(ASTImpl::Instruction) != header_.instruction_size) {
+        throw SnapshotException(path + " was written by an incompatible version");
+    }
+
+    const Layout layout = ComputeLayout(header_);
+    if (layout.end > file_.Size()) {
+        throw SnapshotException(path + " is truncated");
+    }
+
+    const std::byte* data = file_.Data();
+    positions_ = reinterpret_cast<const Position*>(data + layout.positions);
+    order_ = reinterpret_cast<const uint32_t*>(data + layout.order);
+    texts_ = reinterpret_cast<const uint32_t*>(data + layout.texts);
+    formulas_ = reinterpret_cast<const uint32_t*>(data + layout.formulas);
+    records_ = reinterpret_cast<const FormulaRecord*>(data + layout.records);
+    program_ = reinterpret_cast<const ASTImpl::Instruction*>(data + layout.program);
+    references_ = reinterpret_cast<const Position*>(data + layout.references);
+    text_offsets_ = reinterpret_cast<const uint32_t*>(data + layout.text_offsets);
+    chars_ = reinterpret_cast<const char*>(data + layout.chars);
+}
+
+Size SheetSnapshot::GetSize() const {
+    return { header_.rows, header_.cols };
+}
+
+size_t SheetSnapshot::GetCellCount() const {
+    return header_.cell_count;
+}
+
+std::optional<uint32_t> SheetSnapshot::Find(Position pos) const {
+    const Position* end = positions_ + header_.cell_count;
+    const Position* it = std::lower_bound(positions_, end, pos);
+    if (end == it || *it != pos) {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(it - positions_);
+}
+
+Position SheetSnapshot::GetPosition(uint32_t index) const {
+    return positions_[index];
+}
+
+uint32_t SheetSnapshot::GetOrdered(size_t place) const {
+    return order_[place];
+}
+
+bool SheetSnapshot::IsFormula(uint32_t index) const {
+    return NO_FORMULA != formulas_[index];
+}
+
+std::string_view SheetSnapshot::GetText(uint32_t index) const {
+    const uint32_t id = texts_[index];
+    return { chars_ + text_offsets_[id], text_offsets_[id + 1] - text_offsets_[id] };
+}
+
+FormulaProgram SheetSnapshot::GetFormula(uint32_t index) const {
+    const FormulaRecord& record = records_[formulas_[index]];
+
+    FormulaProgram formula;
+    formula.expression = GetText(index);
+    formula.program = { program_ + record.program_begin, record.program_size };
+    formula.stack_size = record.stack_size;
+    formula.cells = { references_ + record.references_begin, record.references_size };
+    return formula;
+}
+
+FormulaInterface::Value SheetSnapshot::GetValue(uint32_t index) const {
+    const FormulaRecord& record = records_[formulas_[index]];
+    if (NUMBER_VALUE == record.value_type) {
+        return record.value;
+    }
+    return FormulaError(static_cast<FormulaError::Category>(record.value_type));
+}
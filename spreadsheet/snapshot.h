@@ -0,0 +1,155 @@
+#pragma once
+
+#include "FormulaAST.h"
+#include "common.h"
+#include "formula.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const std::byte* Data() const;
+    size_t Size() const;
+
+private:
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+namespace snapshot {
+
+// The file is a header followed by columnar sections, each one is an
+// array aligned to 8 bytes:
+//   positions   Position[cells]       sorted, the index of the file
+//   order       uint32_t[cells]       cell indices, dependencies first
+//   texts       uint32_t[cells]       text id, the expression for formulas
+//   formulas    uint32_t[cells]       formula id or NO_FORMULA
+//   records     FormulaRecord[formulas]
+//   program     Instruction[instructions]
+//   references  Position[references]
+//   offsets     uint32_t[texts + 1]   interned text pool
+//   chars       char[chars]
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t instruction_size;
+    int32_t rows;
+    int32_t cols;
+    uint32_t cell_count;
+    uint32_t formula_count;
+    uint32_t text_count;
+    // keeps the 64-bit counts aligned
+    uint32_t reserved;
+    uint64_t instruction_count;
+    uint64_t reference_count;
+    uint64_t char_count;
+};
+
+struct FormulaRecord {
+    uint32_t program_begin;
+    uint32_t program_size;
+    uint32_t references_begin;
+    uint32_t references_size;
+    uint32_t stack_size;
+    // FormulaError category or NUMBER_VALUE
+    uint32_t value_type;
+    double value;
+};
+
+inline constexpr char MAGIC[8] = { 'S', 'H', 'E', 'E', 'T', 'B', 'I', 'N' };
+inline constexpr uint32_t VERSION = 2;
+inline constexpr uint32_t NO_FORMULA = UINT32_MAX;
+inline constexpr uint32_t NUMBER_VALUE = UINT32_MAX;
+
+// Collects the cells of a sheet and writes them as a snapshot file
+class Writer {
+public:
+    explicit Writer(Size size);
+
+    // The cell is kept by reference, formula values are read by Write().
+    // The ranges of its formula order the cells like its references do.
+    void AddCell(Position pos, const CellInterface& cell, std::vector<Rect> ranges = {});
+
+    // Throws SnapshotException if the file cannot be written
+    void Write(const std::string& path);
+
+private:
+    struct Entry {
+        Position pos;
+        const CellInterface* cell;
+        std::vector<Rect> ranges;
+    };
+
+    uint32_t InternText(std::string_view text);
+    std::vector<uint32_t> SortTopologically() const;
+
+    Size size_;
+    std::vector<Entry> entries_;
+
+    // interned text pool
+    std::unordered_map<std::string, uint32_t> text_ids_;
+    std::vector<uint32_t> text_offsets_{ 0 };
+    std::string chars_;
+};
+
+}  // namespace snapshot
+
+// Mapped snapshot file. Nothing is deserialized up front, every accessor
+// reads the mapped sections directly.
+class SheetSnapshot {
+public:
+    // Throws SnapshotException if the file is missing or malformed
+    explicit SheetSnapshot(const std::string& path);
+
+    Size GetSize() const;
+    size_t GetCellCount() const;
+
+    // Cell index of the position, binary search over the sorted index
+    std::optional<uint32_t> Find(Position pos) const;
+
+    Position GetPosition(uint32_t index) const;
+    // Index of the cell at the given place of the topological order
+    uint32_t GetOrdered(size_t place) const;
+
+    bool IsFormula(uint32_t index) const;
+    // Text of a text cell, the expression without the leading '=' of a formula
+    std::string_view GetText(uint32_t index) const;
+    FormulaProgram GetFormula(uint32_t index) const;
+    FormulaInterface::Value GetValue(uint32_t index) const;
+
+private:
+    MappedFile file_;
+    snapshot::Header header_;
+
+    const Position* positions_;
+    const uint32_t* order_;
+    const uint32_t* texts_;
+    const uint32_t* formulas_;
+    const snapshot::FormulaRecord* records_;
+    const ASTImpl::Instruction* program_;
+    const Position* references_;
+    const uint32_t* text_offsets_;
+    const char* chars_;
+};
@@ -2,7 +2,10 @@
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cmath>
 #include <sstream>
+#include <tuple>
 
 using namespace std::literals;
 
@@ -31,11 +34,21 @@ std::string pos_convert::IndexToColumn(int index) {
     return col;
 }
 
+char* num_convert::ToChars(char* first, double value) {
+    // integers short enough for %g to print in full are the common case and
+    // are much cheaper to write as integers, -0 still goes the long way
+    if (std::abs(value) < 1e6 && value == static_cast<int>(value)
+        && !(0 == value && std::signbit(value))) {
+        return std::to_chars(first, first + MAX_LENGTH, static_cast<int>(value)).ptr;
+    }
+    return std::to_chars(first, first + MAX_LENGTH, value, std::chars_format::general, 6).ptr;
+}
+
 bool Position::operator==(Position rhs) const {
     return row == rhs.row && col == rhs.col;
 }
 bool Position::operator!=(Position rhs) const {
-    return row != rhs.row && col != rhs.col;
+    return !(*this == rhs);
 }
 bool Position::operator<(Position rhs) const {
     return col < rhs.col || (col == rhs.col && row < rhs.row);
@@ -79,8 +92,17 @@ Position Position::FromString(std::string_view str) {
     }
 
     const size_t row_id = std::distance(str.begin(), row_pos);
+    // longer columns are out of range and would overflow the index
+    if (MAX_POS_LETTER_COUNT < row_id) {
+        return pos;
+    }
     pos.col = pos_convert::ColumnToIndex(str.substr(0, row_id));
-    pos.row = std::stoi(std::string(str.substr(row_id))) - 1;
+    const auto row_str = str.substr(row_id);
+    const auto [ptr, ec] = std::from_chars(row_str.data(), row_str.data() + row_str.size(), pos.row);
+    if (std::errc() != ec) {
+        return Position::NONE;
+    }
+    --pos.row;
 
     if (pos.IsValid()) {
         return pos;
@@ -94,6 +116,49 @@ bool Size::operator==(Size rhs) const {
     return rows == rhs.rows && cols == rhs.cols;
 }
 
+bool Rect::operator==(Rect rhs) const {
+    return top_left == rhs.top_left && bottom_right == rhs.bottom_right;
+}
+
+bool Rect::IsValid() const {
+    return top_left.IsValid() && bottom_right.IsValid()
+        && top_left.row <= bottom_right.row && top_left.col <= bottom_right.col;
+}
+
+bool Rect::Contains(Position pos) const {
+    return top_left.row <= pos.row && pos.row <= bottom_right.row
+        && top_left.col <= pos.col && pos.col <= bottom_right.col;
+}
+
+std::string Rect::ToString() const {
+    if (!IsValid()) {
+        return ""s;
+    }
+    if (top_left == bottom_right) {
+        return top_left.ToString();
+    }
+    return top_left.ToString() + ':' + bottom_right.ToString();
+}
+
+Rect Rect::FromString(std::string_view str) {
+    const size_t colon = str.find(':');
+    if (std::string_view::npos == colon) {
+        const Position pos = Position::FromString(str);
+        return { pos, pos };
+    }
+    return { Position::FromString(str.substr(0, colon)),
+        Position::FromString(str.substr(colon + 1)) };
+}
+
+bool SheetReference::operator==(const SheetReference& rhs) const {
+    return sheet == rhs.sheet && range == rhs.range;
+}
+
+bool SheetReference::operator<(const SheetReference& rhs) const {
+    return std::tie(sheet, range.top_left, range.bottom_right)
+        < std::tie(rhs.sheet, rhs.range.top_left, rhs.range.bottom_right);
+}
+
 FormulaError::FormulaError(Category category)
     : category_(category)
 {}
@@ -0,0 +1,66 @@
+#include "table_export.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <variant>
+
+TableWriter::TableWriter(std::ostream& output, size_t buffer_size)
+    : output_(output)
+    , buffer_(std::max(buffer_size, num_convert::MAX_LENGTH))
+{}
+
+TableWriter::~TableWriter() {
+    Flush();
+}
+
+void TableWriter::Write(char c) {
+    *Reserve(1) = c;
+    ++size_;
+}
+
+void TableWriter::Write(std::string_view text) {
+    // long texts skip the buffer instead of growing it
+    if (text.size() > buffer_.size()) {
+        Flush();
+        output_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        return;
+    }
+    std::memcpy(Reserve(text.size()), text.data(), text.size());
+    size_ += text.size();
+}
+
+void TableWriter::Write(double number) {
+    char* first = Reserve(num_convert::MAX_LENGTH);
+    size_ += num_convert::ToChars(first, number) - first;
+}
+
+void TableWriter::Write(FormulaError error) {
+    Write(error.ToString());
+}
+
+void TableWriter::Write(const CellInterface::Value& value) {
+    if (const auto* text = std::get_if<std::string>(&value)) {
+        Write(std::string_view(*text));
+    }
+    else if (const auto* number = std::get_if<double>(&value)) {
+        Write(*number);
+    }
+    else {
+        Write(std::get<FormulaError>(value));
+    }
+}
+
+void TableWriter::Flush() {
+    if (0 != size_) {
+        output_.write(buffer_.data(), static_cast<std::streamsize>(size_));
+        size_ = 0;
+    }
+}
+
+char* TableWriter::Reserve(size_t size) {
+    if (buffer_.size() - size_ < size) {
+        Flush();
+    }
+    return buffer_.data() + size_;
+}
\ No newline at end of file
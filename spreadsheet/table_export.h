@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string_view>
+#include <vector>
+
+// Buffered writer of table output. Everything is formatted into one
+// reusable buffer which goes to the stream in large blocks, numbers are
+// written with to_chars in the format of operator<<.
+class TableWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    explicit TableWriter(std::ostream& output, size_t buffer_size = BUFFER_SIZE);
+    TableWriter(const TableWriter&) = delete;
+    TableWriter& operator=(const TableWriter&) = delete;
+    // Writes what is left in the buffer
+    ~TableWriter();
+
+    void Write(char c);
+    void Write(std::string_view text);
+    void Write(double number);
+    void Write(FormulaError error);
+    void Write(const CellInterface::Value& value);
+
+    // Passes the buffer to the stream, the stream itself is not flushed
+    void Flush();
+
+private:
+    // Makes room for size more bytes, returns where they go
+    char* Reserve(size_t size);
+
+    std::ostream& output_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+};
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "table_import.h"
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+
+TableReader::TableReader(std::istream& input, TableFormat format, size_t chunk_size)
+    : input_(input)
+    , delimiter_(TableFormat::Csv == format ? ',' : '\t')
+    , quoting_(TableFormat::Csv == format)
+    , chunk_size_(std::max<size_t>(chunk_size, 1))
+{}
+
+bool TableReader::Next(Field& field) {
+    while (begin_ != end_ || !eof_) {
+        if (Scan::NeedMore == ScanField(field)) {
+            Refill();
+        }
+        else if (!field.text.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Consumes one field with its delimiter or line break. A field is only
+// taken once its end is in the buffer, otherwise nothing is consumed.
+TableReader::Scan TableReader::ScanField(Field& field) {
+    const char* first = buffer_.data() + begin_;
+    const char* last = buffer_.data() + end_;
+    if (quoting_ && first != last && '"' == *first) {
+        return ScanQuoted(field);
+    }
+
+    const char* stop = first;
+    while (last != stop && delimiter_ != *stop && '\n' != *stop) {
+        ++stop;
+    }
+    if (last == stop && !eof_) {
+        return Scan::NeedMore;
+    }
+
+    size_t length = stop - first;
+    if (0 != length && '\r' == first[length - 1]) {
+        --length;
+    }
+    field = { { row_, col_ }, { first, length } };
+
+    Consume(stop);
+    return Scan::Field;
+}
+
+TableReader::Scan TableReader::ScanQuoted(Field& field) {
+    const char* first = buffer_.data() + begin_;
+    const char* last = buffer_.data() + end_;
+
+    // find the closing quote, doubled quotes stand for one
+    bool escaped = false;
+    const char* close = first + 1;
+    while (true) {
+        close = std::find(close, last, '"');
+        if (last == close || last == close + 1) {
+            if (!eof_) {
+                return Scan::NeedMore;
+            }
+            break;
+        }
+        if ('"' != close[1]) {
+            break;
+        }
+        escaped = true;
+        close += 2;
+    }
+
+    // anything between the closing quote and the delimiter is dropped
+    const char* stop = last == close ? last : close + 1;
+    while (last != stop && delimiter_ != *stop && '\n' != *stop) {
+        ++stop;
+    }
+    if (last == stop && !eof_) {
+        return Scan::NeedMore;
+    }
+
+    std::string_view text(first + 1, close - first - 1);
+    if (escaped) {
+        unquoted_.clear();
+        for (size_t i = 0; i < text.size(); ++i) {
+            unquoted_.push_back(text[i]);
+            if ('"' == text[i]) {
+                ++i;
+            }
+        }
+        text = unquoted_;
+    }
+    field = { { row_, col_ }, text };
+
+    Consume(stop);
+    return Scan::Field;
+}
+
+// Moves past the delimiter or line break at stop
+void TableReader::Consume(const char* stop) {
+    if (buffer_.data() + end_ == stop) {
+        begin_ = end_;
+        return;
+    }
+
+    begin_ = stop - buffer_.data() + 1;
+    if ('\n' == *stop) {
+        ++row_;
+        col_ = 0;
+    }
+    else {
+        ++col_;
+    }
+}
+
+// Keeps the unfinished field at the front of the buffer and appends the
+// next chunk after it
+void TableReader::Refill() {
+    const size_t tail = end_ - begin_;
+    if (0 != tail && 0 != begin_) {
+        std::memmove(buffer_.data(), buffer_.data() + begin_, tail);
+    }
+    begin_ = 0;
+    end_ = tail;
+
+    if (buffer_.size() < tail + chunk_size_) {
+        buffer_.resize(tail + chunk_size_);
+    }
+    input_.read(buffer_.data() + end_, static_cast<std::streamsize>(chunk_size_));
+    end_ += static_cast<size_t>(input_.gcount());
+    if (!input_) {
+        eof_ = true;
+    }
+}
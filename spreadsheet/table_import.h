@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class TableFormat {
+    Tsv,    // the format of Sheet::PrintTexts, no quoting
+    Csv,    // RFC 4180, fields may be quoted and span lines
+};
+
+// Streaming reader of delimited text. The input is read in large chunks
+// and fields are returned as views into the chunk, so a field is only
+// valid until the next call to Next().
+class TableReader {
+public:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    struct Field {
+        Position pos;
+        std::string_view text;
+    };
+
+    TableReader(std::istream& input, TableFormat format, size_t chunk_size = CHUNK_SIZE);
+
+    // Reads the next non-empty field, returns false at the end of input
+    bool Next(Field& field);
+
+private:
+    enum class Scan {
+        Field,
+        NeedMore,
+    };
+
+    Scan ScanField(Field& field);
+    Scan ScanQuoted(Field& field);
+    void Consume(const char* stop);
+    void Refill();
+
+    std::istream& input_;
+    const char delimiter_;
+    const bool quoting_;
+    size_t chunk_size_;
+
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+
+    int row_ = 0;
+    int col_ = 0;
+
+    // unescaped text of a quoted field with doubled quotes
+    std::string unquoted_;
+};
@@ -1,10 +1,23 @@
 #pragma once
 
+#include <cstdio>
 #include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
 
+#include "aggregate.h"
 #include "common.h"
+#include "dependency_graph.h"
 #include "formula.h"
+#include "FormulaAST.h"
+#include "load_generator.h"
+#include "script_runner.h"
+#include "sheet.h"
+#include "sheet_server.h"
 #include "test_runner_p.h"
+#include "user_interface.h"
+#include "workbook.h"
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -18,6 +31,10 @@ inline std::ostream& operator<<(std::ostream& output, Size size) {
     return output << "(" << size.rows << ", " << size.cols << ")";
 }
 
+inline std::ostream& operator<<(std::ostream& output, Rect rect) {
+    return output << rect.top_left << ":" << rect.bottom_right;
+}
+
 inline std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) {
     std::visit(
         [&](const auto& x) {
@@ -163,11 +180,11 @@ namespace {
         sheet->SetCell("A2"_pos, "2");
         ASSERT_EQUAL(evaluate("A1+A2"), 3);
 
-        //   :
+        // Тест на нули:
         sheet->SetCell("B3"_pos, "");
-        ASSERT_EQUAL(evaluate("A1+B3"), 1);  //    
-        ASSERT_EQUAL(evaluate("A1+B1"), 1);  //  
-        ASSERT_EQUAL(evaluate("A1+E4"), 1);  //    
+        ASSERT_EQUAL(evaluate("A1+B3"), 1);  // Ячейка с пустым текстом
+        ASSERT_EQUAL(evaluate("A1+B1"), 1);  // Пустая ячейка
+        ASSERT_EQUAL(evaluate("A1+E4"), 1);  // Ячейка за пределами таблицы
     }
 
     void TestFormulaExpressionFormatting() {
@@ -304,7 +321,7 @@ namespace {
         ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetReferencedCells(), std::vector{ "A1"_pos });
         ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetReferencedCells(), std::vector{ "A1"_pos });
 
-        //    
+        // Ссылка на пустую ячейку
         sheet->SetCell("B2"_pos, "=B1");
         ASSERT(sheet->GetCell("B1"_pos)->GetReferencedCells().empty());
         ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetReferencedCells(), std::vector{ "B1"_pos });
@@ -313,7 +330,7 @@ namespace {
         ASSERT(sheet->GetCell("A1"_pos)->GetReferencedCells().empty());
         ASSERT(sheet->GetCell("A2"_pos)->GetReferencedCells().empty());
 
-        //      
+        // Ссылка на ячейку за пределами таблицы
         sheet->SetCell("B1"_pos, "=C3");
         ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetReferencedCells(), std::vector{ "C3"_pos });
     }
@@ -354,6 +371,1603 @@ namespace {
         ASSERT(caught);
         ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
     }
+
+    void TestDependantsRecalculation() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B1"_pos, "=A1+1");
+        sheet->SetCell("C1"_pos, "=B1*2");
+        sheet->SetCell("D1"_pos, "=C1+1");
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(5.0));
+
+        sheet->SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(6.0));
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(7.0));
+
+        sheet->ClearCell("A1"_pos);
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "");
+    }
+
+    void TestManualRecalculation() {
+        Sheet sheet;
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        sheet.SetCell("A1"_pos, "=B1*2");
+        sheet.SetCell("B1"_pos, "3");
+        sheet.Recalculate();
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+        sheet.SetCell("B1"_pos, "4");
+        sheet.SetCell("C1"_pos, "=A1+B1");
+        sheet.Recalculate();
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(8.0));
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(12.0));
+    }
+
+    void TestDiamondDependencies() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B1"_pos, "=A1");
+        sheet->SetCell("C1"_pos, "=A1*2");
+        sheet->SetCell("D1"_pos, "=B1+C1+A1");
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+        bool caught = false;
+        try {
+            sheet->SetCell("A1"_pos, "=D1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "1");
+    }
+
+    void TestCircularReferencesToNewerCells() {
+        auto sheet = CreateSheet();
+        // every referenced cell is created after the formula that uses it
+        sheet->SetCell("A1"_pos, "=B1");
+        sheet->SetCell("B1"_pos, "=C1+D1");
+        sheet->SetCell("D1"_pos, "=E1");
+        sheet->SetCell("C1"_pos, "=E1");
+
+        auto is_circular = [&](Position pos, std::string text) {
+            try {
+                sheet->SetCell(pos, std::move(text));
+            }
+            catch (const CircularDependencyException&) {
+                return true;
+            }
+            return false;
+        };
+        ASSERT(is_circular("E1"_pos, "=A1"));
+        ASSERT(is_circular("E1"_pos, "=C1"));
+        ASSERT(!is_circular("E1"_pos, "=F1"));
+        ASSERT(is_circular("F1"_pos, "=B1+1"));
+        ASSERT(!is_circular("A2"_pos, "=A1+B1+C1+D1+E1+F1"));
+        ASSERT(is_circular("F1"_pos, "=A2"));
+    }
+
+    void TestCompiledProgramMatchesTree() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "3");
+        sheet->SetCell("A2"_pos, "=1/0");
+        sheet->SetCell("A3"_pos, "text");
+
+        // both paths return a value or the same error
+        auto run = [&](const FormulaAST& ast, bool compiled) -> FormulaInterface::Value {
+            try {
+                return compiled ? ast.Execute(*sheet) : ast.ExecuteTree(*sheet);
+            }
+            catch (const FormulaError& err) {
+                return err;
+            }
+        };
+
+        for (std::string expr : { "1", "-A1", "+-+A1*2", "(1+2)*(3-4)/5", "A1/(A1-3)",
+                                  "1/(1e200*1e200)", "A2+1", "A3*0", "B7+A1",
+                                  "((((((((((1+A1))))))))))*-(2-(3*(4-(5/(6+A1)))))",
+                                  "SUM(A1,A3:B4)", "SUM(A1:A3)", "AVERAGE(B1:B9)", "COUNT(A1:C9,7)",
+                                  "MAX(A1,-A1*2,MIN(A1:A1,1))*2", "SUM(1e200*1e200,-1e200*1e200)",
+                                  "1/0+A3", "A3+1/0", "(A1-3)/0*A3" }) {
+            const auto ast = ParseFormulaAST(expr);
+            ASSERT(run(ast, true) == run(ast, false));
+        }
+
+        // the first error met left to right is the result
+        const auto arithm = FormulaInterface::Value(FormulaError(FormulaError::Category::Arithmetic));
+        const auto value = FormulaInterface::Value(FormulaError(FormulaError::Category::Value));
+        ASSERT(run(ParseFormulaAST("1/0+A3"), true) == arithm);
+        ASSERT(run(ParseFormulaAST("A3+1/0"), true) == value);
+
+        std::string deep = "1";
+        for (int i = 0; i < 100; ++i) {
+            deep = "A1-(" + deep + ")";
+        }
+        const auto ast = ParseFormulaAST(deep);
+        ASSERT(run(ast, true) == run(ast, false));
+    }
+
+    void TestConstantFolding() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "3");
+        sheet->SetCell("A2"_pos, "=-0");
+
+        auto program_size = [](const std::string& expr) {
+            return ParseFormulaAST(expr).GetProgram().size();
+        };
+        ASSERT_EQUAL(program_size("2*3*A1"), 3u);
+        ASSERT_EQUAL(program_size("(1+2)*(3-4)/-5"), 1u);
+        ASSERT_EQUAL(program_size("--A1"), 1u);
+        ASSERT_EQUAL(program_size("-(-(-A1))"), 2u);
+        ASSERT_EQUAL(program_size("1*A1*1/1-0"), 1u);
+        ASSERT_EQUAL(program_size("SUM(1+2,A1:A2)*1"), 5u);
+        // not the same for every value
+        ASSERT_EQUAL(program_size("A1+0"), 3u);
+        ASSERT_EQUAL(program_size("A1-(-0)"), 3u);
+        ASSERT_EQUAL(program_size("A1*0"), 3u);
+        // the error is raised at run time
+        ASSERT_EQUAL(program_size("1/0"), 3u);
+        ASSERT_EQUAL(program_size("1e308*10*1"), 3u);
+
+        // the same value down to the sign of zero, or the same error
+        auto run = [&](const FormulaAST& ast, bool compiled) -> FormulaInterface::Value {
+            try {
+                return compiled ? ast.Execute(*sheet) : ast.ExecuteTree(*sheet);
+            }
+            catch (const FormulaError& err) {
+                return err;
+            }
+        };
+        for (std::string expr : { "1/0", "1e308*10*1", "1*(1e308*10)", "1e308*10-0", "-(1e308*10)/1", "0/0*A1",
+                                  "1e308*10-1e308*10", "A2+0", "A2-0", "0-A2", "A2*1", "-(-A2)",
+                                  "-0*1", "2*3*A1", "1/(2-2)", "SUM(1e308,1e308)*1" }) {
+            const auto ast = ParseFormulaAST(expr);
+            const auto compiled = run(ast, true);
+            const auto tree = run(ast, false);
+            AssertEqual(compiled == tree, true, "expression: " + expr);
+            if (const auto* number = std::get_if<double>(&compiled)) {
+                AssertEqual(std::signbit(*number), std::signbit(std::get<double>(tree)),
+                    "expression: " + expr);
+            }
+        }
+        ASSERT(std::holds_alternative<FormulaError>(run(ParseFormulaAST("1*(1e308*10)/1"), true)));
+
+        // only the program is optimized
+        ASSERT_EQUAL(ParseFormula("2*3*A1+0")->GetExpression(), "2*3*A1+0");
+        ASSERT_EQUAL(ParseFormula("--A1*1")->GetExpression(), "--A1*1");
+    }
+
+    void TestDescentParserMatchesAntlr() {
+        // prefix form of the tree and the referenced cells, or "error"
+        auto describe = [](auto parse) -> std::string {
+            try {
+                const FormulaAST ast = parse();
+                std::ostringstream out;
+                ast.Print(out);
+                out << " | ";
+                ast.PrintCells(out);
+                return out.str();
+            }
+            catch (...) {
+                return "error";
+            }
+        };
+        auto check = [&](const std::string& expr) {
+            const auto descent = describe([&] { return ParseFormulaAST(expr); });
+            const auto antlr = describe([&] {
+                std::istringstream in(expr);
+                return ParseFormulaASTAntlr(in);
+            });
+            AssertEqual(descent, antlr, "expression: " + expr);
+        };
+
+        for (std::string expr : { "1", "-1+2", "2*-3", "--A1", "+(1-2)/3", "1.5e+3*.5",
+                                  "A1*B2-C3/D4", "1-2-3", "8/4/2", "-A1*2", "(((7)))",
+                                  "", "1.", ".", "1e", "1..2", "A", "a1", "A1B", "3X",
+                                  "XFD16384", "XFD16385", "1 2", "(1", "1)", "1+", "*1",
+                                  "SUM(A1:B2)", "MIN(B2:A1,3*-C1,MAX(1))", "COUNT(A1:A1)",
+                                  "AVERAGE(A1 : C3 + 1)", "SUM()", "SUM(A1:)", "SUM(:A1)", "SUM",
+                                  "SUMA1", "SUMX(1)", "A1:B2", "(A1:B2)", "SUM((A1:B2))", "SUM(1,)" }) {
+            check(expr);
+        }
+
+        static const char* const pieces[] = {
+            "A1", "B22", "ZZ9", "AAAA1", "XFD16384", "1", "42", ".5", "2.", "1e3", "1E+2",
+            "3e-1", "e", "E", "+", "-", "*", "/", "(", ")", " ", "\t", "x", "A", ".", "9.9.9",
+            "SUM(", "MAX", ":", ",", "A1:C3",
+        };
+        std::mt19937 generator(20240229);
+        std::uniform_int_distribution<size_t> piece(0, std::size(pieces) - 1);
+        std::uniform_int_distribution<int> length(1, 12);
+        for (int i = 0; i < 20000; ++i) {
+            std::string expr;
+            for (int n = length(generator); n > 0; --n) {
+                expr += pieces[piece(generator)];
+            }
+            check(expr);
+        }
+    }
+
+    void TestLargeFormulaAST() {
+        // long enough to make the ANTLR arena grow several times
+        std::string expr = "A1";
+        for (int i = 1; i < 2000; ++i) {
+            expr += (i % 2 ? "+-B" : "*A") + std::to_string(i % 7 + 1);
+        }
+
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        auto check = [&](FormulaAST ast) {
+            const FormulaAST moved = std::move(ast);
+            std::ostringstream out;
+            moved.PrintCells(out);
+            ASSERT_EQUAL(out.str(), "A1 A2 A3 A4 A5 A6 A7 B1 B2 B3 B4 B5 B6 B7 ");
+            ASSERT_EQUAL(moved.Execute(*sheet), moved.ExecuteTree(*sheet));
+        };
+        check(ParseFormulaAST(expr));
+        std::istringstream in(expr);
+        check(ParseFormulaASTAntlr(in));
+    }
+
+    void TestBinarySnapshot() {
+        const std::string path = "test_snapshot.bin";
+        std::string texts;
+        std::string values;
+        std::string drawing;
+        {
+            Sheet sheet;
+            sheet.SetCell("A1"_pos, "2");
+            sheet.SetCell("A2"_pos, "=A1*3");
+            sheet.SetCell("B2"_pos, "=A2+C5");
+            sheet.SetCell("B1"_pos, "'=text");
+            sheet.SetCell("C1"_pos, "=B1");
+            sheet.SetCell("D1"_pos, "=1/0");
+            sheet.SetCell("D2"_pos, "=A2+C5");
+
+            std::ostringstream out;
+            sheet.PrintTexts(out);
+            texts = out.str();
+            out.str("");
+            sheet.PrintValues(out);
+            values = out.str();
+            out.str("");
+            sheet.DrawSheet(out, false);
+            drawing = out.str();
+            sheet.SaveBinary(path);
+        }
+
+        auto sheet = Sheet::LoadBinary(path);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5, 4 }));
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(6.0));
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetText(), "=A2+C5");
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetReferencedCells(), (std::vector{ "A2"_pos, "C5"_pos }));
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(),
+            CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+        // C3 lies between C1 and the empty C5 of the same column
+        ASSERT(sheet->GetCell("C3"_pos) == nullptr);
+        ASSERT(sheet->GetCell("D5"_pos) == nullptr);
+
+        std::ostringstream out;
+        sheet->DrawSheet(out, false);
+        ASSERT_EQUAL(out.str(), drawing);
+        out.str("");
+        sheet->PrintTexts(out);
+        ASSERT_EQUAL(out.str(), texts);
+        out.str("");
+        sheet->PrintValues(out);
+        ASSERT_EQUAL(out.str(), values);
+
+        // edits see the restored dependencies and their order
+        sheet->SetCell("A1"_pos, "5");
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(15.0));
+        ASSERT_EQUAL(sheet->GetCell("D2"_pos)->GetValue(), CellInterface::Value(15.0));
+        bool caught = false;
+        try {
+            sheet->SetCell("C5"_pos, "=D2");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+
+        sheet.reset();
+        std::remove(path.c_str());
+
+        caught = false;
+        try {
+            Sheet::LoadBinary(path);
+        }
+        catch (const SnapshotException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestTableReader() {
+        const std::string csv = "a,\"b,\"\"c\"\"\"\r\n,\"multi\nline\",=A1+1\n\n\"\",tail";
+        const std::vector<std::string> expected = {
+            "A1:a", "B1:b,\"c\"", "B2:multi\nline", "C2:=A1+1", "B4:tail",
+        };
+        // tiny chunks cut fields at every possible place
+        for (size_t chunk : { size_t{ 1 }, size_t{ 2 }, size_t{ 3 }, size_t{ 7 }, TableReader::CHUNK_SIZE }) {
+            std::istringstream in(csv);
+            TableReader reader(in, TableFormat::Csv, chunk);
+            std::vector<std::string> fields;
+            for (TableReader::Field field; reader.Next(field); ) {
+                fields.push_back(field.pos.ToString() + ":" + std::string(field.text));
+            }
+            ASSERT_EQUAL(fields, expected);
+        }
+    }
+
+    void TestTableWriter() {
+        const std::vector<double> numbers = {
+            0.0, -0.0, 1.0, -2.5, 1.0 / 3, 123456.0, 1234567.0, 1e-5, 1e100, -1e-300, 0.1 + 0.2,
+            std::numeric_limits<double>::infinity(),
+        };
+        // a tiny buffer is flushed between almost every write
+        for (size_t buffer_size : { size_t{ 1 }, size_t{ 30 }, TableWriter::BUFFER_SIZE }) {
+            std::ostringstream expected;
+            std::ostringstream out;
+            {
+                TableWriter writer(out, buffer_size);
+                for (double number : numbers) {
+                    expected << number << '\t';
+                    writer.Write(number);
+                    writer.Write('\t');
+                }
+                const std::string long_text(100, 'x');
+                expected << long_text << FormulaError(FormulaError::Category::Value) << '\n';
+                writer.Write(CellInterface::Value(long_text));
+                writer.Write(CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+                writer.Write('\n');
+            }
+            ASSERT_EQUAL(out.str(), expected.str());
+        }
+
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "'=escaped");
+        sheet.SetCell("B1"_pos, "0042");
+        sheet.SetCell("A2"_pos, "=(B1+0.5)/-A3");
+        sheet.SetCell("B2"_pos, "=1/0");
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        ASSERT_EQUAL(out.str(), "'=escaped\t0042\n=(B1+0.5)/-A3\t=1/0\n\t\n");
+        out.str("");
+        sheet.PrintValues(out);
+        ASSERT_EQUAL(out.str(), "=escaped\t42\n#ARITHM!\t#ARITHM!\n\t\n");
+    }
+
+    void TestImportTable() {
+        Sheet source;
+        source.SetCell("A1"_pos, "=B3*2");
+        source.SetCell("B3"_pos, "4");
+        source.SetCell("C2"_pos, "'=text");
+        source.SetCell("D1"_pos, "=A1+B3");
+        std::ostringstream texts;
+        source.PrintTexts(texts);
+
+        Sheet sheet;
+        std::istringstream in(texts.str());
+        sheet.Import(in, TableFormat::Tsv);
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        ASSERT_EQUAL(out.str(), texts.str());
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(12.0));
+
+        // dependencies are linked, later edits propagate
+        sheet.SetCell("B3"_pos, "5");
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(15.0));
+
+        // new cells referring forward, and new cells inside a range of a
+        // formula which was there before the import
+        Sheet fresh;
+        fresh.SetCell("C1"_pos, "=SUM(A1:A2)");
+        std::istringstream rows("1,=A1+1\n=B1*2,\n\n=D5,,,,=A1\n");
+        fresh.Import(rows, TableFormat::Csv);
+        ASSERT_EQUAL(fresh.GetCell("A2"_pos)->GetValue(), CellInterface::Value(4.0));
+        ASSERT_EQUAL(fresh.GetCell("C1"_pos)->GetValue(), CellInterface::Value(5.0));
+        ASSERT_EQUAL(fresh.GetCell("A4"_pos)->GetValue(), CellInterface::Value(0.0));
+        ASSERT_EQUAL(fresh.GetCell("E4"_pos)->GetValue(), CellInterface::Value(1.0));
+
+        // a cycle anywhere in the input undoes all of it
+        const auto rejected = [&sheet](const std::string& input) {
+            const auto size = sheet.GetPrintableSize();
+            std::ostringstream before;
+            sheet.PrintTexts(before);
+            try {
+                std::istringstream in(input);
+                sheet.Import(in, TableFormat::Csv);
+            }
+            catch (const CircularDependencyException&) {
+            }
+            catch (const FormulaException&) {
+            }
+            std::ostringstream after;
+            sheet.PrintTexts(after);
+            ASSERT_EQUAL(after.str(), before.str());
+            ASSERT_EQUAL(sheet.GetPrintableSize(), size);
+        };
+        rejected("1,2,3\n=D2+F9,,,=A2\n");
+        rejected("=B3+A1,7\n\n,,,,,=Z100");
+        rejected("9,9\n=1+");
+        ASSERT(sheet.GetCell("A2"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(15.0));
+
+        bool caught = false;
+        try {
+            sheet.SetCell("B3"_pos, "=D1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        sheet.SetCell("B3"_pos, "=C2");
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+    }
+
+    void TestBatchEdits() {
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("A2"_pos, "=A1+1");
+        sheet.SetCell("C3"_pos, "wide text");
+
+        const auto texts = [&sheet] {
+            std::ostringstream out;
+            sheet.PrintTexts(out);
+            return out.str();
+        };
+        const std::string before = texts();
+
+        // a cycle is only found on commit and undoes the whole batch
+        sheet.BeginBatch();
+        sheet.SetCell("A1"_pos, "=B1");
+        sheet.SetCell("B1"_pos, "=A2");
+        sheet.ClearCell("C3"_pos);
+        sheet.SetCell("D5"_pos, "x");
+        bool caught = false;
+        try {
+            sheet.CommitBatch();
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(texts(), before);
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 3, 3 }));
+
+        // so does a formula that does not parse, right away
+        sheet.BeginBatch();
+        sheet.SetCell("A1"_pos, "5");
+        caught = false;
+        try {
+            sheet.SetCell("B1"_pos, "=1+");
+        }
+        catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(texts(), before);
+
+        sheet.BeginBatch();
+        sheet.SetCell("A1"_pos, "=B1*2");
+        sheet.SetCell("B1"_pos, "3");
+        sheet.ClearCell("C3"_pos);
+        sheet.SetCell("B2"_pos, "=A2");
+        sheet.CommitBatch();
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(7.0));
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(7.0));
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 2, 2 }));
+        std::ostringstream drawing;
+        sheet.DrawSheet(drawing, true);
+        ASSERT(drawing.str().find("wide text") == std::string::npos);
+
+        // a cleared cell that formulas refer to stays empty in place
+        sheet.BeginBatch();
+        sheet.ClearCell("B1"_pos);
+        sheet.SetCell("C1"_pos, "=1/0");
+        sheet.RollbackBatch();
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "3");
+        ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+
+        sheet.BeginBatch();
+        sheet.ClearCell("B1"_pos);
+        sheet.CommitBatch();
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "");
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(1.0));
+    }
+
+    void TestColumnAlign() {
+        Sheet sheet;
+        // the header line holds the row ids and every column with its delimiter
+        const auto column_width = [&sheet](bool is_text) {
+            std::ostringstream out;
+            sheet.DrawSheet(out, is_text);
+            return static_cast<int>(out.str().find('\n')) - 4;
+        };
+
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("A2"_pos, "=A1*1000");
+        ASSERT_EQUAL(column_width(false), 4);
+        ASSERT_EQUAL(column_width(true), 8);
+
+        // the formula is measured with its current value
+        sheet.SetCell("A1"_pos, "1000");
+        ASSERT_EQUAL(column_width(false), 5);
+
+        sheet.SetCell("A3"_pos, "a long piece of text");
+        ASSERT_EQUAL(column_width(true), 20);
+        sheet.SetCell("A3"_pos, "x");
+        ASSERT_EQUAL(column_width(true), 8);
+        sheet.ClearCell("A2"_pos);
+        ASSERT_EQUAL(column_width(false), 4);
+        ASSERT_EQUAL(column_width(true), 4);
+
+        sheet.BeginBatch();
+        sheet.SetCell("A4"_pos, "0123456789abcdef");
+        sheet.ClearCell("A1"_pos);
+        sheet.RollbackBatch();
+        ASSERT_EQUAL(column_width(true), 4);
+
+        sheet.BeginBatch();
+        sheet.SetCell("A4"_pos, "0123456789abcdef");
+        sheet.ClearCell("A1"_pos);
+        sheet.CommitBatch();
+        ASSERT_EQUAL(column_width(true), 16);
+        sheet.ClearCell("A4"_pos);
+        ASSERT_EQUAL(column_width(true), 3);
+    }
+
+    void TestDrawWindow() {
+        ASSERT_EQUAL(Rect::FromString("B2:H40"), (Rect{ "B2"_pos, "H40"_pos }));
+        ASSERT_EQUAL(Rect::FromString("C3"), (Rect{ "C3"_pos, "C3"_pos }));
+        ASSERT_EQUAL(Rect::FromString("B2:H40").ToString(), "B2:H40");
+        ASSERT(!Rect::FromString("H40:B2").IsValid());
+        ASSERT(!Rect::FromString("B2:").IsValid());
+
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "wide text in A1");
+        sheet.SetCell("B2"_pos, "=C3*2");
+        sheet.SetCell("C3"_pos, "21");
+        sheet.SetCell("D4"_pos, "far");
+
+        std::ostringstream out;
+        sheet.DrawSheet(out, false);
+        const std::string whole = out.str();
+        out.str("");
+        sheet.DrawSheet(out, false, Rect::FromString("A1:Z100"));
+        ASSERT_EQUAL(out.str(), whole);
+
+        // only the visible columns are measured, A1 does not widen column B
+        out.str("");
+        sheet.DrawSheet(out, false, Rect::FromString("B2:C3"));
+        ASSERT_EQUAL(out.str(),
+            "c++| B | C \n"
+            "---+---+---\n"
+            "  2| 42|   \n"
+            "---+---+---\n"
+            "  3|   | 21\n");
+
+        bool caught = false;
+        try {
+            sheet.DrawSheet(out, false, Rect::FromString("C3:B2"));
+        }
+        catch (const InvalidPositionException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestThreadPool() {
+        ThreadPool pool(4);
+        ASSERT_EQUAL(pool.GetThreadCount(), 4u);
+        std::vector<int> squares(10'000);
+        pool.ParallelFor(squares.size(), [&squares](size_t i) {
+            squares[i] = static_cast<int>(i * i % 1000);
+        });
+        for (size_t i = 0; i < squares.size(); ++i) {
+            ASSERT_EQUAL(squares[i], static_cast<int>(i * i % 1000));
+        }
+
+        bool caught = false;
+        try {
+            pool.ParallelFor(100, [](size_t i) {
+                if (42 == i) {
+                    throw std::runtime_error("task failed");
+                }
+            });
+        }
+        catch (const std::runtime_error&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestParallelRecalculation() {
+        constexpr int ROWS = 600;
+        const auto fill = [](Sheet& sheet) {
+            for (int row = 0; row < ROWS; ++row) {
+                const std::string a = Position{ row, 0 }.ToString();
+                const std::string b = Position{ row, 1 }.ToString();
+                const std::string next_a = Position{ (row + 1) % ROWS, 0 }.ToString();
+                sheet.SetCell({ row, 0 }, std::to_string(row));
+                sheet.SetCell({ row, 1 }, "=" + a + "/3+" + next_a);
+                sheet.SetCell({ row, 2 }, "=" + b + "*" + b + "-" + a);
+                sheet.SetCell({ row, 3 }, row % 100 == 0 ? "=C1/(A1-A1)" : "=C1+" + b);
+            }
+        };
+        const auto values = [](const Sheet& sheet) {
+            std::ostringstream out;
+            sheet.PrintValues(out);
+            return out.str();
+        };
+
+        Sheet serial;
+        fill(serial);
+
+        // manual mode collects every formula, automatic mode a batch of them
+        Sheet manual;
+        manual.SetThreadCount(4);
+        ASSERT_EQUAL(manual.GetThreadCount(), 4u);
+        manual.SetRecalcMode(Sheet::RecalcMode::Manual);
+        fill(manual);
+        manual.Recalculate();
+        ASSERT_EQUAL(values(manual), values(serial));
+
+        Sheet automatic;
+        automatic.SetThreadCount(3);
+        automatic.BeginBatch();
+        fill(automatic);
+        automatic.CommitBatch();
+        ASSERT_EQUAL(values(automatic), values(serial));
+
+        serial.SetCell("A1"_pos, "1000");
+        automatic.SetCell("A1"_pos, "1000");
+        ASSERT_EQUAL(values(automatic), values(serial));
+
+        automatic.SetThreadCount(1);
+        ASSERT_EQUAL(automatic.GetThreadCount(), 1u);
+    }
+
+    void TestFarAwayCells() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("XFD16384"_pos, "far");
+        sheet->SetCell("B2"_pos, "near");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ Position::MAX_ROWS, Position::MAX_COLS }));
+        ASSERT_EQUAL(sheet->GetCell("XFD16384"_pos)->GetText(), "far");
+        ASSERT(sheet->GetCell("XFD16383"_pos) == nullptr);
+
+        sheet->ClearCell("XFD16384"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 2 }));
+
+        std::ostringstream values;
+        sheet->PrintValues(values);
+        ASSERT_EQUAL(values.str(), "\t\n\tnear\n");
+    }
+
+    void TestRangeFunctions() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("A2"_pos, "=A1*2");
+        sheet->SetCell("A3"_pos, "text");
+        sheet->SetCell("B1"_pos, "'5");
+        sheet->SetCell("B2"_pos, "4");
+        auto value = [&](std::string_view pos) {
+            return sheet->GetCell(Position::FromString(pos))->GetValue();
+        };
+
+        sheet->SetCell("C1"_pos, "=SUM(A1:B3)");
+        sheet->SetCell("C2"_pos, "=AVERAGE(A1:B3)");
+        sheet->SetCell("C3"_pos, "=MIN(B3:A1)");
+        sheet->SetCell("C4"_pos, "=MAX(A1:B3, 10)");
+        sheet->SetCell("C5"_pos, "=COUNT(A1:B3)");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(7.0));
+        ASSERT_EQUAL(value("C2"), CellInterface::Value(7.0 / 3));
+        ASSERT_EQUAL(value("C3"), CellInterface::Value(1.0));
+        ASSERT_EQUAL(value("C4"), CellInterface::Value(10.0));
+        ASSERT_EQUAL(value("C5"), CellInterface::Value(3.0));
+
+        ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetText(), "=MIN(A1:B3)");
+        ASSERT(sheet->GetCell("C3"_pos)->GetReferencedCells().empty());
+        auto formula = ParseFormula("SUM(B3:A1,C1)+SUM(A1:B3)+MAX(D2:D4)");
+        ASSERT_EQUAL(formula->GetReferencedCells(), (std::vector{ "C1"_pos }));
+        ASSERT_EQUAL(formula->GetReferencedRanges(), (std::vector{
+            Rect::FromString("A1:B3"), Rect::FromString("D2:D4") }));
+
+        // a change inside the range reaches the function
+        sheet->SetCell("B3"_pos, "=-2");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(5.0));
+        ASSERT_EQUAL(value("C3"), CellInterface::Value(-2.0));
+
+        // nothing to aggregate
+        sheet->SetCell("D1"_pos, "=SUM(E1:E5)");
+        sheet->SetCell("D2"_pos, "=AVERAGE(E1:E5)");
+        sheet->SetCell("D3"_pos, "=MAX(E1:F100)");
+        ASSERT_EQUAL(value("D1"), CellInterface::Value(0.0));
+        ASSERT_EQUAL(value("D2"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+        ASSERT_EQUAL(value("D3"), CellInterface::Value(0.0));
+
+        // an error in the range is the result
+        sheet->SetCell("A2"_pos, "=1/0");
+        ASSERT_EQUAL(value("C5"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+        sheet->SetCell("A2"_pos, "=A3");
+        ASSERT_EQUAL(value("C5"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+
+        // ranges are printed with both corners
+        ASSERT_EQUAL(ParseFormula("SUM( B2 : A1 , (1+2)*3 , A1:A1 )")->GetExpression(),
+            "SUM(A1:B2,(1+2)*3,A1:A1)");
+        ASSERT_EQUAL(ParseFormula("-MAX(1)*COUNT(A1)")->GetExpression(), "-MAX(1)*COUNT(A1)");
+
+        // a range covering its own cell is a cycle
+        bool caught = false;
+        try {
+            sheet->SetCell("B3"_pos, "=SUM(A1:C3)");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(value("B3"), CellInterface::Value(-2.0));
+
+        // a call reads a range whose formulas run their own calls first
+        Sheet nested;
+        nested.SetRecalcMode(Sheet::RecalcMode::Manual);
+        nested.SetCell("A1"_pos, "2");
+        nested.SetCell("B1"_pos, "=MAX(A1,SUM(A1:A2)*3)");
+        nested.SetCell("B2"_pos, "=COUNT(A1:B1,SUM(A1))");
+        nested.SetCell("C1"_pos, "=SUM(B1:B2,MIN(B1:B2))+1");
+        ASSERT_EQUAL(nested.GetCell("C1"_pos)->GetValue(), CellInterface::Value(13.0));
+    }
+
+    void TestDependencyGraph() {
+        std::vector<std::unique_ptr<Cell>> cells;
+        for (int row = 0; row < 5000; ++row) {
+            cells.push_back(std::make_unique<Cell>(Position{ row, 0 }));
+        }
+        auto dependencies = [](const DependencyGraph& graph, const Cell* cell) {
+            std::vector<const Cell*> deps;
+            graph.ForEachDependency(cell, [&deps](const Cell* dep) {
+                deps.push_back(dep);
+            });
+            std::sort(deps.begin(), deps.end());
+            return deps;
+        };
+        auto dependant_count = [](const DependencyGraph& graph, const Cell* cell) {
+            size_t count = 0;
+            graph.ForEachDependant(cell, [&count](const Cell*) {
+                ++count;
+            });
+            return count;
+        };
+
+        // relinking touches only the changed links, unlinked cells lose their ids
+        DependencyGraph graph;
+        const Cell* a = cells[0].get();
+        const Cell* b = cells[1].get();
+        const Cell* c = cells[2].get();
+        const Cell* d = cells[3].get();
+        graph.Link(a, { b, c }, {});
+        ASSERT_EQUAL(graph.GetNodeCount(), 3u);
+        ASSERT(graph.HasDependants(b) && graph.HasDependants(c) && !graph.HasDependants(a));
+        graph.Link(a, { c, d }, { Rect::FromString("B1:C9") });
+        ASSERT(!graph.HasDependants(b));
+        ASSERT_EQUAL(graph.GetNodeCount(), 3u);
+        ASSERT_EQUAL(graph.GetRanges(a).size(), 1u);
+        ASSERT(graph.GetRanges(b).empty());
+        std::vector<const Cell*> expected{ c, d };
+        std::sort(expected.begin(), expected.end());
+        ASSERT(dependencies(graph, a) == expected);
+        graph.Unlink(a);
+        ASSERT_EQUAL(graph.GetNodeCount(), 0u);
+        ASSERT(!graph.HasDependants(c) && graph.GetRanges(a).empty());
+
+        // a long row of dependants is packed, then emptied in every order
+        for (size_t i = 2; i < cells.size(); ++i) {
+            graph.Link(cells[i].get(), { a, cells[i - 1].get() }, {});
+        }
+        ASSERT(graph.GetChangedRowCount() < cells.size());
+        ASSERT_EQUAL(dependant_count(graph, a), cells.size() - 2);
+        ASSERT_EQUAL(dependant_count(graph, cells[10].get()), 1u);
+        ASSERT(dependencies(graph, cells[10].get()).size() == 2);
+        for (size_t i = 3; i < cells.size(); i += 2) {
+            graph.Unlink(cells[i].get());
+        }
+        for (size_t i = cells.size() - 2; i >= 2; i -= 2) {
+            ASSERT_EQUAL(dependant_count(graph, a), i / 2);
+            graph.Unlink(cells[i].get());
+        }
+        ASSERT(!graph.HasDependants(a));
+        ASSERT_EQUAL(graph.GetNodeCount(), 0u);
+
+        // freed ids are taken again
+        graph.Link(d, { a }, {});
+        ASSERT_EQUAL(graph.GetNodeCount(), 2u);
+        ASSERT(dependencies(graph, d) == std::vector<const Cell*>{ a });
+        ASSERT_EQUAL(dependant_count(graph, a), 1u);
+    }
+
+    void TestRangeDependencies() {
+        Sheet sheet;
+        auto value = [&](std::string_view pos) {
+            return sheet.GetCell(Position::FromString(pos))->GetValue();
+        };
+
+        // a range does not create the cells it covers
+        sheet.SetCell("B1"_pos, "=SUM(A1:A16384)");
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 1, 2 }));
+        ASSERT_EQUAL(value("B1"), CellInterface::Value(0.0));
+
+        // cells appearing in the range, formulas among them and clearing
+        sheet.SetCell("A500"_pos, "5");
+        ASSERT_EQUAL(value("B1"), CellInterface::Value(5.0));
+        sheet.SetCell("A600"_pos, "=A500*2");
+        ASSERT_EQUAL(value("B1"), CellInterface::Value(15.0));
+        sheet.SetCell("C1"_pos, "=B1+A500");
+        sheet.SetCell("A500"_pos, "1");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(4.0));
+        sheet.ClearCell("A600"_pos);
+        ASSERT(sheet.GetCell("A600"_pos) == nullptr);
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(2.0));
+
+        // cycles through a range from either side
+        auto is_cycle = [&](std::string_view pos, std::string text) {
+            try {
+                sheet.SetCell(Position::FromString(pos), std::move(text));
+            }
+            catch (const CircularDependencyException&) {
+                return true;
+            }
+            return false;
+        };
+        ASSERT(is_cycle("A3", "=C1"));
+        ASSERT(is_cycle("B1", "=SUM(B1:B2)"));
+        ASSERT(is_cycle("A1", "=MAX(B1:C1)"));
+        ASSERT(!is_cycle("D1", "=A1"));
+        ASSERT(is_cycle("A1", "=COUNT(C1:D1)"));
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(2.0));
+
+        // a replaced range no longer covers its cells
+        sheet.SetCell("B1"_pos, "=SUM(E1:E2)");
+        ASSERT(!is_cycle("A1", "=COUNT(C1:C2)"));
+        ASSERT(is_cycle("E2", "=A1+10"));
+        sheet.SetCell("E2"_pos, "=A500+10");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(12.0));
+
+        // manual mode evaluates a range after the dirty formulas inside it
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        sheet.SetCell("E1"_pos, "=E2*2");
+        sheet.SetCell("A500"_pos, "2");
+        sheet.Recalculate();
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(38.0));
+        sheet.SetRecalcMode(Sheet::RecalcMode::Automatic);
+
+        // batches link the ranges at once
+        sheet.BeginBatch();
+        sheet.SetCell("F1"_pos, "=SUM(G1:G3)");
+        sheet.SetCell("G2"_pos, "4");
+        sheet.SetCell("G3"_pos, "=G2+1");
+        sheet.CommitBatch();
+        ASSERT_EQUAL(value("F1"), CellInterface::Value(9.0));
+        sheet.BeginBatch();
+        sheet.SetCell("G1"_pos, "=F1");
+        bool caught = false;
+        try {
+            sheet.CommitBatch();
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT(sheet.GetCell("G1"_pos) == nullptr);
+        sheet.SetCell("G1"_pos, "1");
+        ASSERT_EQUAL(value("F1"), CellInterface::Value(10.0));
+
+        // snapshots keep the ranges
+        const std::string path = "range_dependencies.sheetbin";
+        sheet.SaveBinary(path);
+        auto loaded = Sheet::LoadBinary(path);
+        std::remove(path.c_str());
+        loaded->SetCell("G2"_pos, "0");
+        ASSERT_EQUAL(loaded->GetCell("F1"_pos)->GetValue(), CellInterface::Value(2.0));
+        caught = false;
+        try {
+            loaded->SetCell("G3"_pos, "=F1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestNumericColumns() {
+        Sheet sheet;
+        enum class Kind { Empty, Number, Other };
+        auto kind = [&sheet](Position pos) {
+            const auto column = sheet.GetNumericColumn(pos.col);
+            if (!column || pos.row >= column->rows || !column->chunks[pos.row / 64]) {
+                return Kind::Empty;
+            }
+            const auto& chunk = *column->chunks[pos.row / 64];
+            const uint64_t bit = uint64_t{ 1 } << (pos.row % 64);
+            if (chunk.numbers & bit) {
+                return Kind::Number;
+            }
+            return chunk.others & bit ? Kind::Other : Kind::Empty;
+        };
+        auto number = [&sheet](Position pos) {
+            return sheet.GetNumericColumn(pos.col)->chunks[pos.row / 64]->values[pos.row % 64];
+        };
+
+        sheet.SetCell("A1"_pos, "12");
+        sheet.SetCell("A2"_pos, "text");
+        sheet.SetCell("A3"_pos, "=A1/2");
+        sheet.SetCell("A4"_pos, "=1/0");
+        ASSERT(Kind::Number == kind("A1"_pos));
+        ASSERT_EQUAL(number("A1"_pos), 12.0);
+        ASSERT(Kind::Empty == kind("A2"_pos));
+        ASSERT(Kind::Number == kind("A3"_pos));
+        ASSERT_EQUAL(number("A3"_pos), 6.0);
+        ASSERT(Kind::Other == kind("A4"_pos));
+        ASSERT(Kind::Empty == kind("A200"_pos));
+        ASSERT(Kind::Empty == kind("Z1"_pos));
+
+        // only the chunks holding values are allocated
+        sheet.SetCell("XFD16384"_pos, "5");
+        ASSERT(Kind::Number == kind("XFD16384"_pos));
+        ASSERT_EQUAL(sheet.GetNumericColumn(16383)->rows, 16384);
+        ASSERT(!sheet.GetNumericColumn(16383)->chunks[0]);
+        ASSERT_EQUAL(sheet.GetNumericColumn(16382)->rows, 0);
+        sheet.ClearCell("XFD16384"_pos);
+        ASSERT_EQUAL(sheet.GetNumericColumn(16383)->rows, 0);
+
+        // formulas waiting for recalculation are read from the cells
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        sheet.SetCell("A1"_pos, "20");
+        sheet.SetCell("B1"_pos, "=SUM(A1:A3)");
+        ASSERT(Kind::Other == kind("A3"_pos));
+        ASSERT(Kind::Other == kind("B1"_pos));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+        sheet.Recalculate();
+        ASSERT(Kind::Number == kind("B1"_pos));
+        ASSERT_EQUAL(number("A3"_pos), 10.0);
+        sheet.SetRecalcMode(Sheet::RecalcMode::Automatic);
+
+        sheet.ClearCell("A1"_pos);
+        ASSERT(Kind::Empty == kind("A1"_pos));
+        ASSERT_EQUAL(number("B1"_pos), 0.0);
+
+        // a rolled back batch leaves the old numbers
+        sheet.BeginBatch();
+        sheet.SetCell("A5"_pos, "7");
+        sheet.SetCell("A3"_pos, "=A5");
+        sheet.RollbackBatch();
+        ASSERT(Kind::Empty == kind("A5"_pos));
+        ASSERT(Kind::Number == kind("A3"_pos));
+        sheet.BeginBatch();
+        sheet.SetCell("A5"_pos, "7");
+        sheet.SetCell("A3"_pos, "=A5");
+        sheet.CommitBatch();
+        ASSERT_EQUAL(number("A3"_pos), 7.0);
+        ASSERT_EQUAL(number("B1"_pos), 7.0);
+
+        // ranges read numbers, texts, errors and stale formulas alike
+        for (int row = 0; row < 300; ++row) {
+            sheet.SetCell({ row, 3 }, row % 50 == 7 ? "=D1+1" : std::to_string(row));
+        }
+        sheet.SetCell("E1"_pos, "=SUM(D2:D299)");
+        sheet.SetCell("E2"_pos, "=COUNT(D1:D300)");
+        ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(43765.0));
+        ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(300.0));
+        sheet.SetCell("D100"_pos, "x");
+        ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(299.0));
+        sheet.SetCell("D130"_pos, "=A4");
+        ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(),
+            CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+        // cells of a snapshot are read from the cells until they are loaded
+        const std::string path = "numeric_columns.sheetbin";
+        sheet.SaveBinary(path);
+        auto loaded = Sheet::LoadBinary(path);
+        std::remove(path.c_str());
+        ASSERT(!loaded->GetNumericColumn(3).has_value());
+        loaded->SetCell("D130"_pos, "1");
+        ASSERT(loaded->GetNumericColumn(3).has_value());
+        ASSERT_EQUAL(loaded->GetCell("E2"_pos)->GetValue(), CellInterface::Value(299.0));
+    }
+
+    void TestCompactCells() {
+        static_assert(sizeof(Cell) <= 40, "a plain cell should stay small");
+
+        Sheet sheet;
+        auto check = [&sheet](Position pos, const std::string& text, CellInterface::Value value) {
+            sheet.SetCell(pos, text);
+            const auto* cell = sheet.GetCell(pos);
+            ASSERT_EQUAL(cell->GetText(), text);
+            ASSERT_EQUAL(cell->GetValue(), value);
+        };
+        check("A1"_pos, "0", 0.0);
+        check("A2"_pos, "12", 12.0);
+        check("A3"_pos, "0012", 12.0);
+        check("A4"_pos, "'12", "12");
+        check("A5"_pos, "123456789012345", 123456789012345.0);
+        check("A6"_pos, "12345678901234567890", 12345678901234567890.0);
+        check("A7"_pos, "1.5", "1.5");
+        check("A8"_pos, "'", "");
+        check("A9"_pos, "=A2+A3", 24.0);
+
+        std::ostringstream values;
+        sheet.PrintValues(values);
+        ASSERT_EQUAL(values.str(), "0\n12\n12\n12\n1.23457e+14\n1.23457e+19\n1.5\n\n24\n");
+        std::ostringstream texts;
+        sheet.PrintTexts(texts);
+        ASSERT_EQUAL(texts.str(), "0\n12\n0012\n'12\n123456789012345\n12345678901234567890\n1.5\n'\n=A2+A3\n");
+
+        // equal texts are shared and outlive any one of their cells
+        sheet.SetCell("B1"_pos, "shared text");
+        sheet.SetCell("B2"_pos, "shared text");
+        sheet.ClearCell("B1"_pos);
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetText(), "shared text");
+        sheet.SetCell("B2"_pos, "other text");
+        sheet.SetCell("B3"_pos, "shared text");
+        ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value("shared text"));
+
+        // a rolled back batch gets every kind of content back
+        sheet.BeginBatch();
+        sheet.SetCell("A2"_pos, "text");
+        sheet.SetCell("A4"_pos, "=1");
+        sheet.SetCell("A9"_pos, "7");
+        sheet.ClearCell("B3"_pos);
+        sheet.RollbackBatch();
+        std::ostringstream restored;
+        sheet.PrintTexts(restored);
+        ASSERT_EQUAL(restored.str(), "0\t\n12\tother text\n0012\tshared text\n'12\t\n"
+            "123456789012345\t\n12345678901234567890\t\n1.5\t\n'\t\n=A2+A3\t\n");
+        ASSERT_EQUAL(sheet.GetCell("A9"_pos)->GetValue(), CellInterface::Value(24.0));
+    }
+
+    void TestFormulaTemplates() {
+        // a formula of a template matches one parsed on its own
+        Sheet values;
+        for (int row = 0; row < 8; ++row) {
+            for (int col = 0; col < 8; ++col) {
+                values.SetCell({ row, col }, std::to_string(row * 8 + col + 1));
+            }
+        }
+        auto check = [&values](const std::string& expr, Position pos) {
+            const auto alone = ParseFormula(expr);
+            const auto shared = ParseFormula(expr, pos);
+            const std::string hint = "expression: " + expr + " at " + pos.ToString();
+            AssertEqual(shared->GetExpression(), alone->GetExpression(), hint);
+            AssertEqual(shared->GetReferencedCells(), alone->GetReferencedCells(), hint);
+            AssertEqual(shared->GetReferencedRanges(), alone->GetReferencedRanges(), hint);
+            AssertEqual(shared->Evaluate(values) == alone->Evaluate(values), true, hint);
+        };
+        for (int row = 0; row < 4; ++row) {
+            const std::string r = std::to_string(row + 1);
+            const std::string next = std::to_string(row + 2);
+            check("A" + r + "*B" + r, { row, 2 });
+            check("A" + r + " * B" + r, { row, 2 });
+            check("SUM(B" + next + ":A" + r + ")/(C" + r + "-1)", { row + 10, 3 });
+            check("MAX(A1:C" + r + ",-D" + r + ")", { row, 4 });
+            check("1+2*3", { row, 5 });
+        }
+        // the same template seen from columns to the right and to the left
+        check("B1+C2", { 0, 0 });
+        check("C1+D2", { 0, 1 });
+        check("A1+B2", { 0, 0 });
+        check("A1+B2", { 5, 5 });
+
+        for (std::string expr : { "A1+", "AAAA1", "XFD16385", "SUM(A1:)", "" }) {
+            bool thrown = false;
+            try {
+                ParseFormula(expr, "B2"_pos);
+            }
+            catch (const FormulaException&) {
+                thrown = true;
+            }
+            ASSERT(thrown);
+        }
+
+        // a filled down column keeps working after edits and a snapshot
+        Sheet sheet;
+        for (int row = 0; row < 100; ++row) {
+            const std::string r = std::to_string(row + 1);
+            sheet.SetCell({ row, 0 }, std::to_string(row));
+            sheet.SetCell({ row, 1 }, "2");
+            sheet.SetCell({ row, 2 }, "=A" + r + "*B" + r);
+        }
+        ASSERT_EQUAL(sheet.GetCell("C50"_pos)->GetText(), "=A50*B50");
+        ASSERT_EQUAL(sheet.GetCell("C50"_pos)->GetValue(), CellInterface::Value(98.0));
+        sheet.SetCell("B50"_pos, "3");
+        ASSERT_EQUAL(sheet.GetCell("C50"_pos)->GetValue(), CellInterface::Value(147.0));
+        ASSERT(sheet.IsReferenced(sheet.GetConcreteCell("B50"_pos)));
+
+        const std::string path = "formula_templates.sheetbin";
+        sheet.SaveBinary(path);
+        auto loaded = Sheet::LoadBinary(path);
+        std::remove(path.c_str());
+        loaded->SetCell("A99"_pos, "1");
+        ASSERT_EQUAL(loaded->GetCell("C99"_pos)->GetValue(), CellInterface::Value(2.0));
+        ASSERT_EQUAL(loaded->GetCell("C100"_pos)->GetText(), "=A100*B100");
+    }
+
+    void TestAggregateKernel() {
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<double> number(-1000, 1000);
+        for (size_t count : { 0, 1, 3, 4, 5, 63, 64, 1001 }) {
+            std::vector<double> values(count);
+            for (auto& value : values) {
+                value = std::round(number(generator));
+            }
+
+            aggregate::Totals totals;
+            totals.sum = 0.5;
+            aggregate::Accumulate(values.data(), values.size(), totals);
+
+            double sum = 0.5;
+            double min = std::numeric_limits<double>::infinity();
+            double max = -std::numeric_limits<double>::infinity();
+            for (double value : values) {
+                sum += value;
+                min = std::min(min, value);
+                max = std::max(max, value);
+            }
+            // integers are added exactly in any order
+            ASSERT_EQUAL(totals.sum, sum);
+            ASSERT_EQUAL(totals.min, min);
+            ASSERT_EQUAL(totals.max, max);
+            ASSERT_EQUAL(totals.count, count);
+        }
+    }
+
+    void TestSnapshots() {
+        const auto values = [](const auto& sheet) {
+            std::ostringstream out;
+            sheet.PrintValues(out);
+            return out.str();
+        };
+        const auto texts = [](const auto& sheet) {
+            std::ostringstream out;
+            sheet.PrintTexts(out);
+            return out.str();
+        };
+
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("A2"_pos, "=A1+1");
+        sheet.SetCell("B3"_pos, "text");
+        const SheetView first = sheet.Snapshot();
+        const std::string first_values = values(sheet);
+        const std::string first_texts = texts(sheet);
+        ASSERT_EQUAL(values(first), first_values);
+        ASSERT_EQUAL(texts(first), first_texts);
+        ASSERT_EQUAL(first.GetPrintableSize(), (Size{ 3, 2 }));
+        ASSERT_EQUAL(first.GetVersion(), 1u);
+
+        // edits after the snapshot do not reach it
+        sheet.SetCell("A1"_pos, "10");
+        sheet.ClearCell("B3"_pos);
+        sheet.SetCell("C5"_pos, "=A2*2");
+        const SheetView second = sheet.Snapshot();
+        ASSERT_EQUAL(values(first), first_values);
+        ASSERT_EQUAL(texts(first), first_texts);
+        ASSERT(first.GetCell("A2"_pos)->GetValue() == CellInterface::Value(2.0));
+        ASSERT(first.GetCell("C5"_pos) == nullptr);
+        ASSERT_EQUAL(first.GetCell("B3"_pos)->GetText(), "text");
+        ASSERT_EQUAL(values(second), values(sheet));
+        ASSERT_EQUAL(texts(second), texts(sheet));
+        ASSERT(second.GetCell("C5"_pos)->GetValue() == CellInterface::Value(22.0));
+        ASSERT(second.GetCell("B3"_pos) == nullptr);
+        ASSERT(second.GetCell("A2"_pos)->GetReferencedCells() == std::vector<Position>{ "A1"_pos });
+        try {
+            second.GetCell(Position::NONE);
+            ASSERT(false);
+        }
+        catch (const InvalidPositionException&) {
+        }
+
+        // dirty formulas of the manual mode are evaluated for the snapshot
+        sheet.SetRecalcMode(Sheet::RecalcMode::Manual);
+        sheet.SetCell("A1"_pos, "100");
+        const SheetView third = sheet.Snapshot();
+        ASSERT(third.GetCell("C5"_pos)->GetValue() == CellInterface::Value(202.0));
+        ASSERT(second.GetCell("C5"_pos)->GetValue() == CellInterface::Value(22.0));
+
+        // a version nobody reads is freed by the next snapshot
+        {
+            SheetView copy = first;
+            copy = third;
+            ASSERT_EQUAL(copy.GetVersion(), 3u);
+        }
+        auto store = std::make_shared<VersionStore>();
+        store->Set("A1"_pos, sheet.GetCell("A1"_pos));
+        std::optional<SheetView> kept = store->Publish({ 1, 1 });
+        for (int i = 0; i < 5; ++i) {
+            store->Set("A1"_pos, i % 2 ? nullptr : sheet.GetCell("A2"_pos));
+            store->Publish({ 1, 1 });
+        }
+        ASSERT_EQUAL(store->GetVersionCount(), 2u);
+        ASSERT_EQUAL(kept->GetCell("A1"_pos)->GetText(), "100");
+        kept.reset();
+        store->Publish({ 1, 1 });
+        ASSERT_EQUAL(store->GetVersionCount(), 1u);
+
+        std::optional<SheetView> latest;
+        for (int i = 0; i < 10; ++i) {
+            sheet.SetCell("D1"_pos, std::to_string(i));
+            latest.emplace(sheet.Snapshot());
+        }
+        ASSERT_EQUAL(latest->GetVersion(), 13u);
+        ASSERT(latest->GetCell("D1"_pos)->GetValue() == CellInterface::Value(9.0));
+
+        // readers check every version they see while the sheet changes
+        constexpr int ROWS = 200;
+        Sheet shared;
+        for (int row = 0; row < ROWS; ++row) {
+            shared.SetCell({ row, 0 }, "0");
+            shared.SetCell({ row, 1 }, "=A" + std::to_string(row + 1) + "*2");
+        }
+        std::atomic<bool> done{ false };
+        std::mutex mutex;
+        SheetView current = shared.Snapshot();
+        std::vector<std::thread> readers;
+        std::atomic<int> mismatches{ 0 };
+        for (int i = 0; i < 3; ++i) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    std::optional<SheetView> view;
+                    {
+                        std::lock_guard lock(mutex);
+                        view.emplace(current);
+                    }
+                    const double number = std::get<double>(view->GetCell({ 0, 0 })->GetValue());
+                    for (int row = 0; row < ROWS; ++row) {
+                        const auto a = view->GetCell({ row, 0 })->GetValue();
+                        const auto b = view->GetCell({ row, 1 })->GetValue();
+                        if (!(a == CellInterface::Value(number)) || !(b == CellInterface::Value(number * 2))) {
+                            ++mismatches;
+                        }
+                    }
+                }
+            });
+        }
+        for (int i = 1; i <= 200; ++i) {
+            shared.BeginBatch();
+            for (int row = 0; row < ROWS; ++row) {
+                shared.SetCell({ row, 0 }, std::to_string(i));
+            }
+            shared.CommitBatch();
+            SheetView view = shared.Snapshot();
+            std::lock_guard lock(mutex);
+            current = view;
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        ASSERT_EQUAL(mismatches.load(), 0);
+        ASSERT(current.GetCell({ ROWS - 1, 1 })->GetValue() == CellInterface::Value(400.0));
+    }
+    void TestWorkbook() {
+        const auto value = [](const Sheet& sheet, std::string_view pos) {
+            return sheet.GetCell(Position::FromString(pos))->GetValue();
+        };
+        const CellInterface::Value ref_error = FormulaError(FormulaError::Category::Ref);
+
+        Workbook book;
+        Sheet& first = book.AddSheet("Sheet1");
+        Sheet& second = book.AddSheet("Sheet2");
+        ASSERT(book.GetSheetNames() == (std::vector<std::string>{ "Sheet1", "Sheet2" }));
+        ASSERT(book.GetSheet("Sheet2") == &second);
+        ASSERT(book.GetSheet("Sheet3") == nullptr);
+
+        second.SetCell("A1"_pos, "2");
+        second.SetCell("B2"_pos, "=A1*5");
+        first.SetCell("A1"_pos, "=Sheet2!A1 + SUM(Sheet2!A1:B2)");
+        ASSERT_EQUAL(first.GetCell("A1"_pos)->GetText(), "=Sheet2!A1+SUM(Sheet2!A1:B2)");
+        ASSERT(first.GetCell("A1"_pos)->GetReferencedCells().empty());
+        ASSERT(value(first, "A1") == CellInterface::Value(14.0));
+        // the referenced cells of another sheet are not created
+        ASSERT(second.GetCell("C3"_pos) == nullptr);
+        first.SetCell("A2"_pos, "=Sheet2!C3+A1");
+        ASSERT(second.GetCell("C3"_pos) == nullptr);
+        ASSERT(value(first, "A2") == CellInterface::Value(14.0));
+
+        // edits of one sheet reach the formulas of the other one
+        second.SetCell("A1"_pos, "3");
+        ASSERT(value(first, "A1") == CellInterface::Value(21.0));
+        second.SetCell("C3"_pos, "=B2");
+        ASSERT(value(first, "A2") == CellInterface::Value(36.0));
+        second.ClearCell("C3"_pos);
+        ASSERT(value(first, "A2") == CellInterface::Value(21.0));
+
+        // an unknown sheet is #REF! until it is added
+        first.SetCell("B1"_pos, "=Data!A1*2");
+        ASSERT(value(first, "B1") == ref_error);
+        Sheet& data = book.AddSheet("Data");
+        ASSERT(value(first, "B1") == CellInterface::Value(0.0));
+        data.SetCell("A1"_pos, "=Sheet1!A1");
+        ASSERT(value(first, "B1") == CellInterface::Value(42.0));
+
+        // cycles through other sheets are refused and keep the old content
+        bool caught = false;
+        try {
+            second.SetCell("A1"_pos, "=Data!A1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(second.GetCell("A1"_pos)->GetText(), "3");
+        caught = false;
+        try {
+            first.SetCell("C1"_pos, "=Sheet1!C1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        second.BeginBatch();
+        second.SetCell("D1"_pos, "1");
+        second.SetCell("B2"_pos, "=Data!A1");
+        caught = false;
+        try {
+            second.CommitBatch();
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(second.GetCell("B2"_pos)->GetText(), "=A1*5");
+        ASSERT(second.GetCell("D1"_pos) == nullptr);
+        ASSERT(value(first, "B1") == CellInterface::Value(42.0));
+
+        // sheets referring to each other both ways without a cycle of cells
+        second.SetCell("E1"_pos, "=Sheet1!B1+1");
+        ASSERT(value(second, "E1") == CellInterface::Value(43.0));
+        second.SetCell("A1"_pos, "1");
+        ASSERT(value(first, "A1") == CellInterface::Value(7.0));
+        ASSERT(value(second, "E1") == CellInterface::Value(15.0));
+
+        // filled down formulas share a template with the sheet references
+        for (int row = 0; row < 10; ++row) {
+            data.SetCell({ row, 1 }, "=Sheet2!A" + std::to_string(row + 1) + "+1");
+        }
+        ASSERT_EQUAL(data.GetCell("B2"_pos)->GetText(), "=Sheet2!A2+1");
+        ASSERT(value(data, "B1") == CellInterface::Value(2.0));
+        second.SetCell("A3"_pos, "=9");
+        ASSERT(value(data, "B3") == CellInterface::Value(10.0));
+
+        // the manual mode leaves the dependants in all the sheets dirty
+        book.SetRecalcMode(Workbook::RecalcMode::Manual);
+        second.SetCell("A3"_pos, "=19");
+        ASSERT(data.GetConcreteCell("B3"_pos)->GetCachedValue() == std::nullopt);
+        book.Recalculate();
+        ASSERT(data.GetConcreteCell("B3"_pos)->GetCachedValue() == CellInterface::Value(20.0));
+        book.SetRecalcMode(Workbook::RecalcMode::Automatic);
+
+        // a saved sheet keeps its references when it joins another workbook
+        const std::string path = "workbook.sheetbin";
+        first.SaveBinary(path);
+        Workbook copy;
+        copy.AddSheet("Sheet1", Sheet::LoadBinary(path));
+        std::remove(path.c_str());
+        ASSERT(value(*copy.GetSheet("Sheet1"), "A1") == ref_error);
+        Sheet& copied = copy.AddSheet("Sheet2");
+        copied.SetCell("A1"_pos, "4");
+        ASSERT(value(*copy.GetSheet("Sheet1"), "A1") == CellInterface::Value(8.0));
+
+        // a sheet closing a cycle is refused and stays with the caller
+        Workbook cyclic;
+        Sheet& left = cyclic.AddSheet("Left");
+        left.SetCell("A1"_pos, "=Right!A1");
+        auto right = std::make_unique<Sheet>();
+        right->SetCell("A1"_pos, "=Left!A1+1");
+        caught = false;
+        try {
+            cyclic.AddSheet("Right", std::move(right));
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT(right != nullptr);
+        ASSERT(cyclic.GetSheet("Right") == nullptr);
+        ASSERT_EQUAL(right->GetCell("A1"_pos)->GetText(), "=Left!A1+1");
+        right->SetCell("A1"_pos, "2");
+        cyclic.AddSheet("Right", std::move(right));
+        ASSERT(right == nullptr);
+        ASSERT(value(left, "A1") == CellInterface::Value(2.0));
+
+        caught = false;
+        try {
+            book.AddSheet("Sheet1");
+        }
+        catch (const std::invalid_argument&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        caught = false;
+        try {
+            book.AddSheet("2nd");
+        }
+        catch (const std::invalid_argument&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestWorkbookParallelRecalculation() {
+        constexpr int SHEETS = 12;
+        constexpr int ROWS = 500;
+
+        // every sheet sums its column and the totals of the two sheets before
+        const auto build = [](Workbook& book) {
+            for (int i = 0; i < SHEETS; ++i) {
+                Sheet& sheet = book.AddSheet("S" + std::to_string(i));
+                for (int row = 0; row < ROWS; ++row) {
+                    sheet.SetCell({ row, 0 }, std::to_string(row % 7 + i));
+                }
+                std::string total = "=SUM(A1:A" + std::to_string(ROWS) + ")";
+                for (int j = std::max(0, i - 2); j < i; ++j) {
+                    total += "+S" + std::to_string(j) + "!B1/2";
+                }
+                sheet.SetCell("B1"_pos, total);
+            }
+        };
+        const auto totals = [](const Workbook& book) {
+            std::vector<double> result;
+            for (const auto& name : book.GetSheetNames()) {
+                result.push_back(std::get<double>(
+                    book.GetSheet(name)->GetCell("B1"_pos)->GetValue()));
+            }
+            return result;
+        };
+
+        Workbook serial;
+        Workbook parallel;
+        parallel.SetThreadCount(4);
+        ASSERT_EQUAL(parallel.GetThreadCount(), 4u);
+        build(serial);
+        build(parallel);
+        for (Workbook* book : { &serial, &parallel }) {
+            book->SetRecalcMode(Workbook::RecalcMode::Manual);
+            for (int i = 0; i < SHEETS; i += 3) {
+                book->GetSheet("S" + std::to_string(i))->SetCell("A1"_pos, "=100");
+            }
+            book->Recalculate();
+        }
+        ASSERT(totals(serial) == totals(parallel));
+        double first_total = 100.0;
+        for (int row = 1; row < ROWS; ++row) {
+            first_total += row % 7;
+        }
+        ASSERT_EQUAL(totals(parallel).front(), first_total);
+    }
+#if defined(__linux__)
+    void TestSheetServer() {
+        const std::string path = "test_sheet_server.sock";
+        SheetServer server(path, 2);
+        std::thread loop([&server] {
+            server.Run();
+        });
+
+        {
+            SheetClient client(path);
+            const auto expect = [&client](bool ok, std::string_view text) {
+                const auto response = client.Receive();
+                ASSERT_EQUAL(response.ok, ok);
+                ASSERT_EQUAL(response.text, text);
+            };
+
+            // commands go without waiting, the answers keep their order
+            client.Send("set A1 =1+2\nget A1\nget B7\nscope\n"
+                "sheet Data\nset A1 =Sheet1!A1*2\nget A1\nsheet Sheet1\nset A1 5\n"
+                "text\nview A1:A1\n");
+            expect(true, "");
+            expect(true, "3\n");
+            expect(true, "\n");
+            expect(true, "1 1\n");
+            expect(true, "");
+            expect(true, "");
+            expect(true, "6\n");
+            expect(true, "");
+            expect(true, "");
+            expect(true, "5\n");
+            ASSERT(client.Receive().ok);
+
+            client.Send("bogus\nset B1 =B1\nset A0 1\nsheet 2nd\nget A1\nsheet Sheet1\r\nget A1\n");
+            expect(false, "Wrong command");
+            ASSERT(!client.Receive().ok);
+            ASSERT(!client.Receive().ok);
+            ASSERT(!client.Receive().ok);
+            expect(false, "Unknown sheet 2nd");
+            expect(true, "");
+            expect(true, "5\n");
+
+            // an answered edit is seen by the reads of other connections
+            SheetClient other(path);
+            other.Send("sheet Data\nget A1\n");
+            ASSERT_EQUAL(other.Receive().text, "");
+            ASSERT_EQUAL(other.Receive().text, "10\n");
+        }
+
+        LoadOptions options;
+        options.address = path;
+        options.connections = 3;
+        options.requests = 500;
+        options.pipeline = 8;
+        options.write_share = 0.3;
+        const LoadReport report = RunLoad(options);
+        ASSERT_EQUAL(report.requests, 1500u);
+        ASSERT_EQUAL(report.errors, 0u);
+        ASSERT(report.p99_us <= report.max_us);
+
+        server.Stop();
+        loop.join();
+    }
+#endif
+
+    void TestScriptRunner() {
+        const InputData parsed = InputReader::Parse("  set\tB2   hello  world");
+        ASSERT(Actions::SET_CELL == parsed.action);
+        ASSERT_EQUAL(parsed.pos, "B2"_pos);
+        ASSERT_EQUAL(parsed.data, "hello  world");
+        ASSERT(Actions::BAD_ACTION == InputReader::Parse("set").action);
+        ASSERT(Actions::EXIT == InputReader::Parse("exit").action);
+
+        const std::string script =
+            "set A1 1\n"
+            "set A2 =A1+1\n"
+            "\n"
+            "get A2\n"
+            "bogus\n"
+            "set ZZZZZ1 5\n"
+            "set B1 =B2\n"
+            "set B2 =B1\n"
+            "set B3 =1+\n"
+            "get B1\n"
+            "clear A1\n"
+            "get A2\n"
+            "exit\n"
+            "set A1 100\n";
+
+        // tiny chunks split the lines, every two edits make a batch
+        ScriptOptions options;
+        options.chunk_size = 5;
+        options.batch_size = 2;
+        Sheet sheet;
+        std::istringstream input(script);
+        std::ostringstream output;
+        std::ostringstream errors;
+        const ScriptReport report = RunScript(input, output, errors, sheet, options);
+
+        ASSERT_EQUAL(output.str(), "2\n0\n1\n");
+        // the batch with the cycle is applied again edit by edit
+        ASSERT_EQUAL(errors.str(),
+            "line 5: Wrong command\n"
+            "line 6: Wrong position\n"
+            "line 8: Circular dependency found\n"
+            "line 9: Wrong formula\n");
+        ASSERT_EQUAL(report.lines, 13u);
+        ASSERT_EQUAL(report.commands, 12u);
+        ASSERT_EQUAL(report.edits, 6u);
+        ASSERT_EQUAL(report.batches, 4u);
+        ASSERT_EQUAL(report.errors, 4u);
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=B2");
+        ASSERT(sheet.GetCell("B3"_pos) == nullptr);
+        // A2 still refers to the cleared cell
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "");
+
+        // Windows line breaks and no line break at the end
+        std::istringstream more("set C1 =C2*2\r\nset C2 3\r\nget C1");
+        output.str("");
+        errors.str("");
+        ASSERT_EQUAL(RunScript(more, output, errors, sheet).errors, 0u);
+        ASSERT_EQUAL(output.str(), "6\n");
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetText(), "3");
+    }
 }  // namespace
 
 void RunTests() {
@@ -377,4 +1991,36 @@ void RunTests() {
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestFarAwayCells);
+    RUN_TEST(tr, TestDependantsRecalculation);
+    RUN_TEST(tr, TestManualRecalculation);
+    RUN_TEST(tr, TestDiamondDependencies);
+    RUN_TEST(tr, TestCircularReferencesToNewerCells);
+    RUN_TEST(tr, TestCompiledProgramMatchesTree);
+    RUN_TEST(tr, TestConstantFolding);
+    RUN_TEST(tr, TestDescentParserMatchesAntlr);
+    RUN_TEST(tr, TestLargeFormulaAST);
+    RUN_TEST(tr, TestBinarySnapshot);
+    RUN_TEST(tr, TestTableReader);
+    RUN_TEST(tr, TestTableWriter);
+    RUN_TEST(tr, TestImportTable);
+    RUN_TEST(tr, TestBatchEdits);
+    RUN_TEST(tr, TestColumnAlign);
+    RUN_TEST(tr, TestDrawWindow);
+    RUN_TEST(tr, TestThreadPool);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestRangeFunctions);
+    RUN_TEST(tr, TestDependencyGraph);
+    RUN_TEST(tr, TestRangeDependencies);
+    RUN_TEST(tr, TestNumericColumns);
+    RUN_TEST(tr, TestCompactCells);
+    RUN_TEST(tr, TestFormulaTemplates);
+    RUN_TEST(tr, TestAggregateKernel);
+    RUN_TEST(tr, TestSnapshots);
+    RUN_TEST(tr, TestWorkbook);
+    RUN_TEST(tr, TestWorkbookParallelRecalculation);
+#if defined(__linux__)
+    RUN_TEST(tr, TestSheetServer);
+#endif
+    RUN_TEST(tr, TestScriptRunner);
 }
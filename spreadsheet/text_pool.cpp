@@ -0,0 +1,68 @@
+#include "text_pool.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+struct Pool {
+    std::mutex mutex;
+    // keys view the texts of the entries
+    std::unordered_map<std::string_view, std::unique_ptr<TextPool::Entry>> entries;
+};
+
+// never destroyed, cells of static sheets may outlive it otherwise
+static Pool& GetPool() {
+    static Pool* pool = new Pool;
+    return *pool;
+}
+
+static std::optional<double> ParseNumber(std::string_view text) {
+    const bool digits = !text.empty() && std::all_of(text.begin(), text.end(), [](char ch) {
+        return std::isdigit(static_cast<unsigned char>(ch));
+    });
+    double number = 0;
+    if (!digits || std::from_chars(text.data(), text.data() + text.size(), number).ec != std::errc()) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+}   // namespace
+
+std::string_view TextPool::Entry::GetShown() const {
+    const std::string_view shown = text;
+    return !shown.empty() && ESCAPE_SIGN == shown.front() ? shown.substr(1) : shown;
+}
+
+const TextPool::Entry* TextPool::Intern(std::string_view text) {
+    Pool& pool = GetPool();
+    std::lock_guard lock(pool.mutex);
+
+    auto it = pool.entries.find(text);
+    if (pool.entries.end() == it) {
+        auto entry = std::make_unique<Entry>();
+        entry->text = std::string(text);
+        entry->number = ParseNumber(text);
+        const std::string_view key = entry->text;
+        it = pool.entries.emplace(key, std::move(entry)).first;
+    }
+    ++it->second->refs;
+    return it->second.get();
+}
+
+void TextPool::Release(const Entry* entry) {
+    Pool& pool = GetPool();
+    std::lock_guard lock(pool.mutex);
+
+    const auto it = pool.entries.find(entry->text);
+    if (0 == --it->second->refs) {
+        pool.entries.erase(it);
+    }
+}
\ No newline at end of file
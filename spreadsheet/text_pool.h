@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Texts of the cells. Equal texts are stored once and shared by all the
+// cells of all the sheets, the value of a text is worked out when it
+// enters the pool.
+class TextPool {
+public:
+    struct Entry {
+        std::string text;
+        // the value of a text of digits
+        std::optional<double> number;
+        // cells holding the text, guarded by the pool
+        size_t refs = 0;
+
+        // The value of a text which is not a number: the text without the
+        // escape sign
+        std::string_view GetShown() const;
+    };
+
+    // Returns the entry of the text with one more reference
+    static const Entry* Intern(std::string_view text);
+    // Drops a reference, the last one removes the entry
+    static void Release(const Entry* entry);
+};
\ No newline at end of file
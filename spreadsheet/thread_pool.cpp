@@ -0,0 +1,84 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    workers_.reserve(thread_count - 1);
+    for (size_t i = 0; i + 1 < thread_count; ++i) {
+        workers_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard guard(wake_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return queues_.size();
+}
+
+void ThreadPool::Push(size_t queue, Task task) {
+    {
+        std::lock_guard guard(queues_[queue]->mutex);
+        queues_[queue]->tasks.push_back(std::move(task));
+    }
+    {
+        // counted under the wake mutex, so a worker going to sleep sees it
+        std::lock_guard guard(wake_mutex_);
+        queued_.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::TryRun(size_t queue) {
+    Task task;
+    for (size_t i = 0; i < queues_.size() && !task; ++i) {
+        Queue& victim = *queues_[(queue + i) % queues_.size()];
+        std::lock_guard guard(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        // the own queue is used as a stack, stolen tasks come from the front
+        if (0 == i) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+        }
+        else {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(size_t queue) {
+    while (true) {
+        if (TryRun(queue)) {
+            continue;
+        }
+        std::unique_lock lock(wake_mutex_);
+        wake_.wait(lock, [this] {
+            return stop_ || 0 != queued_.load(std::memory_order_relaxed);
+        });
+        if (stop_) {
+            return;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers with a task queue each. A worker takes tasks from
+// the back of its own queue and steals from the front of the others when
+// it runs dry.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // thread_count includes the thread which calls ParallelFor()
+    explicit ThreadPool(size_t thread_count);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    size_t GetThreadCount() const;
+
+    // Calls func(i) for every i in [0, count) and returns once all calls
+    // are done. The range is cut into chunks spread over the queues, the
+    // calling thread works on them too. The first exception thrown by func
+    // is rethrown here after the other chunks are finished.
+    template <typename Func>
+    void ParallelFor(size_t count, Func&& func);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Push(size_t queue, Task task);
+    // Runs one task of the queue or one stolen from another queue
+    bool TryRun(size_t queue);
+    void WorkerLoop(size_t queue);
+
+    // the last queue belongs to the calling thread
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_{ 0 };
+    bool stop_ = false;
+};
+
+template <typename Func>
+void ThreadPool::ParallelFor(size_t count, Func&& func) {
+    if (0 == count) {
+        return;
+    }
+
+    // a few chunks per thread leave something to steal when they are uneven
+    const size_t chunk_count = std::min(count, queues_.size() * 4);
+    std::atomic<size_t> left{ chunk_count };
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        const size_t begin = count * chunk / chunk_count;
+        const size_t end = count * (chunk + 1) / chunk_count;
+        Push(chunk % queues_.size(), [&, begin, end] {
+            try {
+                for (size_t i = begin; i < end; ++i) {
+                    func(i);
+                }
+            }
+            catch (...) {
+                std::lock_guard guard(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            left.fetch_sub(1, std::memory_order_acq_rel);
+        });
+    }
+
+    const size_t own_queue = queues_.size() - 1;
+    while (0 != left.load(std::memory_order_acquire)) {
+        if (!TryRun(own_queue)) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
\ No newline at end of file
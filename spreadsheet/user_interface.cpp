@@ -1,6 +1,8 @@
 #include "user_interface.h"
 
-#include "sstream"
+#include <algorithm>
+#include <cctype>
+#include <string_view>
 
 static inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -28,107 +30,154 @@ InputReader::InputReader(std::istream& input)
 {}
 
 InputData InputReader::Read() {
-    using namespace std::literals;
-
-    InputData data;
-
     std::string txt;
     if (in_.good()) {
         std::getline(in_, txt);
     }
-    else {
-        return data;
-    }
+    return Parse(txt);
+}
+
+// Cuts the first word off the text, the spaces before it are skipped
+static std::string_view NextWord(std::string_view& text) {
+    static constexpr std::string_view SPACES = " \t\n\v\f\r";
+    const size_t begin = std::min(text.find_first_not_of(SPACES), text.size());
+    const size_t end = std::min(text.find_first_of(SPACES, begin), text.size());
+    const std::string_view word = text.substr(begin, end - begin);
+    text.remove_prefix(end);
+    return word;
+}
 
-    if (txt.empty()) {
+InputData InputReader::Parse(std::string_view line) {
+    using namespace std::literals;
+
+    InputData data;
+    if (line.empty()) {
         return data;
     }
 
-    std::istringstream txt_stream(txt);
-    txt_stream >> txt;
+    const std::string_view txt = NextWord(line);
 
-    if ("set"s == txt) {
-        if (txt_stream >> txt) {
+    if ("set"sv == txt) {
+        if (const auto pos = NextWord(line); !pos.empty()) {
             data.action = Actions::SET_CELL;
-            data.pos = Position::FromString(txt);
+            data.pos = Position::FromString(pos);
         }
     }
-    else if ("clear"s == txt) {
-        if (txt_stream >> txt) {
+    else if ("clear"sv == txt) {
+        if (const auto pos = NextWord(line); !pos.empty()) {
             data.action = Actions::CLEAR_CELL;
-            data.pos = Position::FromString(txt);
+            data.pos = Position::FromString(pos);
         }
     }
-    else if ("scope"s == txt) {
+    else if ("scope"sv == txt) {
         data.action = Actions::GET_SCOPE;
     }
-    else if ("value"s == txt) {
+    else if ("value"sv == txt) {
         data.action = Actions::PRINT_VALUE;
     }
-    else if ("text"s == txt) {
+    else if ("text"sv == txt) {
         data.action = Actions::PRINT_TEXT;
     }
-    else if ("exit"s == txt) {
+    else if ("get"sv == txt) {
+        if (const auto pos = NextWord(line); !pos.empty()) {
+            data.action = Actions::GET_VALUE;
+            data.pos = Position::FromString(pos);
+        }
+    }
+    else if ("view"sv == txt) {
+        if (const auto window = NextWord(line); !window.empty()) {
+            data.action = Actions::VIEW;
+            data.window = Rect::FromString(window);
+        }
+    }
+    else if ("exit"sv == txt) {
         data.action = Actions::EXIT;
     }
 
-    while (isspace(txt_stream.peek())) {
-        txt_stream.get();
+    while (!line.empty() && isspace(static_cast<unsigned char>(line.front()))) {
+        line.remove_prefix(1);
     }
-    std::getline(txt_stream, data.data);
+    data.data = line;
 
     return data;
 }
 
-Executor::Executor(std::ostream& output, Sheet& sheet)
+Executor::Executor(std::ostream& output, Sheet& sheet, bool interactive)
     : out_(output)
     , sheet_(sheet)
+    , interactive_(interactive)
 {}
 
+void Executor::ClearScreen() const {
+    if (interactive_) {
+        system("cls");
+    }
+}
+
 void Executor::Execute(InputData & data) {
     using namespace std::literals;
     
     try {
         switch (data.action) {
         case (Actions::BAD_ACTION): {
-            out_ << "  \n"sv;
+            out_ << "Неверно введено действие\n"sv;
             break;
         }
         case (Actions::SET_CELL): {
-            sheet_.SetCell(data.pos, data.data);
-            out_ << "    "sv
-                << data.pos.ToString()
-                << '\n';
+            sheet_.SetCell(data.pos, std::move(data.data));
+            if (interactive_) {
+                out_ << "Добавлена ячейка на позицию "sv
+                    << data.pos.ToString()
+                    << '\n';
+            }
             break;
         }
         case (Actions::CLEAR_CELL): {
             sheet_.ClearCell(data.pos);
-            out_ << "    "sv
-                << data.pos.ToString()
-                << '\n';
+            if (interactive_) {
+                out_ << "Очищенна ячейка на позиции "sv
+                    << data.pos.ToString()
+                    << '\n';
+            }
             break;
         }
         case (Actions::GET_SCOPE): {
-            out_ << "    "sv
+            out_ << "Текущая область видимости таблицы "sv
                 << sheet_.GetPrintableSize() << '\n';
             break;
         }
+        case (Actions::GET_VALUE): {
+            if (const CellInterface* cell = sheet_.GetCell(data.pos)) {
+                out_ << cell->GetValue();
+            }
+            out_ << '\n';
+            break;
+        }
         case (Actions::PRINT_VALUE): {
-            system("cls");
+            ClearScreen();
             sheet_.DrawSheet(out_, false);
             break;
         }
         case (Actions::PRINT_TEXT): {
-            system("cls");
+            ClearScreen();
             sheet_.DrawSheet(out_, true);
             break;
         }
+        case (Actions::VIEW): {
+            ClearScreen();
+            sheet_.DrawSheet(out_, false, data.window);
+            break;
+        }
         default:
-            throw std::exception(" ");
+            throw std::exception("Неопределенное поведение");
         }
     }
     catch (InvalidPositionException) {
-        out_ << "        \n"sv;
+        // without a console the caller reports it
+        if (!interactive_) {
+            throw;
+        }
+        out_ << "Позиция ячейки задана неверно либо выходит за допустимые пределы\n"sv;
     }
 }
 
@@ -4,6 +4,7 @@
 #include "formula.h"
 
 #include <iostream>
+#include <string_view>
 
 enum struct Actions {
 	BAD_ACTION,
@@ -12,11 +13,14 @@ enum struct Actions {
 	GET_SCOPE,
 	PRINT_VALUE,
 	PRINT_TEXT,
+	VIEW,
+	GET_VALUE,
 	EXIT
 };
 
 struct InputData {
 	Position pos;
+	Rect window;
 	std::string data;
 	Actions action{ Actions::BAD_ACTION };
 };
@@ -29,15 +33,22 @@ public:
 	explicit InputReader(std::istream& input);
 
 	InputData Read();
+	// Parses one command line, a wrong command gives BAD_ACTION
+	static InputData Parse(std::string_view line);
 };
 
 class Executor {
 private:
 	std::ostream& out_;
 	Sheet& sheet_;
+	// a console: edits are confirmed, the screen is cleared before drawing
+	// and a wrong position is reported to the output instead of thrown
+	bool interactive_;
+
+	void ClearScreen() const;
 
 public:
-	explicit Executor(std::ostream& output, Sheet& sheet);
+	explicit Executor(std::ostream& output, Sheet& sheet, bool interactive = true);
 
 	void Execute(InputData& data);
 };
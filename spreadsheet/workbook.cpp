@@ -0,0 +1,490 @@
+#include "workbook.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+static bool IsValidName(const std::string& name) {
+    const auto is_start = [](char c) {
+        return ('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z') || '_' == c;
+    };
+    if (name.empty() || !is_start(name.front())) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [&is_start](char c) {
+        return is_start(c) || ('0' <= c && c <= '9');
+    });
+}
+
+// Tarjan's algorithm. Components are numbered in the order they are
+// finished, every one after the components it has edges to.
+class StrongComponents {
+public:
+    explicit StrongComponents(const std::vector<std::vector<size_t>>& edges)
+        : edges_(edges)
+        , indices_(edges.size(), NONE)
+        , lows_(edges.size())
+        , components_(edges.size(), NONE) {
+        for (size_t node = 0; node < edges.size(); ++node) {
+            if (NONE == indices_[node]) {
+                Visit(node);
+            }
+        }
+    }
+
+    size_t GetCount() const {
+        return count_;
+    }
+    size_t GetComponent(size_t node) const {
+        return components_[node];
+    }
+
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    void Visit(size_t node) {
+        indices_[node] = lows_[node] = next_index_++;
+        stack_.push_back(node);
+        for (size_t next : edges_[node]) {
+            if (NONE == indices_[next]) {
+                Visit(next);
+                lows_[node] = std::min(lows_[node], lows_[next]);
+            }
+            else if (NONE == components_[next]) {
+                // still on the stack
+                lows_[node] = std::min(lows_[node], indices_[next]);
+            }
+        }
+        if (lows_[node] != indices_[node]) {
+            return;
+        }
+        size_t member;
+        do {
+            member = stack_.back();
+            stack_.pop_back();
+            components_[member] = count_;
+        } while (member != node);
+        ++count_;
+    }
+
+    const std::vector<std::vector<size_t>>& edges_;
+    std::vector<size_t> indices_;
+    std::vector<size_t> lows_;
+    std::vector<size_t> components_;
+    std::vector<size_t> stack_;
+    size_t next_index_ = 0;
+    size_t count_ = 0;
+};
+
+}   // namespace
+
+Workbook::~Workbook() = default;
+
+Sheet& Workbook::AddSheet(const std::string& name) {
+    return AddSheet(name, std::make_unique<Sheet>());
+}
+
+Sheet& Workbook::AddSheet(const std::string& name, std::unique_ptr<Sheet>&& sheet) {
+    if (!IsValidName(name)) {
+        throw std::invalid_argument("Wrong sheet name " + name);
+    }
+    if (indices_.count(name)) {
+        throw std::invalid_argument("Sheet " + name + " already exists");
+    }
+    if (!sheet || sheet->workbook_) {
+        throw std::invalid_argument("The sheet belongs to a workbook");
+    }
+
+    // the loaded cells are linked before the sheet knows the workbook
+    sheet->LinkLoadedCells();
+    Sheet& added = *sheet;
+    const RecalcMode own_mode = added.recalc_mode_;
+    sheets_.push_back({ name, std::move(sheet) });
+    indices_.emplace(sheets_.back().name, sheets_.size() - 1);
+    sheet_indices_.emplace(&added, sheets_.size() - 1);
+    added.workbook_ = this;
+    added.recalc_mode_ = recalc_mode_;
+
+    std::vector<Cell*> linked;
+    added.sheet_.ForEach([this, &added, &linked](Position pos, const Cell* cell) {
+        auto references = cell->GetSheetReferences();
+        if (!references.empty()) {
+            Link(added, cell, std::move(references));
+            linked.push_back(added.sheet_.Get(pos));
+        }
+    });
+    if (HasCycle(added, linked)) {
+        for (const Cell* cell : linked) {
+            Unlink(cell);
+        }
+        added.workbook_ = nullptr;
+        added.recalc_mode_ = own_mode;
+        sheet_indices_.erase(&added);
+        indices_.erase(sheets_.back().name);
+        // the caller gets the sheet back untouched
+        sheet = std::move(sheets_.back().sheet);
+        sheets_.pop_back();
+        throw CircularDependencyException("Circular dependency found");
+    }
+
+    // formulas referring to the name had #REF! or values of another content
+    for (const auto& [cell, link] : links_) {
+        const bool refers = &added == link.sheet
+            || std::any_of(link.references.begin(), link.references.end(),
+                [&name](const SheetReference& reference) {
+                    return name == reference.sheet;
+                });
+        if (refers) {
+            link.sheet->InvalidateSheetReference(cell);
+        }
+    }
+    if (RecalcMode::Automatic == recalc_mode_) {
+        Recalculate();
+    }
+    return added;
+}
+
+Sheet* Workbook::GetSheet(std::string_view name) {
+    const auto it = indices_.find(name);
+    return indices_.end() == it ? nullptr : sheets_[it->second].sheet.get();
+}
+
+const Sheet* Workbook::GetSheet(std::string_view name) const {
+    const auto it = indices_.find(name);
+    return indices_.end() == it ? nullptr : sheets_[it->second].sheet.get();
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const {
+    std::vector<std::string> names;
+    names.reserve(sheets_.size());
+    for (const Entry& entry : sheets_) {
+        names.push_back(entry.name);
+    }
+    return names;
+}
+
+void Workbook::SetRecalcMode(RecalcMode mode) {
+    recalc_mode_ = mode;
+    for (const Entry& entry : sheets_) {
+        entry.sheet->recalc_mode_ = mode;
+    }
+    if (RecalcMode::Automatic == mode) {
+        Recalculate();
+    }
+}
+
+Workbook::RecalcMode Workbook::GetRecalcMode() const {
+    return recalc_mode_;
+}
+
+// A level only reads the values of earlier levels, which are all evaluated,
+// so its groups do not write anything another group reads
+void Workbook::Recalculate() {
+    for (const auto& level : GetRecalculationLevels()) {
+        const auto recalculate = [&level](size_t i) {
+            for (Sheet* sheet : level[i]) {
+                sheet->Recalculate();
+            }
+        };
+        if (pool_ && level.size() > 1) {
+            pool_->ParallelFor(level.size(), recalculate);
+        }
+        else {
+            for (size_t i = 0; i < level.size(); ++i) {
+                recalculate(i);
+            }
+        }
+    }
+}
+
+void Workbook::SetThreadCount(size_t threads) {
+    if (threads == GetThreadCount()) {
+        return;
+    }
+    pool_ = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+}
+
+size_t Workbook::GetThreadCount() const {
+    return pool_ ? pool_->GetThreadCount() : 1;
+}
+
+// private
+
+void Workbook::Link(Sheet& sheet, const Cell* cell, std::vector<SheetReference> references) {
+    Unlink(cell);
+    if (references.empty()) {
+        return;
+    }
+    auto& counts = sheet_references_[&sheet];
+    for (const SheetReference& reference : references) {
+        Dependants& dependants = dependants_[reference.sheet];
+        dependants.ranges.Add(cell, { reference.range });
+        ++dependants.count;
+        ++counts[reference.sheet];
+    }
+    links_.emplace(cell, CellLink{ &sheet, std::move(references) });
+}
+
+void Workbook::Unlink(const Cell* cell) {
+    const auto it = links_.find(cell);
+    if (links_.end() == it) {
+        return;
+    }
+    auto& counts = sheet_references_.at(it->second.sheet);
+    for (const SheetReference& reference : it->second.references) {
+        const auto dependants = dependants_.find(reference.sheet);
+        dependants->second.ranges.Remove(cell, { reference.range });
+        if (0 == --dependants->second.count) {
+            dependants_.erase(dependants);
+        }
+        const auto count = counts.find(reference.sheet);
+        if (0 == --count->second) {
+            counts.erase(count);
+        }
+    }
+    if (counts.empty()) {
+        sheet_references_.erase(it->second.sheet);
+    }
+    links_.erase(it);
+}
+
+bool Workbook::HasDependants(const Sheet& sheet) const {
+    return dependants_.count(GetName(sheet)) > 0;
+}
+
+void Workbook::InvalidateDependants(const Sheet& sheet, Position pos) {
+    const auto it = dependants_.find(GetName(sheet));
+    if (dependants_.end() == it) {
+        return;
+    }
+    std::vector<const Cell*> cells;
+    it->second.ranges.ForEachCovering(pos, [&cells](const Cell* cell) {
+        cells.push_back(cell);
+    });
+    for (const Cell* cell : cells) {
+        links_.at(cell).sheet->InvalidateSheetReference(cell);
+    }
+}
+
+bool Workbook::HasCycle(const Sheet& sheet, const Cell* cell,
+    const std::unordered_set<const Cell*>& dependencies, const std::vector<Rect>& ranges,
+    const std::vector<SheetReference>& references) const {
+    if (!IsOnSheetCycle(sheet, references)) {
+        return false;
+    }
+
+    // the cell is not linked to the new content yet, the search starts from it
+    std::vector<Node> stack;
+    const auto push = [&stack](const Sheet* owner) {
+        return [&stack, owner](const Cell* dependency) {
+            stack.push_back({ owner, dependency });
+        };
+    };
+    for (const Cell* dependency : dependencies) {
+        stack.push_back({ &sheet, dependency });
+    }
+    for (const Rect& range : ranges) {
+        sheet.ForEachCellInRange(range, push(&sheet));
+    }
+    for (const SheetReference& reference : references) {
+        if (const Sheet* other = GetSheet(reference.sheet)) {
+            other->ForEachCellInRange(reference.range, push(other));
+        }
+    }
+    return Reaches(std::move(stack), cell);
+}
+
+bool Workbook::HasCycle(const Sheet& sheet, const std::vector<Cell*>& cells) const {
+    if (!IsOnSheetCycle(sheet, {})) {
+        return false;
+    }
+    std::vector<Node> roots;
+    roots.reserve(cells.size());
+    for (const Cell* cell : cells) {
+        roots.push_back({ &sheet, cell });
+    }
+    return HasCycleFrom(roots);
+}
+
+bool Workbook::ReadsDirtySheet(const Sheet& sheet) const {
+    const auto it = sheet_references_.find(&sheet);
+    if (sheet_references_.end() == it) {
+        return false;
+    }
+    return std::any_of(it->second.begin(), it->second.end(), [this](const auto& item) {
+        const Sheet* other = GetSheet(item.first);
+        return other && !other->dirty_.empty();
+    });
+}
+
+const std::string& Workbook::GetName(const Sheet& sheet) const {
+    return sheets_[sheet_indices_.at(&sheet)].name;
+}
+
+bool Workbook::IsOnSheetCycle(const Sheet& sheet, const std::vector<SheetReference>& extra) const {
+    std::vector<const Sheet*> stack;
+    std::unordered_set<const Sheet*> visited;
+    const auto push = [this, &stack, &visited](std::string_view name) {
+        const Sheet* other = GetSheet(name);
+        if (other && visited.insert(other).second) {
+            stack.push_back(other);
+        }
+    };
+
+    for (const SheetReference& reference : extra) {
+        push(reference.sheet);
+    }
+    const Sheet* current = &sheet;
+    while (true) {
+        const auto it = sheet_references_.find(current);
+        if (sheet_references_.end() != it) {
+            for (const auto& item : it->second) {
+                push(item.first);
+            }
+        }
+        if (visited.count(&sheet)) {
+            return true;
+        }
+        if (stack.empty()) {
+            return false;
+        }
+        current = stack.back();
+        stack.pop_back();
+    }
+}
+
+template <typename Func>
+void Workbook::ForEachDependency(Node node, Func&& func) const {
+    node.sheet->ForEachDependency(node.cell, [&func, &node](const Cell* dependency) {
+        func(Node{ node.sheet, dependency });
+    });
+    const auto it = links_.find(node.cell);
+    if (links_.end() == it) {
+        return;
+    }
+    for (const SheetReference& reference : it->second.references) {
+        if (const Sheet* other = GetSheet(reference.sheet)) {
+            other->ForEachCellInRange(reference.range, [&func, other](const Cell* dependency) {
+                func(Node{ other, dependency });
+            });
+        }
+    }
+}
+
+bool Workbook::Reaches(std::vector<Node> stack, const Cell* target) const {
+    std::unordered_set<const Cell*> visited;
+    while (!stack.empty()) {
+        const Node node = stack.back();
+        stack.pop_back();
+        if (target == node.cell) {
+            return true;
+        }
+        if (!visited.insert(node.cell).second) {
+            continue;
+        }
+        ForEachDependency(node, [&stack](Node dependency) {
+            stack.push_back(dependency);
+        });
+    }
+    return false;
+}
+
+// Depth-first search with three colors: a dependency on the current path
+// closes a cycle. A finished node is pushed again to be marked as such.
+bool Workbook::HasCycleFrom(const std::vector<Node>& roots) const {
+    enum class Color : uint8_t {
+        OnPath,
+        Finished,
+    };
+    std::unordered_map<const Cell*, Color> colors;
+    std::vector<std::pair<Node, bool>> stack;
+    for (const Node& root : roots) {
+        stack.push_back({ root, false });
+    }
+
+    while (!stack.empty()) {
+        const auto [node, finished] = stack.back();
+        stack.pop_back();
+        if (finished) {
+            colors[node.cell] = Color::Finished;
+            continue;
+        }
+        if (!colors.emplace(node.cell, Color::OnPath).second) {
+            continue;
+        }
+        stack.push_back({ node, true });
+
+        bool has_cycle = false;
+        ForEachDependency(node, [&](Node dependency) {
+            const auto it = colors.find(dependency.cell);
+            if (colors.end() == it) {
+                stack.push_back({ dependency, false });
+            }
+            else if (Color::OnPath == it->second) {
+                has_cycle = true;
+            }
+        });
+        if (has_cycle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::vector<std::vector<Sheet*>>> Workbook::GetRecalculationLevels() const {
+    std::vector<Sheet*> dirty;
+    std::unordered_map<const Sheet*, size_t> ids;
+    for (const Entry& entry : sheets_) {
+        if (!entry.sheet->dirty_.empty()) {
+            ids.emplace(entry.sheet.get(), dirty.size());
+            dirty.push_back(entry.sheet.get());
+        }
+    }
+
+    // a dirty sheet waits for the dirty sheets it refers to
+    std::vector<std::vector<size_t>> edges(dirty.size());
+    for (size_t i = 0; i < dirty.size(); ++i) {
+        const auto it = sheet_references_.find(dirty[i]);
+        if (sheet_references_.end() == it) {
+            continue;
+        }
+        for (const auto& item : it->second) {
+            const auto id = ids.find(GetSheet(item.first));
+            if (ids.end() != id && i != id->second) {
+                edges[i].push_back(id->second);
+            }
+        }
+    }
+
+    const StrongComponents components(edges);
+    std::vector<std::vector<size_t>> members(components.GetCount());
+    for (size_t i = 0; i < dirty.size(); ++i) {
+        members[components.GetComponent(i)].push_back(i);
+    }
+
+    // the components come after the ones they refer to
+    std::vector<size_t> component_levels(components.GetCount(), 0);
+    std::vector<std::vector<std::vector<Sheet*>>> levels;
+    for (size_t component = 0; component < members.size(); ++component) {
+        size_t& level = component_levels[component];
+        for (size_t member : members[component]) {
+            for (size_t next : edges[member]) {
+                const size_t other = components.GetComponent(next);
+                if (component != other) {
+                    level = std::max(level, component_levels[other] + 1);
+                }
+            }
+        }
+        if (levels.size() <= level) {
+            levels.resize(level + 1);
+        }
+        auto& group = levels[level].emplace_back();
+        for (size_t member : members[component]) {
+            group.push_back(dirty[member]);
+        }
+    }
+    return levels;
+}
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+#include "range_index.h"
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Named sheets whose formulas refer to each other as Sheet2!A1 or
+// SUM(Sheet2!A1:B3). Every sheet keeps its own dependency graph, the
+// workbook links the references between sheets and forwards changes along
+// them. References go by name, so a formula may refer to a sheet added
+// later and evaluates to #REF! until then.
+class Workbook {
+public:
+    using RecalcMode = Sheet::RecalcMode;
+
+    Workbook() = default;
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+    ~Workbook();
+
+    // Adds an empty sheet or one made elsewhere, e.g. by Sheet::LoadBinary().
+    // A name is [A-Za-z_][A-Za-z0-9_]* as formulas write it. Throws
+    // std::invalid_argument for a malformed or taken name, or for a sheet
+    // of another workbook, and CircularDependencyException if the formulas
+    // of the sheet close a cycle with the others. The sheet is only moved
+    // from once it is added, on failure the caller still owns it.
+    Sheet& AddSheet(const std::string& name);
+    Sheet& AddSheet(const std::string& name, std::unique_ptr<Sheet>&& sheet);
+
+    // nullptr for an unknown name
+    Sheet* GetSheet(std::string_view name);
+    const Sheet* GetSheet(std::string_view name) const;
+    // In the order of addition
+    std::vector<std::string> GetSheetNames() const;
+
+    // The mode of every sheet. In the automatic mode an edit evaluates its
+    // dependants in all the sheets.
+    void SetRecalcMode(RecalcMode mode);
+    RecalcMode GetRecalcMode() const;
+
+    // Recalculates the sheets with dirty formulas, the sheets they refer to
+    // first. Sheets which do not depend on each other are recalculated
+    // concurrently on a pool of that many threads, sheets referring to each
+    // other both ways go together on one thread.
+    void Recalculate();
+    void SetThreadCount(size_t threads);
+    size_t GetThreadCount() const;
+
+private:
+    friend class Sheet;
+
+    struct Entry {
+        std::string name;
+        std::unique_ptr<Sheet> sheet;
+    };
+
+    // Formulas of the workbook referring to one sheet name
+    struct Dependants {
+        RangeIndex ranges;
+        size_t count = 0;
+    };
+
+    // References of a formula to other sheets
+    struct CellLink {
+        Sheet* sheet;
+        std::vector<SheetReference> references;
+    };
+
+    // A node of the cell graph of the whole workbook
+    struct Node {
+        const Sheet* sheet;
+        const Cell* cell;
+    };
+
+    // Replaces the references of the cell, an empty list unlinks it
+    void Link(Sheet& sheet, const Cell* cell, std::vector<SheetReference> references);
+    void Unlink(const Cell* cell);
+
+    bool HasDependants(const Sheet& sheet) const;
+    // The value at pos changed, the formulas of any sheet referring to it
+    // become dirty together with their dependants
+    void InvalidateDependants(const Sheet& sheet, Position pos);
+
+    // True if the new links of the cell would close a cycle through other
+    // sheets. The cycles inside one sheet are found by the sheet itself.
+    bool HasCycle(const Sheet& sheet, const Cell* cell,
+        const std::unordered_set<const Cell*>& dependencies, const std::vector<Rect>& ranges,
+        const std::vector<SheetReference>& references) const;
+    // The same for cells of the sheet which are linked already
+    bool HasCycle(const Sheet& sheet, const std::vector<Cell*>& cells) const;
+
+    // True if formulas of the sheet refer to a sheet with dirty formulas,
+    // maybe to itself. Those are evaluated on first read then, which is not
+    // safe from several threads.
+    bool ReadsDirtySheet(const Sheet& sheet) const;
+
+    const std::string& GetName(const Sheet& sheet) const;
+    // True if the references between sheets lead from the sheet back to it,
+    // extra names count as references of the sheet. Only then a cycle of
+    // cells may pass through other sheets.
+    bool IsOnSheetCycle(const Sheet& sheet, const std::vector<SheetReference>& extra) const;
+    // Calls func(node) for the cells of any sheet the cell of the node refers to
+    template <typename Func>
+    void ForEachDependency(Node node, Func&& func) const;
+    // Searches the cells the stack leads to for the target
+    bool Reaches(std::vector<Node> stack, const Cell* target) const;
+    // Searches the cells the roots lead to for a cycle
+    bool HasCycleFrom(const std::vector<Node>& roots) const;
+
+    // Sheets with dirty formulas grouped by the cycles of references between
+    // them, every group goes to a level after the groups it refers to
+    std::vector<std::vector<std::vector<Sheet*>>> GetRecalculationLevels() const;
+
+    // a deque keeps the names in place for the keys of indices_
+    std::deque<Entry> sheets_;
+    std::unordered_map<std::string_view, size_t> indices_;
+    std::unordered_map<const Sheet*, size_t> sheet_indices_;
+
+    std::unordered_map<const Cell*, CellLink> links_;
+    std::unordered_map<std::string, Dependants> dependants_;
+    // formulas of every sheet referring to every sheet name
+    std::unordered_map<const Sheet*, std::unordered_map<std::string, size_t>> sheet_references_;
+
+    RecalcMode recalc_mode_ = RecalcMode::Automatic;
+    std::unique_ptr<ThreadPool> pool_;
+};
\ No newline at end of file